@@ -102,6 +102,20 @@ Base* CreateObject(const std::string& class_name)
     return (*iter->second)();
 }
 
+//按完整名称(namespace.class_name)查找对象生成器，未注册返回NULL
+//可预先查找并保存生成器，创建对象时不再拼接及查找名称
+template<typename Base>
+GenObjectFun<Base>* GetObjectGenerator(const std::string& full_class_name)
+{
+    typename std::map<std::string, GenObjectFun<Base>* >::const_iterator iter
+        = GetBaseMap<Base>().find(full_class_name);
+    if(iter == GetBaseMap<Base>().end())
+    {
+        return NULL;
+    }
+    return iter->second;
+}
+
 template<typename Base>
 bool HasRegisted(const std::string &class_namespace, const std::string& class_name)
 {
@@ -7,6 +7,7 @@
 
 #include <algorithm>
 #include <cassert>
+#include <mutex>
 
 #include "yapf/base/logging.h"
 
@@ -22,6 +23,15 @@ DAGNodePtr DAG::AllocNode(const std::string &name) {
   return node;
 }
 
+uint32_t DAG::InternNode(const std::string &name) {
+  std::pair<Name2NodeMap::iterator, bool> node_iter =
+      node_name_map_.emplace(name, 0u);
+  if (node_iter.second) {
+    node_iter.first->second = AllocNode(name)->id_;
+  }
+  return node_iter.first->second;
+}
+
 int DAG::AddNodeLinks(
     const std::vector<std::pair<std::string, std::string> > &links,
     const std::vector<std::string> &single_nodes,
@@ -31,6 +41,8 @@ int DAG::AddNodeLinks(
     return kDagOpRetEmptyLinks;
   }
   node_pool_.reserve(links.size() + single_nodes.size() + 2u);
+  node_name_map_.reserve(links.size() + single_nodes.size() + 2u);
+  pair_set_.reserve(links.size() * 2u + single_nodes.size());
   node_alias_name_map_.insert(node_alias_name_map.begin(),
                               node_alias_name_map.end());
   for (const auto &item : links) {
@@ -48,11 +60,8 @@ int DAG::AddNodeLinks(
                       << std::endl;
       return kDagOpRetInvalidName;
     }
-    std::pair<Name2NodeMap::iterator, bool> node_iter =
-        node_name_map_.emplace(node_name, 0u);
-    if (node_iter.second) {
-      auto new_node = AllocNode(node_name);
-      node_iter.first->second = new_node->id_;
+    if (node_name_map_.count(node_name) == 0) {
+      InternNode(node_name);
     } else {
       DAGPF_LOG_ERROR << "node " << node_name << " already created, ignore."
                       << std::endl;
@@ -65,31 +74,19 @@ int DAG::AddLink(const std::string &pre_node_name,
                  const std::string &next_node_name) {
   DAGPF_LOG_DEBUG << "add link " << pre_node_name << " -> " << next_node_name
                   << std::endl;
-  std::string bundle = pre_node_name + "->" + next_node_name;
-  if (pair_set_.count(bundle) != 0) {
+  // 名称只在此处查找一次，之后均按id处理
+  uint32_t pre_id = InternNode(pre_node_name);
+  return AddLink(pre_id, InternNode(next_node_name));
+}
+
+int DAG::AddLink(uint32_t pre_id, uint32_t next_id) {
+  if (!pair_set_.insert(PackLink(pre_id, next_id)).second) {
     return 0;
   }
-  pair_set_.insert(bundle);
-  //
-  std::pair<Name2NodeMap::iterator, bool> pre_node_iter =
-      node_name_map_.emplace(pre_node_name, 0u);
-  if (pre_node_iter.second) {
-    auto new_node = AllocNode(pre_node_name);
-    pre_node_iter.first->second = new_node->id_;
-  }
-  //
-  std::pair<Name2NodeMap::iterator, bool> next_node_iter =
-      node_name_map_.emplace(next_node_name, 0u);
-  if (next_node_iter.second) {
-    auto new_node = AllocNode(next_node_name);
-    next_node_iter.first->second = new_node->id_;
-  }
   // add node link
-  node_pool_[pre_node_iter.first->second]->links_.push_back(
-      next_node_iter.first->second);
+  node_pool_[pre_id]->links_.push_back(next_id);
   // inc indegree
-  node_pool_[next_node_iter.first->second]->indegree_.fetch_add(
-      1, std::memory_order_relaxed);
+  node_pool_[next_id]->indegree_.fetch_add(1, std::memory_order_relaxed);
   return 0;
 }
 
@@ -135,17 +132,17 @@ int DAG::Adjust() {
     DAGPF_LOG_ERROR << "empty start nodes or end nodes." << std::endl;
     return kDagOpRetNoStartEndNode;
   }
+  // set start node
+  start_node_id_ = InternNode(DAG::kStartNodeName);
+  node_pool_[start_node_id_]->full_name_ = DAG::kStartNodeName;
+  end_node_id_ = InternNode(DAG::kEndNodeName);
+  node_pool_[end_node_id_]->full_name_ = DAG::kEndNodeName;
   for (auto &node : start_nodes) {
-    AddLink(DAG::kStartNodeName, node->name_);
+    AddLink(start_node_id_, node->id_);
   }
   for (auto &node : end_nodes) {
-    AddLink(node->name_, DAG::kEndNodeName);
+    AddLink(node->id_, end_node_id_);
   }
-  // set start node
-  start_node_id_ = node_name_map_[DAG::kStartNodeName];
-  node_pool_[start_node_id_]->full_name_ = DAG::kStartNodeName;
-  end_node_id_ = node_name_map_[DAG::kEndNodeName];
-  node_pool_[end_node_id_]->full_name_ = DAG::kEndNodeName;
   // update node alias map if necessary
   if (!node_alias_name_map_.empty() &&
       node_alias_name_map_.find(DAG::kStartNodeName) ==
@@ -162,46 +159,228 @@ int DAG::Adjust() {
 
 // detect circle, collect node parents
 int DAG::Traverse() {
-  node_parents_.resize(kMaxDagNodeNum);
   if (has_traversed_) return 0;
-  int ret = DFS(node_pool_[start_node_id_]);
+  if (parallel_executor_ && ParallelTraverse() == 0) {
+    node_parents_ptr_ = &node_parents_;
+    has_traversed_ = true;
+    return 0;
+  }
+  const size_t node_num = node_pool_.size();
+  node_parents_.assign(node_num, std::vector<DAGNodePtr>());
+  node_visited_set_.assign(node_num, false);
+  recur_stack_set_.assign(node_num, false);
+  visited_count_ = 0;
+  int ret = DFS(start_node_id_);
   if (ret != 0) return ret;
-  if (node_visited_set_.count() != node_name_map_.size()) {
-    DAGPF_LOG_ERROR << "visited node count: " << node_visited_set_.count()
+  if (visited_count_ != node_name_map_.size()) {
+    DAGPF_LOG_ERROR << "visited node count: " << visited_count_
                     << ", all node count: " << node_name_map_.size()
                     << std::endl;
     return kDagOpRetNotConnected;
   }
+  BuildLevels();
   node_parents_ptr_ = &node_parents_;
   has_traversed_ = true;
   return 0;
 }
 
-int DAG::DFS(DAGNodePtr node) {
-  // TODO
-  node_visited_set_.set(node->id_);
-  recur_stack_set_.set(node->id_);
-  for (const auto &link_id : node->links_) {
-    if (node_visited_set_.test(link_id)) {
-      if (recur_stack_set_.test(link_id)) {
+// level synchronous Kahn, nodes of one level are processed in parallel
+int DAG::ParallelTraverse() {
+  const size_t node_num = node_pool_.size();
+  std::unique_ptr<std::atomic<int>[]> indegrees(new std::atomic<int>[node_num]);
+  for (const auto &node : node_pool_) {
+    indegrees[node->id_].store(node->indegree_.load(std::memory_order_relaxed),
+                               std::memory_order_relaxed);
+  }
+  levels_.assign(node_num, 0u);
+  std::vector<uint32_t> frontier(1, start_node_id_);
+  std::vector<uint32_t> next;
+  std::mutex next_mutex;
+  size_t visited = 0;
+  for (uint32_t level = 1; !frontier.empty(); ++level) {
+    visited += frontier.size();
+    next.clear();
+    parallel_executor_(frontier.size(), [&](size_t begin, size_t end) {
+      std::vector<uint32_t> ready;
+      for (size_t i = begin; i < end; ++i) {
+        for (const auto &child : node_pool_[frontier[i]]->links_) {
+          if (indegrees[child].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            levels_[child] = level;
+            ready.push_back(child);
+          }
+        }
+      }
+      std::lock_guard<std::mutex> locker(next_mutex);
+      next.insert(next.end(), ready.begin(), ready.end());
+    });
+    frontier.swap(next);
+  }
+  if (visited != node_num) {
+    DAGPF_LOG_ERROR << "layered node count: " << visited
+                    << ", all node count: " << node_num << std::endl;
+    return kDagOpRetNotTraversed;
+  }
+  // parents in node id order, independent of thread interleaving
+  node_parents_.assign(node_num, std::vector<DAGNodePtr>());
+  for (const auto &node : node_pool_) {
+    for (const auto &id : node->links_) {
+      node_parents_[id].push_back(node);
+    }
+  }
+  return 0;
+}
+
+// level of a node is the longest path from StartPhase
+void DAG::BuildLevels() {
+  const size_t node_num = node_pool_.size();
+  std::vector<int> indegrees(node_num, 0);
+  for (const auto &node : node_pool_) {
+    indegrees[node->id_] = node->indegree_.load(std::memory_order_relaxed);
+  }
+  levels_.assign(node_num, 0u);
+  std::vector<uint32_t> order(1, start_node_id_);
+  order.reserve(node_num);
+  for (size_t i = 0; i < order.size(); ++i) {
+    for (const auto &id : node_pool_[order[i]]->links_) {
+      levels_[id] = std::max(levels_[id], levels_[order[i]] + 1);
+      if (--indegrees[id] == 0) {
+        order.push_back(id);
+      }
+    }
+  }
+}
+
+// iterative dfs, stack depth does not grow with node count
+int DAG::DFS(uint32_t root_id) {
+  // (node id, index of next link to visit)
+  std::vector<std::pair<uint32_t, size_t>> stack;
+  stack.emplace_back(root_id, 0u);
+  node_visited_set_[root_id] = true;
+  recur_stack_set_[root_id] = true;
+  ++visited_count_;
+  while (!stack.empty()) {
+    auto &top = stack.back();
+    const auto &node = node_pool_[top.first];
+    if (top.second == node->links_.size()) {
+      recur_stack_set_[top.first] = false;
+      stack.pop_back();
+      continue;
+    }
+    uint32_t link_id = node->links_[top.second++];
+    node_parents_[link_id].push_back(node);
+    if (node_visited_set_[link_id]) {
+      if (recur_stack_set_[link_id]) {
         DAGPF_LOG_ERROR << "circle detected between node "
                         << node_pool_[link_id]->name_ << "->" << node->name_
                         << std::endl;
         return kDagOpRetHasCircle;
       }
-      node_parents_[link_id].push_back(node_pool_[node->id_]);
       continue;
     }
-    node_parents_[link_id].push_back(node_pool_[node->id_]);
-    int ret = DFS(node_pool_[link_id]);
-    if (ret != 0) {
-      return ret;
-    }
+    node_visited_set_[link_id] = true;
+    recur_stack_set_[link_id] = true;
+    ++visited_count_;
+    stack.emplace_back(link_id, 0u);
   }
-  recur_stack_set_.set(node->id_, false);
   return 0;
 }
 
+// transitive reduction, drop edge u->v if v is reachable from another child
+// of u. must be called on an acyclic graph, i.e. after Traverse
+void DAG::ReduceEdges() {
+  const size_t node_num = node_pool_.size();
+  // topology position of each node
+  std::vector<uint32_t> order;
+  std::vector<uint32_t> position(node_num, 0u);
+  std::vector<int> indegrees(node_num, 0);
+  order.reserve(node_num);
+  for (const auto &node : node_pool_) {
+    indegrees[node->id_] = node->indegree_.load(std::memory_order_relaxed);
+  }
+  order.push_back(start_node_id_);
+  for (size_t i = 0; i < order.size(); ++i) {
+    position[order[i]] = i;
+    for (const auto &id : node_pool_[order[i]]->links_) {
+      if (--indegrees[id] == 0) {
+        order.push_back(id);
+      }
+    }
+  }
+  std::vector<bool> keep_in_edges;
+  if (keep_in_edges_) {
+    keep_in_edges.resize(node_num, false);
+    for (const auto &node : node_pool_) {
+      keep_in_edges[node->id_] = keep_in_edges_(node->full_name_);
+    }
+  }
+  if (keep_in_edges_below_) {
+    // a node is only dominated through its ancestors, keeping all in edges
+    // of the descendants leaves the dominated subgraph unchanged
+    keep_in_edges.resize(node_num, false);
+    std::vector<bool> below(node_num, false);
+    for (const auto &id : order) {
+      if (!below[id] && !keep_in_edges_below_(node_pool_[id]->full_name_)) {
+        continue;
+      }
+      for (const auto &child : node_pool_[id]->links_) {
+        below[child] = true;
+        keep_in_edges[child] = true;
+      }
+    }
+  }
+  // mark descendants of kept children, stamp avoids clearing per node
+  std::vector<uint32_t> reached_stamp(node_num, 0u);
+  std::vector<uint32_t> stack;
+  uint32_t stamp = 0;
+  size_t reduced = 0;
+  for (const auto &node : node_pool_) {
+    auto &links = node->links_;
+    if (links.size() < 2u) continue;
+    ++stamp;
+    // a child reachable from a sibling always has a larger position
+    std::sort(links.begin(), links.end(), [&position](uint32_t l, uint32_t r) {
+      return position[l] < position[r];
+    });
+    size_t kept = 0;
+    for (size_t i = 0; i < links.size(); ++i) {
+      uint32_t child = links[i];
+      if (reached_stamp[child] == stamp &&
+          (keep_in_edges.empty() || !keep_in_edges[child])) {
+        DAGPF_LOG_DEBUG << "reduce edge " << node->name_ << " -> "
+                        << node_pool_[child]->name_ << std::endl;
+        pair_set_.erase(PackLink(node->id_, child));
+        node_pool_[child]->indegree_.fetch_sub(1, std::memory_order_relaxed);
+        ++reduced;
+        continue;
+      }
+      links[kept++] = child;
+      reached_stamp[child] = stamp;
+      stack.push_back(child);
+      while (!stack.empty()) {
+        uint32_t id = stack.back();
+        stack.pop_back();
+        for (const auto &next : node_pool_[id]->links_) {
+          if (reached_stamp[next] != stamp) {
+            reached_stamp[next] = stamp;
+            stack.push_back(next);
+          }
+        }
+      }
+    }
+    links.resize(kept);
+  }
+  reduced_edge_count_ = reduced;
+  if (reduced == 0) return;
+  // rebuild node parents
+  for (auto &parents : node_parents_) {
+    parents.clear();
+  }
+  for (const auto &node : node_pool_) {
+    for (const auto &id : node->links_) {
+      node_parents_[id].push_back(node);
+    }
+  }
+}
 
 // display topology sort result
 void DAG::List() {
@@ -248,6 +427,7 @@ int DAG::CopyFrom(const DAG &source) {
   this->node_parents_ptr_ = source.node_parents_ptr_;
   this->start_node_id_ = source.start_node_id_;
   this->end_node_id_ = source.end_node_id_;
+  this->levels_ = source.levels_;
   for (auto &node : node_pool_) {
     auto new_node = std::make_shared<DAGNode>(node->name_, node->id_);
     *new_node = *node;
@@ -256,6 +436,95 @@ int DAG::CopyFrom(const DAG &source) {
   return 0;
 }
 
+int DAG::Compile(DAGPlanPtr &plan) const {
+  if (!has_traversed_) {
+    DAGPF_LOG_ERROR << "DAG not traversed, cant compile." << std::endl;
+    return kDagOpRetNotTraversed;
+  }
+  auto new_plan = std::make_shared<DAGPlan>();
+  new_plan->nodes_.resize(node_pool_.size());
+  size_t edge_count = 0;
+  for (const auto &node : node_pool_) {
+    edge_count += node->links_.size();
+  }
+  new_plan->links_.reserve(edge_count);
+  new_plan->parents_.reserve(edge_count);
+  // intern names, views are set once the table stops growing
+  std::vector<std::pair<size_t, size_t>> name_offsets(node_pool_.size());
+  auto &string_table = new_plan->string_table_;
+  for (const auto &node : node_pool_) {
+    name_offsets[node->id_].first = string_table.size();
+    string_table.append(node->name_);
+    name_offsets[node->id_].second = string_table.size();
+    string_table.append(node->full_name_);
+  }
+  for (const auto &node : node_pool_) {
+    auto &plan_node = new_plan->nodes_[node->id_];
+    const auto &offset = name_offsets[node->id_];
+    plan_node.id = node->id_;
+    plan_node.indegree = node->indegree_.load(std::memory_order_relaxed);
+    plan_node.level = levels_[node->id_];
+    plan_node.name = std::string_view(string_table.data() + offset.first,
+                                      node->name_.size());
+    plan_node.full_name = std::string_view(
+        string_table.data() + offset.second, node->full_name_.size());
+    plan_node.link_begin = new_plan->links_.size();
+    new_plan->links_.insert(new_plan->links_.end(), node->links_.begin(),
+                            node->links_.end());
+    plan_node.link_end = new_plan->links_.size();
+    plan_node.parent_begin = new_plan->parents_.size();
+    for (const auto &parent : (*node_parents_ptr_)[node->id_]) {
+      new_plan->parents_.push_back(parent->id_);
+    }
+    plan_node.parent_end = new_plan->parents_.size();
+  }
+  new_plan->start_node_id_ = start_node_id_;
+  new_plan->end_node_id_ = end_node_id_;
+  plan = std::move(new_plan);
+  return 0;
+}
+
+void DAGPlan::GetTopologyOrder(std::vector<uint32_t> &order) const {
+  order.clear();
+  order.reserve(nodes_.size());
+  std::vector<int> indegrees(nodes_.size());
+  for (const auto &node : nodes_) {
+    indegrees[node.id] = node.indegree;
+  }
+  order.push_back(start_node_id_);
+  for (size_t i = 0; i < order.size(); ++i) {
+    for (const auto &id : GetLinks(order[i])) {
+      if (--indegrees[id] == 0) {
+        order.push_back(id);
+      }
+    }
+  }
+}
+
+// dominators on a DAG, single pass in topology order (Cooper et al.)
+void DAGPlan::GetImmediateDominators(std::vector<uint32_t> &idom) const {
+  std::vector<uint32_t> order;
+  GetTopologyOrder(order);
+  std::vector<uint32_t> position(nodes_.size(), 0u);
+  for (size_t i = 0; i < order.size(); ++i) {
+    position[order[i]] = i;
+  }
+  idom.assign(nodes_.size(), start_node_id_);
+  for (const auto &id : order) {
+    auto parents = GetParents(id);
+    if (parents.empty()) continue;
+    uint32_t dom = *parents.begin();
+    for (const auto &parent : parents) {
+      uint32_t other = parent;
+      while (dom != other) {
+        while (position[dom] > position[other]) dom = idom[dom];
+        while (position[other] > position[dom]) other = idom[other];
+      }
+    }
+    idom[id] = dom;
+  }
+}
+
 int DAG::TraverseAction(NodeVisitor functor) const {
   for (auto &node : node_pool_) {
     int ret = (functor)(node);
@@ -273,8 +542,11 @@ void DAG::Clear() {
   start_node_id_ = 0;
   end_node_id_ = 0;
   pair_set_.clear();
-  node_visited_set_.reset();
-  recur_stack_set_.reset();
+  node_visited_set_.clear();
+  recur_stack_set_.clear();
+  visited_count_ = 0;
+  reduced_edge_count_ = 0;
+  levels_.clear();
   node_parents_.clear();
   node_name_map_.clear();
   node_alias_name_map_.clear();
@@ -8,13 +8,13 @@
 #define DAG_PROCESSING_H_
 
 #include <atomic>
-#include <bitset>
 #include <functional>
 #include <iostream>
 #include <map>
 #include <memory>
 #include <set>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -32,6 +32,7 @@ enum EDAGOpRet {
   kDagOpRetEmptyNodes,
   kDagOpRetNoReadyNodes,
   kDagOpRetInvalidCopy,
+  kDagOpRetNotTraversed,
 };
 
 class DAGNode {
@@ -79,6 +80,75 @@ using DAGNodePtr = std::shared_ptr<DAGNode>;
 
 using NodeVisitor = std::function<int(DAGNodePtr node)>;
 
+//并行执行[0, n)，fn按区间调用，返回前所有区间均已执行完
+using ParallelExecutor = std::function<void(
+    size_t n, const std::function<void(size_t begin, size_t end)> &fn)>;
+
+// 编译后的只读节点信息
+struct DAGPlanNode {
+  uint32_t id{0};            //节点唯一id
+  int indegree{0};           //初始入度
+  uint32_t link_begin{0};    //出边在DAGPlan::links_中的区间
+  uint32_t link_end{0};      //
+  uint32_t parent_begin{0};  //入边在DAGPlan::parents_中的区间
+  uint32_t parent_end{0};    //
+  uint32_t level{0};         //拓扑层级，见DAG::GetLevels
+  std::string_view name;       //节点唯一名称，指向DAGPlan字符串表
+  std::string_view full_name;  //节点全称
+};
+
+// 连续存储的节点id区间
+struct NodeIdRange {
+  const uint32_t *begin() const { return first; }
+  const uint32_t *end() const { return last; }
+  size_t size() const { return last - first; }
+  bool empty() const { return first == last; }
+
+  const uint32_t *first{nullptr};
+  const uint32_t *last{nullptr};
+};
+
+// 编译后的DAG执行计划
+// 由DAG::Compile生成，构建完成后只读，所有请求共享同一份
+// 出边/入边以CSR方式存储，请求级入度计数由调度器维护
+class DAGPlan {
+  friend class DAG;
+  friend class PlanFile;
+
+ public:
+  DAGPlan() = default;
+  DAGPlan(const DAGPlan &) = delete;
+  DAGPlan &operator=(const DAGPlan &) = delete;
+  size_t Size() const { return nodes_.size(); }
+  const DAGPlanNode &GetNode(uint32_t id) const { return nodes_[id]; }
+  NodeIdRange GetLinks(uint32_t id) const {
+    const auto &node = nodes_[id];
+    return {links_.data() + node.link_begin, links_.data() + node.link_end};
+  }
+  NodeIdRange GetParents(uint32_t id) const {
+    const auto &node = nodes_[id];
+    return {parents_.data() + node.parent_begin,
+            parents_.data() + node.parent_end};
+  }
+  uint32_t GetStartNodeId() const { return start_node_id_; }
+  uint32_t GetEndNodeId() const { return end_node_id_; }
+  size_t GetEdgeCount() const { return links_.size(); }
+  //输出拓扑序(Kahn)，StartPhase在前，EndPhase在后
+  void GetTopologyOrder(std::vector<uint32_t> &order) const;
+  //计算直接支配节点，StartPhase的支配节点为自身
+  void GetImmediateDominators(std::vector<uint32_t> &idom) const;
+
+ private:
+  std::vector<DAGPlanNode> nodes_;
+  std::vector<uint32_t> links_;    //所有节点出边
+  std::vector<uint32_t> parents_;  //所有节点入边
+  std::string string_table_;       //所有节点名称，节点名称为其中的区间
+  uint32_t start_node_id_{0};
+  uint32_t end_node_id_{0};
+};
+
+using DAGPlanPtr = std::shared_ptr<const DAGPlan>;
+
 class DAG {
  public:
   DAG() = default;
@@ -95,6 +165,7 @@ class DAG {
   int Pop(DAGNodePtr parent, std::vector<DAGNodePtr> &top_nodes);
   //对依赖关系预处理并判断有效性
   //输出拓扑排序结果
+  //设置parallel_executor时并行校验节点、并行Kahn分层，valid_functor需线程安全
   int Init(auto &&valid_functor) {
     int ret = Adjust();
     if (ret != 0) {
@@ -113,14 +184,40 @@ class DAG {
                       << std::endl;
       return ret;
     }
+    if (enable_transitive_reduction_) {
+      ReduceEdges();
+    }
     return 0;
   }
+  //Init时去除传递冗余边(a->b,b->c时的a->c)，不改变依赖语义
+  void EnableTransitiveReduction(bool enable) {
+    enable_transitive_reduction_ = enable;
+  }
+  //传递约简时保留全部入边的节点(按全称判断)，如按父节点个数汇合的节点
+  void SetKeepInEdges(std::function<bool(const std::string &)> keep) {
+    keep_in_edges_ = std::move(keep);
+  }
+  //传递约简时其全部后代节点保留入边的节点(按全称判断)，
+  //约简后这些节点支配的子图不变，如skip_children节点
+  void SetKeepInEdgesBelow(std::function<bool(const std::string &)> keep) {
+    keep_in_edges_below_ = std::move(keep);
+  }
+  //传递约简去除的边数
+  size_t GetReducedEdgeCount() const { return reduced_edge_count_; }
+  //大图构建时使用，如调度线程池
+  void SetParallelExecutor(ParallelExecutor executor) {
+    parallel_executor_ = std::move(executor);
+  }
+  //各节点拓扑层级，StartPhase为0，其余为父节点最大层级+1，Init后有效
+  const std::vector<uint32_t> &GetLevels() const { return levels_; }
   void List();
   //获取节点的依赖节点集合
   int GetDepNodes(DAGNodePtr node, std::vector<DAGNodePtr> &parents);
   DAGNodePtr GetStartNode() { return node_pool_[start_node_id_]; }
   DAGNodePtr GetEndNode() { return node_pool_[end_node_id_]; }
   int CopyFrom(const DAG &source);
+  //生成只读执行计划，需在Init成功后调用
+  int Compile(DAGPlanPtr &plan) const;
   int TraverseAction(NodeVisitor functor) const;
   size_t Size() const { return node_pool_.size(); }
   void Clear();
@@ -131,27 +228,50 @@ class DAG {
 
  private:
   DAGNodePtr AllocNode(const std::string &);
+  //查找或分配名称对应的节点，返回节点id
+  uint32_t InternNode(const std::string &name);
+  //边以两端节点id打包为64位整数去重
+  static uint64_t PackLink(uint32_t pre_id, uint32_t next_id) {
+    return (static_cast<uint64_t>(pre_id) << 32) | next_id;
+  }
   //检验DAG图有效性
   int CheckValidity(auto &&valid_functor) {
-    bool has_alias = !node_alias_name_map_.empty();
-    for (auto &node : node_pool_) {
-      if (has_alias) {
-        auto alias_iter = node_alias_name_map_.find(node->name_);
-        if (alias_iter == node_alias_name_map_.end()) {
-          DAGPF_LOG_ERROR << "cant find full name for alias: " << node->name_
-                          << std::endl;
-          return kDagOpRetInvalidName;
+    if (parallel_executor_) {
+      std::atomic<int> ret{0};
+      parallel_executor_(node_pool_.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin;
+             i < end && ret.load(std::memory_order_relaxed) == 0; ++i) {
+          int node_ret = CheckNode(*node_pool_[i], valid_functor);
+          if (node_ret != 0) {
+            ret.store(node_ret, std::memory_order_relaxed);
+          }
         }
-        node->full_name_ = alias_iter->second;
-      } else {
-        node->full_name_ = node->name_;
-      }
-      // check if can create instance
-      if (!valid_functor(node->full_name_)) {
-        DAGPF_LOG_ERROR << "not registered, alias: " << node->name_
-                        << ", full name: " << node->full_name_ << std::endl;
+      });
+      return ret.load(std::memory_order_relaxed);
+    }
+    for (auto &node : node_pool_) {
+      int ret = CheckNode(*node, valid_functor);
+      if (ret != 0) return ret;
+    }
+    return 0;
+  }
+  int CheckNode(DAGNode &node, auto &&valid_functor) {
+    if (!node_alias_name_map_.empty()) {
+      auto alias_iter = node_alias_name_map_.find(node.name_);
+      if (alias_iter == node_alias_name_map_.end()) {
+        DAGPF_LOG_ERROR << "cant find full name for alias: " << node.name_
+                        << std::endl;
         return kDagOpRetInvalidName;
       }
+      node.full_name_ = alias_iter->second;
+    } else {
+      node.full_name_ = node.name_;
+    }
+    // check if can create instance
+    if (!valid_functor(node.full_name_)) {
+      DAGPF_LOG_ERROR << "not registered, alias: " << node.name_
+                      << ", full name: " << node.full_name_ << std::endl;
+      return kDagOpRetInvalidName;
     }
     return 0;
   }
@@ -159,28 +279,39 @@ class DAG {
   int Traverse();
   int AddLink(const std::string &pre_node_name,
               const std::string &next_node_name);
-  int DFS(DAGNodePtr node);
+  int AddLink(uint32_t pre_id, uint32_t next_id);
+  int DFS(uint32_t root_id);
+  //按层并行Kahn遍历，有环或不可达节点时返回非0，由DFS给出具体错误
+  int ParallelTraverse();
+  void BuildLevels();
+  void ReduceEdges();
   int InnerPop(DAGNodePtr parent, std::vector<DAGNodePtr> &topNodes);
   bool IsReservedName(const std::string &);
 
  private:
   using Name2NodeMap = std::unordered_map<std::string, uint32_t>;
-  using StringSet = std::unordered_set<std::string>;
+  using LinkSet = std::unordered_set<uint64_t>;
   using NodeAliasNameMap = std::unordered_map<std::string, std::string>;
   std::vector<DAGNodePtr> node_pool_;  //节点池
   Name2NodeMap node_name_map_;         //节点名称到id映射关系
   uint32_t allocated_node_id_{0};      //已分配节点序号
   NodeAliasNameMap node_alias_name_map_;
   bool has_traversed_{false};
-  StringSet pair_set_;  // link去重
-  inline static constexpr size_t kMaxDagNodeNum = 1024;
-  std::bitset<kMaxDagNodeNum> node_visited_set_;       //是否已访问
-  std::bitset<kMaxDagNodeNum> recur_stack_set_;        // dfs访问轨迹记录
+  LinkSet pair_set_;  // link去重，见PackLink
+  std::vector<bool> node_visited_set_;  //是否已访问，按实际节点数分配
+  std::vector<bool> recur_stack_set_;   // dfs访问轨迹记录
+  size_t visited_count_{0};             //已访问节点数
   std::vector<std::vector<DAGNodePtr>> node_parents_;  //节点的依赖关系
   std::vector<std::vector<DAGNodePtr>> *node_parents_ptr_{
       nullptr};  //节点的依赖关系ptr
   uint32_t start_node_id_{0};
   uint32_t end_node_id_{0};
+  bool enable_transitive_reduction_{false};  //是否做传递约简
+  size_t reduced_edge_count_{0};             //约简去除的边数
+  std::function<bool(const std::string &)> keep_in_edges_;  //不约简入边
+  std::function<bool(const std::string &)> keep_in_edges_below_;  //后代不约简
+  ParallelExecutor parallel_executor_;       //为空时串行构建
+  std::vector<uint32_t> levels_;             //节点拓扑层级
   // TODO modify copyFrom together
 };
 
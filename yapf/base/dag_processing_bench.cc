@@ -0,0 +1,54 @@
+// File Name: dag_processing_bench.cc
+// Description: DAG构建耗时基准测试
+// bazel run -c opt //yapf/base:dag_processing_bench
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "yapf/base/dag_processing.h"
+
+namespace yapf {
+
+// per-item fan-out pipeline: source -> item_i_0 -> ... -> item_i_k -> sink
+static std::vector<std::pair<std::string, std::string>> GenPipelineLinks(
+    size_t node_num, size_t stage_num) {
+  std::vector<std::pair<std::string, std::string>> links;
+  size_t item_num = node_num / stage_num;
+  links.reserve(item_num * (stage_num + 1));
+  for (size_t i = 0; i < item_num; ++i) {
+    std::string prefix = "item_" + std::to_string(i) + "_";
+    links.emplace_back("source", prefix + "0");
+    for (size_t j = 1; j < stage_num; ++j) {
+      links.emplace_back(prefix + std::to_string(j - 1),
+                         prefix + std::to_string(j));
+    }
+    links.emplace_back(prefix + std::to_string(stage_num - 1), "sink");
+  }
+  return links;
+}
+
+static void BM_BuildDAG(benchmark::State &state) {
+  auto links = GenPipelineLinks(state.range(0), 4);
+  for (auto _ : state) {
+    DAG dag;
+    dag.AddNodeLinks(links);
+    int ret = dag.Init([](const auto &name) -> bool { return true; });
+    DAGPlanPtr plan;
+    dag.Compile(plan);
+    benchmark::DoNotOptimize(ret);
+    benchmark::DoNotOptimize(plan);
+  }
+  state.counters["nodes"] = state.range(0);
+  state.counters["edges"] = links.size();
+}
+
+BENCHMARK(BM_BuildDAG)
+    ->RangeMultiplier(10)
+    ->Range(1000, 100000)
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace yapf
+
+BENCHMARK_MAIN();
@@ -6,6 +6,8 @@
 #include "yapf/base/dag_processing.h"
 #include "yapf/base/phase_common.h"
 
+#include <thread>
+
 #include "gtest/gtest.h"
 
 namespace yapf {
@@ -65,5 +67,265 @@ TEST(DAGProcessingTest, NormalDAG) {
   EXPECT_STREQ(parents[0]->GetName().c_str(), "StartPhase");
 }
 
-}  // namespace yapf
+TEST(DAGProcessingTest, CompiledPlan) {
+  DAG dag;
+  std::vector<std::pair<std::string, std::string> > pairs;
+  std::vector<std::string> single_nodes;
+  std::vector<std::string> exprs{"a->b", "a->c", "b->d", "c->d"};
+  EXPECT_EQ(0, ParseExprs(exprs, pairs, single_nodes));
+  EXPECT_EQ(0, dag.AddNodeLinks(pairs, single_nodes));
+  DAGPlanPtr plan;
+  EXPECT_EQ(kDagOpRetNotTraversed, dag.Compile(plan));
+  EXPECT_EQ(0, dag.Init([](const auto &t) -> bool { return true; }));
+  EXPECT_EQ(0, dag.Compile(plan));
+  ASSERT_TRUE(plan != nullptr);
+  EXPECT_EQ(plan->Size(), dag.Size());
+  // a->b, a->c, b->d, c->d, StartPhase->a, d->EndPhase
+  EXPECT_EQ(plan->GetEdgeCount(), 6u);
+  EXPECT_EQ(plan->GetNode(plan->GetStartNodeId()).name, "StartPhase");
+  EXPECT_EQ(plan->GetNode(plan->GetEndNodeId()).full_name, "EndPhase");
+  auto start_links = plan->GetLinks(plan->GetStartNodeId());
+  ASSERT_EQ(start_links.size(), 1u);
+  uint32_t a = *start_links.begin();
+  EXPECT_EQ(plan->GetNode(a).name, "a");
+  auto a_links = plan->GetLinks(a);
+  ASSERT_EQ(a_links.size(), 2u);
+  uint32_t d = plan->GetLinks(*a_links.begin()).first[0];
+  EXPECT_EQ(plan->GetNode(d).name, "d");
+  EXPECT_EQ(plan->GetParents(d).size(), 2u);
+  EXPECT_EQ(plan->GetNode(d).indegree, 2);
+  EXPECT_EQ(plan->GetNode(a).indegree, 1);
+}
+
+TEST(DAGProcessingTest, DuplicateLinks) {
+  DAG dag;
+  std::vector<std::pair<std::string, std::string> > pairs{
+      {"a", "b"}, {"a", "b"}, {"b", "c"}, {"a", "b"}};
+  EXPECT_EQ(0, dag.AddNodeLinks(pairs, {"c"}));
+  EXPECT_EQ(3u, dag.Size());
+  EXPECT_EQ(0, dag.Init([](const auto &t) -> bool { return true; }));
+  DAGPlanPtr plan;
+  EXPECT_EQ(0, dag.Compile(plan));
+  // a->b, b->c, StartPhase->a, c->EndPhase
+  EXPECT_EQ(4u, plan->GetEdgeCount());
+  for (uint32_t id = 0; id < plan->Size(); ++id) {
+    EXPECT_EQ(plan->GetNode(id).name == "StartPhase" ? 0 : 1,
+              plan->GetNode(id).indegree);
+  }
+}
+
+TEST(DAGProcessingTest, TransitiveReduction) {
+  DAG dag;
+  dag.EnableTransitiveReduction(true);
+  std::vector<std::pair<std::string, std::string> > pairs;
+  std::vector<std::string> single_nodes;
+  // a->c, a->d and b->d are implied by the other edges
+  std::vector<std::string> exprs{"a->b", "b->c", "a->c", "c->d",
+                                 "a->d", "b->d", "e->d"};
+  EXPECT_EQ(0, ParseExprs(exprs, pairs, single_nodes));
+  EXPECT_EQ(0, dag.AddNodeLinks(pairs, single_nodes));
+  EXPECT_EQ(0, dag.Init([](const auto &t) -> bool { return true; }));
+  EXPECT_EQ(dag.GetReducedEdgeCount(), 3u);
+  DAGPlanPtr plan;
+  EXPECT_EQ(0, dag.Compile(plan));
+  // a->b, b->c, c->d, e->d, StartPhase->a, StartPhase->e, d->EndPhase
+  EXPECT_EQ(plan->GetEdgeCount(), 7u);
+  std::unordered_map<std::string, uint32_t> ids;
+  for (uint32_t id = 0; id < plan->Size(); ++id) {
+    ids[std::string(plan->GetNode(id).name)] = id;
+  }
+  auto parent_names = [&](const std::string &name) {
+    std::set<std::string> names;
+    for (const auto &parent : plan->GetParents(ids[name])) {
+      names.emplace(plan->GetNode(parent).name);
+    }
+    return names;
+  };
+  EXPECT_EQ(parent_names("c"), std::set<std::string>({"b"}));
+  EXPECT_EQ(parent_names("d"), std::set<std::string>({"c", "e"}));
+  EXPECT_EQ(plan->GetNode(ids["d"]).indegree, 2);
+  std::vector<uint32_t> order;
+  plan->GetTopologyOrder(order);
+  EXPECT_EQ(order.size(), plan->Size());
+}
+
+TEST(DAGProcessingTest, KeepInEdges) {
+  DAG dag;
+  dag.EnableTransitiveReduction(true);
+  // d joins by parent count, all its in edges are kept
+  dag.SetKeepInEdges([](const std::string &full_name) {
+    return full_name == "d";
+  });
+  std::vector<std::pair<std::string, std::string> > pairs;
+  std::vector<std::string> single_nodes;
+  std::vector<std::string> exprs{"a->b", "b->c", "a->c", "c->d",
+                                 "a->d", "b->d", "e->d"};
+  EXPECT_EQ(0, ParseExprs(exprs, pairs, single_nodes));
+  EXPECT_EQ(0, dag.AddNodeLinks(pairs, single_nodes));
+  EXPECT_EQ(0, dag.Init([](const auto &t) -> bool { return true; }));
+  // only a->c
+  EXPECT_EQ(dag.GetReducedEdgeCount(), 1u);
+  DAGPlanPtr plan;
+  EXPECT_EQ(0, dag.Compile(plan));
+  for (uint32_t id = 0; id < plan->Size(); ++id) {
+    if (plan->GetNode(id).name == "d") {
+      EXPECT_EQ(plan->GetNode(id).indegree, 4);
+    }
+  }
+}
+
+TEST(DAGProcessingTest, KeepInEdgesBelow) {
+  // a->x->y with a->y, y is not dominated by x unless a->y is reduced
+  for (bool reduction : {false, true}) {
+    DAG dag;
+    dag.EnableTransitiveReduction(reduction);
+    dag.SetKeepInEdgesBelow([](const std::string &full_name) {
+      return full_name == "x";
+    });
+    std::vector<std::pair<std::string, std::string> > pairs;
+    std::vector<std::string> single_nodes;
+    std::vector<std::string> exprs{"a->x", "x->y", "a->y", "a->b",
+                                   "b->c", "a->c"};
+    EXPECT_EQ(0, ParseExprs(exprs, pairs, single_nodes));
+    EXPECT_EQ(0, dag.AddNodeLinks(pairs, single_nodes));
+    EXPECT_EQ(0, dag.Init([](const auto &t) -> bool { return true; }));
+    // a->c is still reduced
+    EXPECT_EQ(dag.GetReducedEdgeCount(), reduction ? 1u : 0u);
+    DAGPlanPtr plan;
+    EXPECT_EQ(0, dag.Compile(plan));
+    std::vector<uint32_t> idom;
+    plan->GetImmediateDominators(idom);
+    std::unordered_map<std::string, std::string> names;
+    for (uint32_t id = 0; id < plan->Size(); ++id) {
+      names[std::string(plan->GetNode(id).name)] =
+          plan->GetNode(idom[id]).name;
+    }
+    EXPECT_EQ(names["y"], "a");
+    // c is not below x, reducing a->c makes b its dominator
+    EXPECT_EQ(names["c"], reduction ? "b" : "a");
+  }
+}
 
+TEST(DAGProcessingTest, Dominators) {
+  DAG dag;
+  std::vector<std::pair<std::string, std::string> > pairs;
+  std::vector<std::string> single_nodes;
+  std::vector<std::string> exprs{"a->b", "b->c", "b->d", "c->e",
+                                 "d->e", "a->f", "f->e"};
+  EXPECT_EQ(0, ParseExprs(exprs, pairs, single_nodes));
+  EXPECT_EQ(0, dag.AddNodeLinks(pairs, single_nodes));
+  EXPECT_EQ(0, dag.Init([](const auto &t) -> bool { return true; }));
+  DAGPlanPtr plan;
+  EXPECT_EQ(0, dag.Compile(plan));
+  std::vector<uint32_t> idom;
+  plan->GetImmediateDominators(idom);
+  ASSERT_EQ(idom.size(), plan->Size());
+  std::unordered_map<std::string, std::string> names;
+  for (uint32_t id = 0; id < plan->Size(); ++id) {
+    names[std::string(plan->GetNode(id).name)] = plan->GetNode(idom[id]).name;
+  }
+  EXPECT_EQ(names["a"], "StartPhase");
+  EXPECT_EQ(names["b"], "a");
+  EXPECT_EQ(names["c"], "b");
+  EXPECT_EQ(names["d"], "b");
+  EXPECT_EQ(names["f"], "a");
+  EXPECT_EQ(names["e"], "a");
+  EXPECT_EQ(names["EndPhase"], "e");
+}
+
+TEST(DAGProcessingTest, LargeDAG) {
+  // deep chain plus wide fan-out, far beyond the old 1024 node limit
+  constexpr size_t kChainLen = 100000;
+  constexpr size_t kFanOut = 20000;
+  std::vector<std::pair<std::string, std::string> > pairs;
+  pairs.reserve(kChainLen + kFanOut);
+  for (size_t i = 1; i < kChainLen; ++i) {
+    pairs.emplace_back("n" + std::to_string(i - 1), "n" + std::to_string(i));
+  }
+  for (size_t i = 0; i < kFanOut; ++i) {
+    pairs.emplace_back("n0", "f" + std::to_string(i));
+  }
+  {
+    DAG dag;
+    EXPECT_EQ(0, dag.AddNodeLinks(pairs));
+    EXPECT_EQ(0, dag.Init([](const auto &t) -> bool { return true; }));
+    EXPECT_EQ(dag.Size(), kChainLen + kFanOut + 2u);
+  }
+  // circle at the tail of the chain
+  pairs.emplace_back("n" + std::to_string(kChainLen - 1), "n1");
+  {
+    DAG dag;
+    EXPECT_EQ(0, dag.AddNodeLinks(pairs));
+    EXPECT_EQ(kDagOpRetHasCircle,
+              dag.Init([](const auto &t) -> bool { return true; }));
+  }
+}
+
+TEST(DAGProcessingTest, ParallelInit) {
+  // layered graph: every node of layer i links to two nodes of layer i+1
+  constexpr size_t kLayerNum = 50;
+  constexpr size_t kLayerWidth = 400;
+  std::vector<std::pair<std::string, std::string> > pairs;
+  std::unordered_map<std::string, std::string> alias_map;
+  for (size_t layer = 0; layer < kLayerNum; ++layer) {
+    for (size_t i = 0; i < kLayerWidth; ++i) {
+      std::string name = "n" + std::to_string(layer) + "_" + std::to_string(i);
+      alias_map[name] = "Phase" + std::to_string(i % 7);
+      if (layer + 1 == kLayerNum) continue;
+      for (size_t j : {i, (i + 1) % kLayerWidth}) {
+        pairs.emplace_back(
+            name, "n" + std::to_string(layer + 1) + "_" + std::to_string(j));
+      }
+    }
+  }
+  // split into four threads
+  auto executor = [](size_t n,
+                     const std::function<void(size_t, size_t)> &fn) {
+    std::vector<std::thread> threads;
+    const size_t step = (n + 3) / 4;
+    for (size_t begin = 0; begin < n; begin += step) {
+      threads.emplace_back(fn, begin, std::min(n, begin + step));
+    }
+    for (auto &thread : threads) thread.join();
+  };
+  std::atomic<size_t> checked{0};
+  auto is_valid = [&checked](const std::string &full_name) -> bool {
+    checked.fetch_add(1);
+    return full_name != "Phase6";
+  };
+  DAG serial_dag, parallel_dag;
+  EXPECT_EQ(0, serial_dag.AddNodeLinks(pairs, {}, alias_map));
+  EXPECT_EQ(0, serial_dag.Init([](const auto &t) -> bool { return true; }));
+  parallel_dag.SetParallelExecutor(executor);
+  EXPECT_EQ(0, parallel_dag.AddNodeLinks(pairs, {}, alias_map));
+  EXPECT_EQ(0, parallel_dag.Init([&checked](const auto &t) -> bool {
+    checked.fetch_add(1);
+    return true;
+  }));
+  EXPECT_EQ(kLayerNum * kLayerWidth + 2u, checked.load());
+  EXPECT_EQ(serial_dag.GetLevels(), parallel_dag.GetLevels());
+  DAGPlanPtr serial_plan, parallel_plan;
+  EXPECT_EQ(0, serial_dag.Compile(serial_plan));
+  EXPECT_EQ(0, parallel_dag.Compile(parallel_plan));
+  EXPECT_EQ(serial_plan->GetEdgeCount(), parallel_plan->GetEdgeCount());
+  EXPECT_EQ(kLayerNum + 1,
+            parallel_plan->GetNode(parallel_plan->GetEndNodeId()).level);
+  for (uint32_t id = 0; id < parallel_plan->Size(); ++id) {
+    EXPECT_EQ(serial_plan->GetParents(id).size(),
+              parallel_plan->GetParents(id).size());
+  }
+  // invalid phase found by a worker
+  DAG invalid_dag;
+  invalid_dag.SetParallelExecutor(executor);
+  EXPECT_EQ(0, invalid_dag.AddNodeLinks(pairs, {}, alias_map));
+  EXPECT_EQ(kDagOpRetInvalidName, invalid_dag.Init(is_valid));
+  // circle falls back to dfs for the error code
+  pairs.emplace_back("n" + std::to_string(kLayerNum - 1) + "_0", "n1_0");
+  DAG circle_dag;
+  circle_dag.SetParallelExecutor(executor);
+  EXPECT_EQ(0, circle_dag.AddNodeLinks(pairs, {}, alias_map));
+  EXPECT_EQ(kDagOpRetHasCircle,
+            circle_dag.Init([](const auto &t) -> bool { return true; }));
+}
+
+}  // namespace yapf
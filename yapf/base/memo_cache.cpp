@@ -0,0 +1,79 @@
+// File Name: memo_cache.cpp
+// Description:
+
+#include "yapf/base/memo_cache.h"
+
+#include <utility>
+
+#include "yapf/base/utils.h"
+
+namespace yapf {
+
+void MemoCache::Init(size_t capacity, int64_t ttl_ms) {
+  shard_capacity_ = (capacity + kShardNum - 1) / kShardNum;
+  ttl_ms_ = ttl_ms;
+  Clear();
+}
+
+bool MemoCache::Get(const std::string &key, MemoValue &value) {
+  Shard &shard = GetShard(key);
+  {
+    std::lock_guard<std::mutex> locker(shard.mutex);
+    auto iter = shard.index.find(key);
+    if (iter != shard.index.end()) {
+      auto entry = iter->second;
+      if (entry->expire_ms > static_cast<int64_t>(Utils::getNowMs())) {
+        shard.entries.splice(shard.entries.begin(), shard.entries, entry);
+        value = entry->value;
+        hit_count_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+      }
+      // expired
+      shard.index.erase(iter);
+      shard.entries.erase(entry);
+    }
+  }
+  miss_count_.fetch_add(1, std::memory_order_relaxed);
+  return false;
+}
+
+void MemoCache::Put(const std::string &key, MemoValue value, int64_t ttl_ms) {
+  if (!Enabled()) return;
+  int64_t expire_ms = static_cast<int64_t>(Utils::getNowMs()) +
+                      (ttl_ms > 0 ? ttl_ms : ttl_ms_);
+  Shard &shard = GetShard(key);
+  std::lock_guard<std::mutex> locker(shard.mutex);
+  auto iter = shard.index.find(key);
+  if (iter != shard.index.end()) {
+    auto entry = iter->second;
+    entry->value = std::move(value);
+    entry->expire_ms = expire_ms;
+    shard.entries.splice(shard.entries.begin(), shard.entries, entry);
+    return;
+  }
+  shard.entries.push_front(Entry{key, std::move(value), expire_ms});
+  shard.index.emplace(shard.entries.front().key, shard.entries.begin());
+  while (shard.entries.size() > shard_capacity_) {
+    shard.index.erase(shard.entries.back().key);
+    shard.entries.pop_back();
+  }
+}
+
+size_t MemoCache::Size() const {
+  size_t size = 0;
+  for (const auto &shard : shards_) {
+    std::lock_guard<std::mutex> locker(shard.mutex);
+    size += shard.entries.size();
+  }
+  return size;
+}
+
+void MemoCache::Clear() {
+  for (auto &shard : shards_) {
+    std::lock_guard<std::mutex> locker(shard.mutex);
+    shard.index.clear();
+    shard.entries.clear();
+  }
+}
+
+}  // namespace yapf
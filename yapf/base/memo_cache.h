@@ -0,0 +1,76 @@
+// File Name: memo_cache.h
+// Description: 跨请求的Phase结果缓存
+//
+// 按key分片加锁，每个分片LRU淘汰，条目超过TTL后视为未命中
+
+#ifndef MEMO_CACHE_H_
+#define MEMO_CACHE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace yapf {
+
+// 缓存的Phase结果: 返回值及业务导出的数据
+struct MemoValue {
+  int ret{0};
+  std::shared_ptr<const void> data;
+};
+
+class MemoCache {
+ public:
+  MemoCache() = default;
+  MemoCache(const MemoCache &) = delete;
+  MemoCache &operator=(const MemoCache &) = delete;
+
+  // 非线程安全，使用前调用; capacity为0表示不启用
+  void Init(size_t capacity, int64_t ttl_ms);
+  bool Enabled() const { return shard_capacity_ > 0; }
+  // 命中返回true，过期条目删除并计为未命中
+  bool Get(const std::string &key, MemoValue &value);
+  // ttl_ms为0时使用Init指定的TTL
+  void Put(const std::string &key, MemoValue value, int64_t ttl_ms = 0);
+  size_t Size() const;
+  void Clear();
+  uint64_t GetHitCount() const {
+    return hit_count_.load(std::memory_order_relaxed);
+  }
+  uint64_t GetMissCount() const {
+    return miss_count_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Entry {
+    std::string key;
+    MemoValue value;
+    int64_t expire_ms{0};
+  };
+  using EntryList = std::list<Entry>;
+  struct Shard {
+    mutable std::mutex mutex;
+    EntryList entries;  // 按最近使用排序，头部最新
+    // key指向entries中的字符串，节点地址不随移动改变
+    std::unordered_map<std::string_view, EntryList::iterator> index;
+  };
+  static constexpr size_t kShardNum = 16;
+
+  Shard &GetShard(const std::string &key) {
+    return shards_[std::hash<std::string>()(key) % kShardNum];
+  }
+
+  Shard shards_[kShardNum];
+  size_t shard_capacity_{0};
+  int64_t ttl_ms_{0};
+  std::atomic<uint64_t> hit_count_{0};
+  std::atomic<uint64_t> miss_count_{0};
+};
+
+}  // namespace yapf
+
+#endif
@@ -0,0 +1,92 @@
+// File Name: memo_cache_test.cc
+// Description:
+
+#include "yapf/base/memo_cache.h"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace yapf {
+
+TEST(MemoCacheTest, HitMiss) {
+  MemoCache cache;
+  MemoValue value;
+  EXPECT_FALSE(cache.Enabled());
+  cache.Put("k", value);
+  EXPECT_EQ(0u, cache.Size());
+
+  cache.Init(64, 1000);
+  EXPECT_TRUE(cache.Enabled());
+  EXPECT_FALSE(cache.Get("k", value));
+  value.ret = 3;
+  value.data = std::make_shared<const int>(42);
+  cache.Put("k", value);
+  MemoValue cached;
+  EXPECT_TRUE(cache.Get("k", cached));
+  EXPECT_EQ(3, cached.ret);
+  EXPECT_EQ(42, *std::static_pointer_cast<const int>(cached.data));
+  EXPECT_EQ(1u, cache.GetHitCount());
+  EXPECT_EQ(1u, cache.GetMissCount());
+  // overwrite
+  value.ret = 4;
+  cache.Put("k", value);
+  EXPECT_TRUE(cache.Get("k", cached));
+  EXPECT_EQ(4, cached.ret);
+  EXPECT_EQ(1u, cache.Size());
+  cache.Clear();
+  EXPECT_FALSE(cache.Get("k", cached));
+}
+
+TEST(MemoCacheTest, Expire) {
+  MemoCache cache;
+  cache.Init(64, 1000);
+  MemoValue value;
+  cache.Put("short", value, 20);
+  cache.Put("long", value);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_FALSE(cache.Get("short", value));
+  EXPECT_TRUE(cache.Get("long", value));
+  // expired entry is removed on access
+  EXPECT_EQ(1u, cache.Size());
+}
+
+TEST(MemoCacheTest, Bounded) {
+  MemoCache cache;
+  // 16 shards, one entry per shard
+  cache.Init(16, 1000);
+  MemoValue value;
+  for (int i = 0; i < 1000; ++i) {
+    cache.Put(std::to_string(i), value);
+  }
+  EXPECT_LE(cache.Size(), 16u);
+  // the latest one of its shard is kept
+  EXPECT_TRUE(cache.Get("999", value));
+
+  // concurrent access
+  cache.Init(1024, 1000);
+  const uint64_t access_count = cache.GetHitCount() + cache.GetMissCount();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&cache, t]() {
+      MemoValue value;
+      for (int i = 0; i < 1000; ++i) {
+        std::string key = std::to_string(i % 100);
+        if (!cache.Get(key, value)) {
+          value.ret = i % 100;
+          cache.Put(key, value);
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(100u, cache.Size());
+  EXPECT_EQ(access_count + 4000u,
+            cache.GetHitCount() + cache.GetMissCount());
+}
+
+}  // namespace yapf
@@ -12,6 +12,8 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <string_view>
+#include <vector>
 
 #include "yapf/base/phase_common.h"
 #include "yapf/base/phase_context.h"
@@ -20,29 +22,55 @@ namespace yapf {
 
 class Phase {
  public:
-  Phase() { signal_promise_ptr_ = std::make_unique<PromiseWrapper<int>>(); }
+  Phase() {}
   virtual ~Phase() {}
   virtual void Initialize() {}
-  void SetName(const std::string &name) { phase_name_ = name; }
+  void SetName(std::string_view name) { phase_name_.assign(name); }
   const std::string &GetName() const { return phase_name_; }
+  // map节点实例序号及实例总数
+  void SetMapIndex(size_t index, size_t size) {
+    map_index_ = index;
+    map_size_ = size;
+  }
+  size_t GetMapIndex() const { return map_index_; }
+  size_t GetMapSize() const { return map_size_; }
   int GetRedoRetryTimes() {
     return redo_retry_times_.load(std::memory_order_relaxed);
   }
-  FutureWrapper<int> Run(PhaseContextPtr context_ptr,
+  // 返回的句柄在本实例下次Run之前有效
+  CompletionRef<int> Run(PhaseContextPtr context_ptr,
                          const PhaseParamDetail &detail) {
     RedoReset();
     DoProcess(context_ptr, detail);
-    return signal_promise_ptr_->GetFuture();
+    return CompletionRef<int>(&signal_cell_);
+  }
+  // 批量执行，rets与context_ptrs一一对应，返回时整批完成
+  void RunBatch(const std::vector<PhaseContextPtr> &context_ptrs,
+                const PhaseParamDetail &detail, std::vector<int> &rets) {
+    rets.assign(context_ptrs.size(), kPhaseProcessingRetOk);
+    DoBatchProcess(context_ptrs, detail, rets);
   }
 
  protected:
   virtual int DoProcess(PhaseContextPtr context_ptr,
                         const PhaseParamDetail &detail) = 0;
-  // 当流程正常结束时，通知调度器
-  int NotifyDone(int ret) {
-    if (!signal_promise_ptr_->GetFuture().IsDone()) {
-      signal_promise_ptr_->SetValue(ret);
+  // 批量版本的DoProcess，同步处理整批上下文并逐项填写rets
+  // 默认逐个调用DoProcess并等待其NotifyXXX，可重写以跨条目向量化
+  virtual int DoBatchProcess(const std::vector<PhaseContextPtr> &context_ptrs,
+                             const PhaseParamDetail &detail,
+                             std::vector<int> &rets) {
+    for (size_t i = 0; i < context_ptrs.size(); ++i) {
+      if (i > 0) Reset();
+      rets[i] = Run(context_ptrs[i], detail).GetValue();
     }
+    return 0;
+  }
+  // 池化调度器复用实例处理下一个请求前调用，清理请求级的成员状态
+  // 实例不可复用时返回false，调度器改为新建实例
+  virtual bool Recycle() { return true; }
+  // 当流程正常结束时，通知调度器，重复通知时只有首次生效
+  int NotifyDone(int ret) {
+    signal_cell_.SetValue(ret);
     return ret;
   }
   // 中断所有中间流程执行直接跳转到EndPhase
@@ -60,21 +88,39 @@ class Phase {
   int NotifyTimeout() { return NotifyDone(kPhaseProcessingRetTimeout); }
 
  private:
+  // 流水线及批量执行复用同一实例处理下一个条目前调用
+  // 上一条目的值已取得，通知方置值后不再访问信号量，可原地重置
+  void Reset() {
+    redo_retry_times_.store(0, std::memory_order_relaxed);
+    signal_cell_.Reset();
+  }
+
+  // 调度器复用实例前调用，先重置框架状态再由实现清理自身状态
+  bool Reuse() {
+    Reset();
+    SetMapIndex(0, 1);
+    return Recycle();
+  }
+
   void RedoReset() {
-    if (signal_promise_ptr_->GetFuture().IsDone() and
-        signal_promise_ptr_->GetFuture().GetValue() ==
-            kPhaseProcessingRetRedo) {
-      signal_promise_ptr_.reset(new PromiseWrapper<int>);
+    if (signal_cell_.IsDone() and
+        signal_cell_.GetValue() == kPhaseProcessingRetRedo) {
+      signal_cell_.Reset();
     }
   }
 
  private:
   // 用于流程控制的信号量，对其设置值表示本阶段完成
-  std::unique_ptr<PromiseWrapper<int>> signal_promise_ptr_;
+  CompletionCell<int> signal_cell_;
 
  private:
   std::string phase_name_;
   std::atomic<int> redo_retry_times_{0};
+  size_t map_index_{0};
+  size_t map_size_{1};
+
+  friend class PhasePipeline;
+  friend class PhaseScheduler;
 };
 
 using PhasePtr = std::shared_ptr<Phase>;
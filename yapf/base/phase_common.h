@@ -7,14 +7,22 @@
 #ifndef SRC_PHASE_COMMON_H_
 #define SRC_PHASE_COMMON_H_
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
-#include <future>
 #include <iterator>
 #include <memory>
+#include <mutex>
+#include <new>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -176,11 +184,55 @@ struct PhaseConfigValue {
   }
 };
 
+// 参数表，按插入顺序平铺存储
+// 每个Phase的参数只有几个，线性查找不慢于哈希，且加载计划时按节点预留一次，
+// 不为每个参数分配哈希节点
+class PhaseConfigValueTable {
+ public:
+  using value_type = std::pair<std::string, PhaseConfigValue>;
+  using iterator = std::vector<value_type>::iterator;
+  using const_iterator = std::vector<value_type>::const_iterator;
+
+  iterator begin() { return values_.begin(); }
+  iterator end() { return values_.end(); }
+  const_iterator begin() const { return values_.begin(); }
+  const_iterator end() const { return values_.end(); }
+  size_t size() const { return values_.size(); }
+  bool empty() const { return values_.empty(); }
+  void reserve(size_t n) { values_.reserve(n); }
+  void clear() { values_.clear(); }
+
+  iterator find(std::string_view name) {
+    return std::find_if(values_.begin(), values_.end(),
+                        [name](const value_type& v) { return v.first == name; });
+  }
+  const_iterator find(std::string_view name) const {
+    return std::find_if(values_.begin(), values_.end(),
+                        [name](const value_type& v) { return v.first == name; });
+  }
+  // 不存在时插入
+  PhaseConfigValue& operator[](std::string_view name) {
+    auto it = find(name);
+    if (it != values_.end()) {
+      return it->second;
+    }
+    values_.emplace_back(std::string(name), PhaseConfigValue());
+    return values_.back().second;
+  }
+  // 调用方保证name不重复
+  PhaseConfigValue& Append(std::string_view name) {
+    values_.emplace_back(std::string(name), PhaseConfigValue());
+    return values_.back().second;
+  }
+
+ private:
+  std::vector<value_type> values_;
+};
+
 struct PhaseConfig {
-  using PhaseConfigValueTable =
-      std::unordered_map<std::string, PhaseConfigValue>;
+  using PhaseConfigValueTable = yapf::PhaseConfigValueTable;
   PhaseConfigValueTable params;
-  const PhaseConfigValue& operator[](const std::string& name) const {
+  const PhaseConfigValue& operator[](std::string_view name) const {
     auto it = params.find(name);
     if (it != params.end()) {
       return it->second;
@@ -226,8 +278,163 @@ struct PhaseParamDetail {
   PhaseConfigKey config_key;  // phaseName(k:v,...)配置参数解析成的结构
 };
 
+//
+// 单生产者单消费者的一次性完成单元
+// 状态: 空 -> 已设值(kReady)或已注册回调(kCallback) -> 两者皆有(完成)
+// 后到达的一方执行回调，回调恰好执行一次；值及回调内联存储，不分配内存
+// 回调执行前先移出存储，之后不再访问本单元，回调中可安全地Reset并复用
+//
+template <typename T>
+class CompletionCell {
+ public:
+  static constexpr size_t kCallbackSize = 64;
+
+  CompletionCell() = default;
+  CompletionCell(const CompletionCell&) = delete;
+  CompletionCell& operator=(const CompletionCell&) = delete;
+  ~CompletionCell() { DestroyCallback(); }
+
+  // 生产方调用，并发的多个生产方只有先到者生效，其余返回false
+  bool SetValue(T value) {
+    if (state_.fetch_or(kClaimed, std::memory_order_acq_rel) & kClaimed) {
+      return false;
+    }
+    value_ = value;
+    const uint32_t last = state_.fetch_or(kReady, std::memory_order_acq_rel);
+    if (last & kWaiting) {
+      Wake();
+    }
+    if (last & kCallback) {
+      RunCallback();
+    }
+    return true;
+  }
+  // 消费方调用，只能注册一次，回调以T为参数，已有值时在当前线程执行
+  template <typename F>
+  void Then(F&& cb) {
+    using Fn = std::decay_t<F>;
+    static_assert(sizeof(Fn) <= kCallbackSize &&
+                      alignof(Fn) <= alignof(std::max_align_t),
+                  "callback is too large for inline storage");
+    // 先注册的回调可能正由生产方执行，不能析构或覆盖，重复注册时丢弃
+    const bool registered = state_.load(std::memory_order_acquire) & kCallback;
+    assert(!registered && "CompletionCell::Then called twice");
+    if (registered) return;
+    new (storage_) Fn(std::forward<F>(cb));
+    ops_ = &CallbackOps<Fn>;
+    if (state_.fetch_or(kCallback, std::memory_order_acq_rel) & kReady) {
+      RunCallback();
+    }
+  }
+  bool IsDone() const {
+    return state_.load(std::memory_order_acquire) & kReady;
+  }
+  // 值未就绪时阻塞等待，用于同步取结果的调用方
+  T GetValue() const {
+    if (!IsDone()) {
+      Wait();
+    }
+    return value_;
+  }
+  // 复用前调用，调用方保证生产方及回调均不再访问本单元
+  void Reset() {
+    DestroyCallback();
+    value_ = T();
+    state_.store(0, std::memory_order_release);
+  }
+
+ private:
+  enum : uint32_t {
+    kClaimed = 1,   // 生产方已占用
+    kReady = 2,     // 值已写入
+    kCallback = 4,  // 回调已写入
+    kWaiting = 8,   // 有阻塞等待的线程
+  };
+  // 按单元地址分片的等待队列，只在阻塞等待时使用
+  struct Waiter {
+    std::mutex mutex;
+    std::condition_variable cond;
+  };
+  static Waiter& GetWaiter(const void* cell) {
+    static constexpr size_t kWaiterNum = 64;
+    static Waiter waiters[kWaiterNum];
+    return waiters[(reinterpret_cast<uintptr_t>(cell) >> 6) % kWaiterNum];
+  }
+  // value非空时移出回调并执行，为空时只析构
+  template <typename Fn>
+  static void CallbackOps(void* storage, const T* value) {
+    Fn* stored = static_cast<Fn*>(storage);
+    if (value == nullptr) {
+      stored->~Fn();
+      return;
+    }
+    T ret = *value;
+    Fn fn(std::move(*stored));
+    stored->~Fn();
+    try {
+      fn(ret);
+    } catch (...) {
+    }
+  }
+  void RunCallback() {
+    auto ops = ops_;
+    ops_ = nullptr;
+    ops(storage_, &value_);
+  }
+  void DestroyCallback() {
+    if (ops_) {
+      ops_(storage_, nullptr);
+      ops_ = nullptr;
+    }
+  }
+  void Wake() const {
+    Waiter& waiter = GetWaiter(this);
+    { std::lock_guard<std::mutex> locker(waiter.mutex); }
+    waiter.cond.notify_all();
+  }
+  void Wait() const {
+    static constexpr int kSpinCount = 64;
+    for (int i = 0; i < kSpinCount; ++i) {
+      if (IsDone()) return;
+      std::this_thread::yield();
+    }
+    // 置位后再检查，生产方置kReady时必能看到kWaiting
+    if (state_.fetch_or(kWaiting, std::memory_order_acq_rel) & kReady) {
+      return;
+    }
+    Waiter& waiter = GetWaiter(this);
+    std::unique_lock<std::mutex> locker(waiter.mutex);
+    waiter.cond.wait(locker, [this]() { return IsDone(); });
+  }
+
+ private:
+  alignas(std::max_align_t) unsigned char storage_[kCallbackSize];
+  void (*ops_)(void*, const T*){nullptr};
+  mutable std::atomic<uint32_t> state_{0};
+  T value_{};
+};
+
+// CompletionCell的非持有句柄，由单元所有者保证有效期
+template <typename T>
+class CompletionRef {
+ public:
+  CompletionRef() = default;
+  explicit CompletionRef(CompletionCell<T>* cell) : cell_(cell) {}
+  template <typename F>
+  void Then(F&& cb) const {
+    cell_->Then(std::forward<F>(cb));
+  }
+  bool IsDone() const { return cell_ ? cell_->IsDone() : false; }
+  T GetValue() const { return cell_ ? cell_->GetValue() : T(); }
+  explicit operator bool() const { return cell_ != nullptr; }
+
+ private:
+  CompletionCell<T>* cell_{nullptr};
+};
+
 //
 // simple wrapper for promise/future
+// 共享所有权的promise/future，基于CompletionCell实现
 //
 template <typename T>
 class FutureWrapper;
@@ -238,30 +445,20 @@ class FutureWrapperBase;
 template <typename T>
 class PromiseWrapper {
  public:
-  PromiseWrapper(bool fast_forward = false) : fast_forward_(fast_forward) {
-    std::future<T> f = promise_holder_.get_future();
-    future_wrapper_ = FutureWrapper<T>(
-        std::make_shared<FutureWrapperBase<T>>(std::move(f), fast_forward));
-  }
+  // 值内联存储于CompletionCell
+  PromiseWrapper()
+      : future_wrapper_(std::make_shared<FutureWrapperBase<T>>()) {}
   PromiseWrapper(const PromiseWrapper&) = delete;
   PromiseWrapper(PromiseWrapper&& other) {
-    promise_holder_ = std::move(other.promise_holder_);
     future_wrapper_ = std::move(other.future_wrapper_);
   }
 
   FutureWrapper<T> GetFuture() { return future_wrapper_; }
 
-  void SetValue(T t) {
-    if (!fast_forward_) {
-      promise_holder_.set_value(t);
-    }
-    future_wrapper_.Notify(t);
-  }
+  void SetValue(T t) { future_wrapper_.Notify(t); }
 
  private:
-  std::promise<T> promise_holder_;
   FutureWrapper<T> future_wrapper_;
-  bool fast_forward_{false};
 };
 
 template <typename T>
@@ -303,63 +500,27 @@ template <typename T>
 class FutureWrapperBase
     : public std::enable_shared_from_this<FutureWrapperBase<T>> {
  public:
-  explicit FutureWrapperBase(std::shared_future<T>&& future,
-                             bool fast_forward = false)
-      : future_holder_(std::move(future)), fast_forward_(fast_forward) {}
-
+  // 回调执行时future仍由调用方或promise持有，捕获this即可
   void Then(std::function<int(FutureWrapper<T>&)>&& cb) {
-    this->cb_ = std::move(cb);
-    if (has_value_) {
-      ExecFunc();
-    }
-  }
-  void Notify(T t) {
-    has_value_ = true;
-    if (fast_forward_) {
-      holder_value_ = t;
-    }
-    ExecFunc();
+    cell_.Then([this, cb = std::move(cb)](T) {
+      auto f = FutureWrapper<T>(this->shared_from_this());
+      cb(f);
+    });
   }
+  void Notify(T t) { cell_.SetValue(t); }
   bool TryGetValue(T& value) {
-    if (not has_value_) {
+    if (!cell_.IsDone()) {
       return false;
     }
-    value = fast_forward_ ? holder_value_ : future_holder_.get();
+    value = cell_.GetValue();
     return true;
   }
-  T GetValue() {
-    if (fast_forward_) {
-      return holder_value_;
-    }
-    return future_holder_.get();
-  }
+  T GetValue() { return cell_.GetValue(); }
 
-  bool IsDone() { return has_value_; }
-
- protected:
-  void ExecFunc() {
-    if (!flag_.load() and cb_) {
-      flag_.store(true);
-      // exec callback
-      auto f = FutureWrapper<T>(this->shared_from_this());
-      try {
-        cb_(f);
-      } catch (...) {
-      }
-      {
-        decltype(cb_) tmp;
-        tmp.swap(cb_);
-      }
-    }
-  }
+  bool IsDone() { return cell_.IsDone(); }
 
  private:
-  std::shared_future<T> future_holder_;
-  std::function<int(FutureWrapper<T>&)> cb_;
-  std::atomic<bool> has_value_{false};
-  std::atomic<bool> flag_{false};
-  T holder_value_;
-  bool fast_forward_{false};
+  CompletionCell<T> cell_;
 };
 
 };  // namespace yapf
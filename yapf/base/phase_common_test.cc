@@ -1,8 +1,10 @@
 #include "yapf/base/phase_common.h"
 
+#include <atomic>
 #include <chrono>
 #include <iostream>
 #include <thread>
+#include <vector>
 
 #include "gtest/gtest.h"
 
@@ -20,18 +22,6 @@ TEST(PhaseCommonTest, SatisfiedFuture) {
   auto mf = mp.GetFuture();
   EXPECT_TRUE(mf.IsDone());
   EXPECT_EQ(mf.GetValue(), 23);
-  // test fast forward
-  {
-    yapf::PromiseWrapper<int> p{true};
-    p.SetValue(23);
-    yapf::FutureWrapper<int> f = p.GetFuture();
-    EXPECT_TRUE(f.IsDone());
-    EXPECT_EQ(f.GetValue(), 23);
-    yapf::PromiseWrapper<int> mp = std::move(p);
-    auto mf = mp.GetFuture();
-    EXPECT_TRUE(mf.IsDone());
-    EXPECT_EQ(mf.GetValue(), 23);
-  }
 }
 
 TEST(PhaseCommonTest, WaitedFuture) {
@@ -55,6 +45,87 @@ TEST(PhaseCommonTest, WaitedFuture) {
   EXPECT_EQ(f.GetValue(), 12);
 }
 
+TEST(PhaseCommonTest, CompletionCell) {
+  // value first, the callback runs inline in Then
+  yapf::CompletionCell<int> cell;
+  int called = 0;
+  int value = 0;
+  EXPECT_TRUE(cell.SetValue(3));
+  EXPECT_FALSE(cell.SetValue(4));
+  EXPECT_TRUE(cell.IsDone());
+  cell.Then([&called, &value](int v) {
+    ++called;
+    value = v;
+  });
+  EXPECT_EQ(1, called);
+  EXPECT_EQ(3, value);
+  // callback first, the callback runs inline in SetValue
+  cell.Reset();
+  EXPECT_FALSE(cell.IsDone());
+  cell.Then([&called, &value](int v) {
+    ++called;
+    value = v;
+  });
+  EXPECT_EQ(1, called);
+  EXPECT_TRUE(cell.SetValue(5));
+  EXPECT_EQ(2, called);
+  EXPECT_EQ(5, value);
+  EXPECT_EQ(5, cell.GetValue());
+  // blocking wait on another thread's value
+  cell.Reset();
+  std::thread producer([&cell]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    cell.SetValue(6);
+  });
+  EXPECT_EQ(6, yapf::CompletionRef<int>(&cell).GetValue());
+  producer.join();
+  // pending callback is released with the cell
+  auto holder = std::make_shared<int>(0);
+  {
+    yapf::CompletionCell<int> pending;
+    pending.Then([holder](int) {});
+    EXPECT_EQ(2, holder.use_count());
+  }
+  EXPECT_EQ(1, holder.use_count());
+}
+
+TEST(PhaseCommonDeathTest, CompletionCellThenTwice) {
+  // registering twice is a misuse, the first callback is kept
+  yapf::CompletionCell<int> cell;
+  int called = 0;
+  cell.Then([&called](int) { ++called; });
+  auto holder = std::make_shared<int>(0);
+  EXPECT_DEBUG_DEATH(cell.Then([holder](int) {}), "called twice");
+  EXPECT_EQ(1, holder.use_count());
+  EXPECT_TRUE(cell.SetValue(1));
+  EXPECT_EQ(1, called);
+}
+
+TEST(PhaseCommonTest, CompletionCellRace) {
+  // value and callback arrive concurrently, no callback is lost or doubled
+  constexpr int kCellNum = 20000;
+  std::vector<yapf::CompletionCell<int>> cells(kCellNum);
+  std::atomic<int> called{0};
+  std::atomic<int> wrong{0};
+  std::thread producer([&cells]() {
+    for (int i = 0; i < kCellNum; ++i) {
+      cells[i].SetValue(i);
+    }
+  });
+  std::thread consumer([&cells, &called, &wrong]() {
+    for (int i = 0; i < kCellNum; ++i) {
+      cells[i].Then([i, &called, &wrong](int v) {
+        called.fetch_add(1);
+        if (v != i) wrong.fetch_add(1);
+      });
+    }
+  });
+  producer.join();
+  consumer.join();
+  EXPECT_EQ(kCellNum, called.load());
+  EXPECT_EQ(0, wrong.load());
+}
+
 TEST(PhaseCommonTest, StrToInt64) {
   std::string str1{"1.2"};
   std::string str2{"12"};
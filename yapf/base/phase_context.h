@@ -7,6 +7,7 @@
 #define PHASE_CONTEXT_H_
 
 #include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -27,6 +28,20 @@ struct PhaseContext {
   }
   // 业务自行定义，用于区分具体的session类型
   virtual int GetCtxType() const { return 0; }
+  // map节点(map:true)本次请求的并行实例数，调度时调用，返回0时跳过该节点
+  virtual size_t GetMapSize(const std::string& phase_name) const { return 1; }
+  // memo节点(memo:true)本次请求的缓存key，只应由该Phase的输入决定
+  // 返回空串表示本次请求不使用缓存
+  virtual std::string GetMemoKey(const std::string& phase_name) const {
+    return std::string();
+  }
+  // memo节点成功完成后导出需缓存的结果，命中缓存时导入，不再执行该Phase
+  virtual std::shared_ptr<const void> ExportMemo(
+      const std::string& phase_name) const {
+    return nullptr;
+  }
+  virtual void ImportMemo(const std::string& phase_name,
+                          const std::shared_ptr<const void>& data) {}
 
   int AddLogHandler(std::function<void(const std::string&)> handler) {
     if (handler) {
@@ -0,0 +1,187 @@
+// File Name: phase_pipeline.cpp
+// Description:
+
+#include "yapf/base/phase_pipeline.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "yapf/base/logging.h"
+
+namespace yapf {
+
+int PhasePipeline::Init(SchedulerPlanPtr plan, const PipelineOption &option) {
+  if (!plan || !plan->dag_plan || !stages_.empty()) {
+    DAGPF_LOG_ERROR << "invalid plan or pipeline already inited." << std::endl;
+    return kPhasePipelineRetNotBuilt;
+  }
+  const auto &dag_plan = *plan->dag_plan;
+  for (uint32_t id = 0; id < dag_plan.Size(); ++id) {
+    if (plan->map_nodes[id] || plan->sub_plans[id] ||
+        (plan->has_quorum_node && plan->join_quorum[id] > 0)) {
+      DAGPF_LOG_ERROR << "unsupported node in pipeline: "
+                      << dag_plan.GetNode(id).name << std::endl;
+      return kPhasePipelineRetUnsupportedNode;
+    }
+  }
+  plan_ = std::move(plan);
+  item_done_fn_ = option.item_done_fn;
+  stages_.reserve(dag_plan.Size());
+  for (uint32_t id = 0; id < dag_plan.Size(); ++id) {
+    const auto &params = plan_->phase_param_pool[id].config_key.params;
+    const auto &queue_size = params["queue_size"];
+    const auto &concurrency = params["concurrency"];
+    auto stage = std::make_unique<Stage>(
+        queue_size.iv > 0 ? queue_size.iv : option.queue_capacity);
+    const size_t worker_num =
+        concurrency.iv > 0 ? concurrency.iv : std::max<size_t>(
+                                                  option.concurrency, 1);
+    for (size_t i = 0; i < worker_num; ++i) {
+      auto generator = plan_->phase_generators[id];
+      PhasePtr phase_ptr(generator ? (*generator)() : nullptr);
+      if (!phase_ptr) {
+        DAGPF_LOG_ERROR << "cant create phase instance: "
+                        << dag_plan.GetNode(id).name << std::endl;
+        stages_.clear();
+        plan_.reset();
+        return kPhasePipelineRetCreatePhaseFailed;
+      }
+      phase_ptr->SetName(dag_plan.GetNode(id).name);
+      stage->phases.push_back(std::move(phase_ptr));
+    }
+    stages_.push_back(std::move(stage));
+  }
+  // start workers after all stages are created
+  for (uint32_t id = 0; id < dag_plan.Size(); ++id) {
+    auto &stage = *stages_[id];
+    for (size_t i = 0; i < stage.phases.size(); ++i) {
+      stage.workers.emplace_back(&PhasePipeline::RunStage, this, id, i);
+    }
+  }
+  return 0;
+}
+
+int PhasePipeline::Push(PhaseContextPtr ctx_ptr) {
+  if (!plan_) return kPhasePipelineRetNotBuilt;
+  {
+    std::lock_guard<std::mutex> locker(mutex_);
+    if (is_stopped_) return kPhasePipelineRetStopped;
+    inflight_count_.fetch_add(1, std::memory_order_acq_rel);
+  }
+  const auto &dag_plan = *plan_->dag_plan;
+  auto item = std::make_shared<Item>();
+  item->ctx_ptr = std::move(ctx_ptr);
+  item->indegree.reset(new std::atomic<int>[dag_plan.Size()]);
+  for (uint32_t id = 0; id < dag_plan.Size(); ++id) {
+    item->indegree[id].store(dag_plan.GetNode(id).indegree,
+                             std::memory_order_relaxed);
+  }
+  // blocks when the first stage is full
+  stages_[dag_plan.GetStartNodeId()]->queue.push(std::move(item));
+  return 0;
+}
+
+void PhasePipeline::Stop() {
+  {
+    std::unique_lock<std::mutex> locker(mutex_);
+    if (is_stopped_) return;
+    is_stopped_ = true;
+    // pushed items are drained before stopping workers
+    drained_cond_.wait(locker, [this]() {
+      return inflight_count_.load(std::memory_order_acquire) == 0;
+    });
+  }
+  for (auto &stage : stages_) {
+    stage->queue.close();
+  }
+  for (auto &stage : stages_) {
+    for (auto &worker : stage->workers) {
+      if (worker.joinable()) worker.join();
+    }
+  }
+}
+
+void PhasePipeline::RunStage(uint32_t node_id, size_t worker) {
+  auto &stage = *stages_[node_id];
+  Phase &phase = *stage.phases[worker];
+  const auto &dag_plan = *plan_->dag_plan;
+  const bool is_end_node = node_id == dag_plan.GetEndNodeId();
+  bool is_first = true;
+  ItemPtr item;
+  while (stage.queue.pop(item)) {
+    int ret = kPhaseProcessingRetSkip;
+    // skip phases other than EndPhase once the item is interrupted
+    if (is_end_node || !item->is_interrupted.load(std::memory_order_acquire)) {
+      if (!is_first) {
+        phase.Reset();
+      }
+      is_first = false;
+      ret = RunPhase(phase, item, node_id);
+    }
+    if (is_end_node) {
+      FinishItem(item);
+      item.reset();
+      continue;
+    }
+    if ((ret == kPhaseProcessingRetInterrupt ||
+         ret == kPhaseProcessingRetFlowLimited) &&
+        !item->is_interrupted.load(std::memory_order_acquire)) {
+      item->ir_reason.store(ret, std::memory_order_relaxed);
+      item->is_interrupted.store(true, std::memory_order_release);
+    }
+    const auto &skip_frontier = plan_->skip_frontier[node_id];
+    if (!skip_frontier.empty() && ret == kPhaseProcessingRetSkip) {
+      // skip the dominated subgraph as a whole
+      for (const auto &frontier : skip_frontier) {
+        ReleaseNode(item, frontier.first, frontier.second);
+      }
+    } else {
+      for (const auto &child : dag_plan.GetLinks(node_id)) {
+        ReleaseNode(item, child, 1);
+      }
+    }
+    item.reset();
+  }
+}
+
+void PhasePipeline::ReleaseNode(const ItemPtr &item, uint32_t node_id,
+                                int count) {
+  if (item->indegree[node_id].fetch_sub(count, std::memory_order_acq_rel) ==
+      count) {
+    // blocks when the child stage is full, stages downstream never
+    // wait on upstream ones, so the pipeline always drains
+    ItemPtr ready_item = item;
+    stages_[node_id]->queue.push(std::move(ready_item));
+  }
+}
+
+int PhasePipeline::RunPhase(Phase &phase, const ItemPtr &item,
+                            uint32_t node_id) {
+  try {
+    // wait on this worker, phases may notify from other threads
+    return phase.Run(item->ctx_ptr, plan_->phase_param_pool[node_id])
+        .GetValue();
+  } catch (std::exception &ex) {
+    DAGPF_LOG_ERROR << "run phase: " << phase.GetName()
+                    << " catch exception: " << ex.what() << std::endl;
+  } catch (...) {
+    DAGPF_LOG_ERROR << "run phase: " << phase.GetName()
+                    << " catch unknown exception." << std::endl;
+  }
+  return kPhaseProcessingRetSkip;
+}
+
+void PhasePipeline::FinishItem(const ItemPtr &item) {
+  item->ctx_ptr->is_interrupted =
+      item->is_interrupted.load(std::memory_order_acquire);
+  item->ctx_ptr->ir_reason = item->ir_reason.load(std::memory_order_relaxed);
+  if (item_done_fn_) {
+    item_done_fn_(item->ctx_ptr);
+  }
+  std::lock_guard<std::mutex> locker(mutex_);
+  if (inflight_count_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    drained_cond_.notify_all();
+  }
+}
+
+}  // namespace yapf
@@ -0,0 +1,103 @@
+// File Name: phase_pipeline.h
+// Description: 流水线方式执行调度计划
+//
+// 计划只实例化一次，每个节点为一个stage，有界输入队列及固定数量的worker线程，
+// 每个worker持有一个Phase实例并复用; 条目(PhaseContext)在stage间连续流动，
+// 省去逐条StartScheduler的调度器复制及Phase分配
+//
+// 限制:
+//   - 不支持map、子图及join:any/join:k节点
+//   - 不做redo、对冲、memo及流控
+//   - skip_children节点跳过时与调度器一致，其支配的子图整体跳过
+//   - Phase实例跨条目复用，不能在成员中保留条目状态
+//   - 条目之间不保证完成顺序
+
+#ifndef PHASE_PIPELINE_H_
+#define PHASE_PIPELINE_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "yapf/base/phase.h"
+#include "yapf/base/phase_context.h"
+#include "yapf/base/phase_scheduler.h"
+#include "yapf/base/utils.h"
+
+namespace yapf {
+
+enum PhasePipelineRet {
+  kPhasePipelineRetNotBuilt = 80400,
+  kPhasePipelineRetUnsupportedNode,
+  kPhasePipelineRetCreatePhaseFailed,
+  kPhasePipelineRetStopped,
+};
+
+struct PipelineOption {
+  // stage默认输入队列容量及worker数，节点可用queue_size、concurrency参数覆盖
+  size_t queue_capacity{64};
+  size_t concurrency{1};
+  // 条目经过EndPhase后回调，可用于统计或通知
+  std::function<void(PhaseContextPtr)> item_done_fn;
+};
+
+class PhasePipeline {
+ public:
+  PhasePipeline() = default;
+  PhasePipeline(const PhasePipeline &) = delete;
+  PhasePipeline &operator=(const PhasePipeline &) = delete;
+  ~PhasePipeline() { Stop(); }
+
+  // 使用已构建的调度计划创建各stage并启动worker
+  int Init(SchedulerPlanPtr plan, const PipelineOption &option);
+  int Init(const PhaseScheduler &scheduler, const PipelineOption &option) {
+    return Init(scheduler.GetPlan(), option);
+  }
+  // 放入一个条目，起始stage队列满时阻塞
+  int Push(PhaseContextPtr ctx_ptr);
+  // 不再接收新条目，等待在途条目完成后停止所有worker
+  void Stop();
+  // 已放入但未经过EndPhase的条目数
+  size_t GetInflightCount() const {
+    return inflight_count_.load(std::memory_order_acquire);
+  }
+
+ private:
+  // 条目级状态，只包含各节点入度
+  struct Item {
+    PhaseContextPtr ctx_ptr;
+    std::unique_ptr<std::atomic<int>[]> indegree;
+    std::atomic<bool> is_interrupted{false};
+    std::atomic<int> ir_reason{0};
+  };
+  using ItemPtr = std::shared_ptr<Item>;
+
+  struct Stage {
+    explicit Stage(size_t capacity) : queue(capacity) {}
+    Utils::BoundedBlockingQueue<ItemPtr> queue;
+    std::vector<PhasePtr> phases;  // 每个worker一个实例
+    std::vector<std::thread> workers;
+  };
+
+  void RunStage(uint32_t node_id, size_t worker);
+  // 扣减节点入度，就绪时放入其stage
+  void ReleaseNode(const ItemPtr &item, uint32_t node_id, int count);
+  int RunPhase(Phase &phase, const ItemPtr &item, uint32_t node_id);
+  void FinishItem(const ItemPtr &item);
+
+  SchedulerPlanPtr plan_;
+  std::vector<std::unique_ptr<Stage>> stages_;
+  std::function<void(PhaseContextPtr)> item_done_fn_;
+  std::atomic<size_t> inflight_count_{0};
+  std::mutex mutex_;
+  std::condition_variable drained_cond_;
+  bool is_stopped_{false};
+};
+
+}  // namespace yapf
+
+#endif
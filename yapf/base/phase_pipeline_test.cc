@@ -0,0 +1,225 @@
+// File Name: phase_pipeline_test.cc
+// Description:
+
+#include "yapf/base/phase_pipeline.h"
+
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+namespace yapf {
+
+struct ItemContext : public PhaseContext {
+  int id{0};
+  std::atomic<int> sum{0};
+  std::mutex local_mutex;
+  std::set<std::string> executed_phases;
+  void Record(const std::string &name) {
+    std::unique_lock<std::mutex> locker(local_mutex);
+    executed_phases.insert(name);
+  }
+};
+
+class StartPhase : public Phase {
+ protected:
+  int DoProcess(PhaseContextPtr context_ptr,
+                const PhaseParamDetail &detail) override {
+    return NotifyDone(0);
+  }
+};
+
+REGISTER_CLASS(yapf, Phase, yapf, StartPhase);
+
+class EndPhase : public Phase {
+ protected:
+  int DoProcess(PhaseContextPtr context_ptr,
+                const PhaseParamDetail &detail) override {
+    ToBizCtxPtr<ItemContext>(context_ptr)->Record(GetName());
+    return NotifyDone(0);
+  }
+};
+
+REGISTER_CLASS(yapf, Phase, yapf, EndPhase);
+
+class AddPhase : public Phase {
+ protected:
+  int DoProcess(PhaseContextPtr context_ptr,
+                const PhaseParamDetail &detail) override {
+    auto item_ctx = ToBizCtxPtr<ItemContext>(context_ptr);
+    item_ctx->Record(GetName());
+    item_ctx->sum.fetch_add(detail.config_key.params["value"].iv);
+    return NotifyDone(0);
+  }
+};
+
+REGISTER_CLASS(yapf, Phase, yapf, AddPhase);
+
+class OddInterruptPhase : public Phase {
+ protected:
+  int DoProcess(PhaseContextPtr context_ptr,
+                const PhaseParamDetail &detail) override {
+    auto item_ctx = ToBizCtxPtr<ItemContext>(context_ptr);
+    item_ctx->Record(GetName());
+    return item_ctx->id % 2 ? SigInterrupt() : NotifyDone(0);
+  }
+};
+
+REGISTER_CLASS(yapf, Phase, yapf, OddInterruptPhase);
+
+class OddSkipPhase : public Phase {
+ protected:
+  int DoProcess(PhaseContextPtr context_ptr,
+                const PhaseParamDetail &detail) override {
+    auto item_ctx = ToBizCtxPtr<ItemContext>(context_ptr);
+    item_ctx->Record(GetName());
+    return item_ctx->id % 2 ? NotifySkip() : NotifyDone(0);
+  }
+};
+
+REGISTER_CLASS(yapf, Phase, yapf, OddSkipPhase);
+
+class MapPhase : public Phase {
+ protected:
+  int DoProcess(PhaseContextPtr context_ptr,
+                const PhaseParamDetail &detail) override {
+    return NotifyDone(0);
+  }
+};
+
+REGISTER_CLASS(yapf, Phase, yapf, MapPhase);
+
+static void BuildScheduler(
+    const std::vector<std::string> &exprs,
+    const std::unordered_map<std::string, std::string> &alias_map,
+    PhaseScheduler &scheduler) {
+  scheduler.SetPhaseNameSpace("yapf");
+  ASSERT_EQ(0, InitScheduler(exprs, alias_map, scheduler));
+}
+
+TEST(PhasePipelineTest, Diamond) {
+  PhaseScheduler scheduler;
+  BuildScheduler({"a->b", "a->c", "b->d", "c->d"},
+                 {{"a", "AddPhase(value:1)"},
+                  {"b", "AddPhase(value:10,concurrency:4,queue_size:8)"},
+                  {"c", "AddPhase(value:100,concurrency:2)"},
+                  {"d", "AddPhase(value:1000)"}},
+                 scheduler);
+  constexpr int kItemNum = 500;
+  std::atomic<int> done_count{0};
+  std::atomic<int> wrong_count{0};
+  PipelineOption option;
+  option.queue_capacity = 4;
+  option.item_done_fn = [&done_count, &wrong_count](PhaseContextPtr ctx_ptr) {
+    auto item_ctx = ToBizCtxPtr<ItemContext>(ctx_ptr);
+    // d runs after both b and c
+    if (item_ctx->sum.load() != 1111 ||
+        item_ctx->executed_phases.size() != 5u) {
+      ++wrong_count;
+    }
+    ++done_count;
+  };
+  PhasePipeline pipeline;
+  ASSERT_EQ(0, pipeline.Init(scheduler, option));
+  // producers block on the bounded queue of the first stage
+  std::vector<std::thread> producers;
+  for (int t = 0; t < 2; ++t) {
+    producers.emplace_back([&pipeline]() {
+      for (int i = 0; i < kItemNum / 2; ++i) {
+        EXPECT_EQ(0, pipeline.Push(std::make_shared<ItemContext>()));
+      }
+    });
+  }
+  for (auto &producer : producers) {
+    producer.join();
+  }
+  pipeline.Stop();
+  EXPECT_EQ(kItemNum, done_count.load());
+  EXPECT_EQ(0, wrong_count.load());
+  EXPECT_EQ(0u, pipeline.GetInflightCount());
+  EXPECT_EQ(kPhasePipelineRetStopped,
+            pipeline.Push(std::make_shared<ItemContext>()));
+}
+
+TEST(PhasePipelineTest, Interrupt) {
+  PhaseScheduler scheduler;
+  BuildScheduler({"a->b"},
+                 {{"a", "OddInterruptPhase(concurrency:2)"},
+                  {"b", "AddPhase(value:1)"}},
+                 scheduler);
+  std::mutex mutex;
+  std::vector<std::shared_ptr<ItemContext>> done_items;
+  PipelineOption option;
+  option.item_done_fn = [&mutex, &done_items](PhaseContextPtr ctx_ptr) {
+    std::unique_lock<std::mutex> locker(mutex);
+    done_items.push_back(ToBizCtxPtr<ItemContext>(ctx_ptr));
+  };
+  PhasePipeline pipeline;
+  ASSERT_EQ(0, pipeline.Init(scheduler, option));
+  for (int i = 0; i < 20; ++i) {
+    auto item_ctx = std::make_shared<ItemContext>();
+    item_ctx->id = i;
+    EXPECT_EQ(0, pipeline.Push(item_ctx));
+  }
+  pipeline.Stop();
+  ASSERT_EQ(20u, done_items.size());
+  for (const auto &item_ctx : done_items) {
+    const bool is_odd = item_ctx->id % 2;
+    EXPECT_EQ(is_odd, item_ctx->is_interrupted);
+    EXPECT_EQ(is_odd ? kPhaseProcessingRetInterrupt : 0, item_ctx->ir_reason);
+    // b is skipped, EndPhase always runs
+    EXPECT_EQ(is_odd ? 0 : 1, item_ctx->sum.load());
+    EXPECT_EQ(1u, item_ctx->executed_phases.count("EndPhase"));
+  }
+}
+
+TEST(PhasePipelineTest, SkipChildren) {
+  PhaseScheduler scheduler;
+  BuildScheduler({"a->s", "s->x", "x->z", "a->z"},
+                 {{"a", "AddPhase(value:1)"},
+                  {"s", "OddSkipPhase(skip_children:true)"},
+                  {"x", "AddPhase(value:10)"},
+                  {"z", "AddPhase(value:100)"}},
+                 scheduler);
+  std::mutex mutex;
+  std::vector<std::shared_ptr<ItemContext>> done_items;
+  PipelineOption option;
+  option.item_done_fn = [&mutex, &done_items](PhaseContextPtr ctx_ptr) {
+    std::unique_lock<std::mutex> locker(mutex);
+    done_items.push_back(ToBizCtxPtr<ItemContext>(ctx_ptr));
+  };
+  PhasePipeline pipeline;
+  ASSERT_EQ(0, pipeline.Init(scheduler, option));
+  for (int i = 0; i < 20; ++i) {
+    auto item_ctx = std::make_shared<ItemContext>();
+    item_ctx->id = i;
+    EXPECT_EQ(0, pipeline.Push(item_ctx));
+  }
+  pipeline.Stop();
+  ASSERT_EQ(20u, done_items.size());
+  for (const auto &item_ctx : done_items) {
+    const bool is_odd = item_ctx->id % 2;
+    // x is dominated by s and skipped with it, z still runs
+    EXPECT_EQ(is_odd ? 101 : 111, item_ctx->sum.load());
+    EXPECT_EQ(is_odd ? 0u : 1u, item_ctx->executed_phases.count("x"));
+    EXPECT_EQ(1u, item_ctx->executed_phases.count("z"));
+  }
+}
+
+TEST(PhasePipelineTest, Unsupported) {
+  PhasePipeline pipeline;
+  EXPECT_EQ(kPhasePipelineRetNotBuilt,
+            pipeline.Push(std::make_shared<ItemContext>()));
+  PhaseScheduler scheduler;
+  BuildScheduler({"a->m"}, {{"a", "AddPhase"}, {"m", "MapPhase(map:true)"}},
+                 scheduler);
+  EXPECT_EQ(kPhasePipelineRetUnsupportedNode,
+            pipeline.Init(scheduler, PipelineOption()));
+  PhaseScheduler empty_scheduler;
+  EXPECT_EQ(kPhasePipelineRetNotBuilt,
+            pipeline.Init(empty_scheduler, PipelineOption()));
+}
+
+}  // namespace yapf
@@ -7,22 +7,118 @@
 
 #include "yapf/base/phase_scheduler.h"
 
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <thread>
+
 #include "logging.h"
+#include "yapf/base/plan_file.h"
 #include "yapf/flow_control/FlowControlFactory.h"
 
 namespace yapf {
 
+namespace {
+// 当前worker上待执行的链式节点
+// 链式节点不入队，由RunPoolJob在当前job返回后循环执行，调用栈不随链长增长
+// 非链式节点同样可以继续执行，连续执行次数受inline_continuation_depth限制
+// 只继续执行当前job所属请求(同一scheduler及上下文)的节点，
+// Phase中同步启动并等待的其他请求不会排在当前job之后
+struct ChainedJob {
+  bool in_pool_job{false};
+  uint32_t depth{0};  // 本job已继续执行的节点数
+  const PhaseScheduler *running_scheduler{nullptr};  // 当前job所属请求
+  const PhaseContext *running_ctx{nullptr};
+  PhaseScheduler *scheduler{nullptr};
+  uint32_t node_id{0};
+  PhaseContextPtr ctx_ptr;
+};
+thread_local ChainedJob t_chained_job;
+// 当前线程上嵌套完成的memo命中数，命中链超过inline_continuation_depth时
+// 改为提交到线程池完成，避免调用栈随命中链增长
+thread_local uint32_t t_memo_hit_depth = 0;
+}  // namespace
+
+// 子图节点，在外层请求的上下文中运行子图的调度计划
+class SubPlanPhase : public Phase {
+ public:
+  explicit SubPlanPhase(SchedulerPlanPtr plan) : plan_(std::move(plan)) {
+    scheduler_.finish_fn_ = [this](int ret) { NotifyDone(ret); };
+  }
+
+ protected:
+  int DoProcess(PhaseContextPtr context_ptr,
+                const PhaseParamDetail &detail) override {
+    // runtime is one-shot, attach again when redo
+    int ret = scheduler_.Attach(plan_);
+    if (ret == 0) {
+      ret = scheduler_.Start(context_ptr);
+    }
+    if (ret != 0) {
+      DAGPF_LOG_ERROR << "start sub plan failed: " << GetName()
+                      << ", ret = " << ret << std::endl;
+      return NotifySkip();
+    }
+    return 0;
+  }
+
+ private:
+  SchedulerPlanPtr plan_;
+  PhaseScheduler scheduler_;
+};
+
 PhaseContext::~PhaseContext() {
   DAGPF_LOG_INFO << "destroy context..." << std::endl;
-  delete scheduler_ptr;
+  PhaseScheduler::Release(scheduler_ptr);
 }
 
-static bool HasRegistered(const std::string &phase_namespace,
-                          const std::string &full_name) {
-  std::string class_name = full_name.substr(0, full_name.find("("));
-  DAGPF_LOG_INFO << "pahse_namespace: " << phase_namespace
-                 << ", class_name: " << class_name << std::endl;
-  return HasRegisted<yapf::Phase>(phase_namespace, class_name);
+// 注册表key为namespace.class_name，复用key缓冲区拼接，不逐节点分配
+static GenObjectFun<Phase> *FindPhaseGenerator(
+    const std::string &phase_namespace, std::string_view class_name,
+    std::string &key) {
+  key.assign(phase_namespace).append(1, '.').append(class_name);
+  return GetObjectGenerator<Phase>(key);
+}
+
+// hedge_percentile:p95 或 hedge_percentile:95，无效时返回0
+static double ParseHedgePercentile(const PhaseConfigValue &value) {
+  if (value.invalid || value.str.empty()) return 0.0;
+  const char *begin = value.str.c_str();
+  if (*begin == 'p' || *begin == 'P') ++begin;
+  char *end = nullptr;
+  double percentile = std::strtod(begin, &end);
+  if (end == begin || *end != '\0' || percentile <= 0.0 ||
+      percentile >= 100.0) {
+    return 0.0;
+  }
+  return percentile;
+}
+
+void LatencyHistogram::Add(int64_t us) {
+  int index = static_cast<int>(4 * std::log2(std::max<int64_t>(us, 0) + 1));
+  buckets_[std::min(index, kBucketNum - 1)].fetch_add(
+      1, std::memory_order_relaxed);
+}
+
+int64_t LatencyHistogram::GetPercentile(double percentile,
+                                        uint64_t min_samples) const {
+  uint64_t counts[kBucketNum];
+  uint64_t total = 0;
+  for (int i = 0; i < kBucketNum; ++i) {
+    counts[i] = buckets_[i].load(std::memory_order_relaxed);
+    total += counts[i];
+  }
+  if (total == 0 || total < min_samples) return -1;
+  // 返回所在桶的上界
+  uint64_t rank = static_cast<uint64_t>(std::ceil(total * percentile / 100));
+  uint64_t accumulated = 0;
+  int index = 0;
+  for (; index < kBucketNum - 1; ++index) {
+    accumulated += counts[index];
+    if (accumulated >= rank) break;
+  }
+  return static_cast<int64_t>(std::exp2((index + 1) / 4.0)) - 1;
 }
 
 int PhaseScheduler::Start(
@@ -40,8 +136,8 @@ int PhaseScheduler::Start(
     DAGPF_LOG_ERROR << "preAllocate phase failed." << std::endl;
     return ret;
   }
-  std::vector<DAGNodePtr> nodes(1, dag_.GetStartNode());
-  return Schedule(nodes, context_ptr);
+  std::vector<uint32_t> nodes(1, plan_->dag_plan->GetStartNodeId());
+  return Schedule(nodes, context_ptr, false);
 }
 
 int PhaseScheduler::Start(
@@ -60,8 +156,8 @@ int PhaseScheduler::Start(
     DAGPF_LOG_ERROR << "preAllocate phase failed." << std::endl;
     return ret;
   }
-  std::vector<DAGNodePtr> nodes(1, dag_.GetStartNode());
-  return Schedule(nodes, context_ptr);
+  std::vector<uint32_t> nodes(1, plan_->dag_plan->GetStartNodeId());
+  return Schedule(nodes, context_ptr, false);
 }
 
 int PhaseScheduler::CopyFrom(const PhaseScheduler &source) {
@@ -71,46 +167,164 @@ int PhaseScheduler::CopyFrom(const PhaseScheduler &source) {
                     << ", has_started_ = " << source.has_started_ << std::endl;
     return kPhaseSchedulerRetDAGInvalidCopy;
   }
-  // TODO
-  int ret = this->dag_.CopyFrom(source.dag_);
+  return Attach(source.plan_);
+}
+
+int PhaseScheduler::SavePlan(const std::string &path) const {
+  if (!is_DAG_built_ || !plan_) {
+    DAGPF_LOG_ERROR << "DAG not built, cant save plan." << std::endl;
+    return kPhaseSchedulerRetDAGNotBuilt;
+  }
+  for (const auto &sub_plan : plan_->sub_plans) {
+    if (sub_plan) {
+      DAGPF_LOG_ERROR << "plan with sub plan cant be saved." << std::endl;
+      return kPhaseSchedulerRetPlanFileFailed;
+    }
+  }
+  int ret = PlanFile::Save(path, *plan_->dag_plan, plan_->phase_param_pool,
+                           plan_->phase_namespace_name);
   if (ret != 0) {
-    return ret;
+    DAGPF_LOG_ERROR << "save plan failed: ret = " << ret << std::endl;
+    return kPhaseSchedulerRetPlanFileFailed;
   }
-  this->is_DAG_built_ = source.is_DAG_built_;
-  this->has_started_ = source.has_started_;
-  this->phase_pool_ = source.phase_pool_;
-  // this->phase_param_pool_ = source.phase_param_pool_;
-  this->phase_param_pool_ptr_ = source.phase_param_pool_ptr_;
-  this->phase_ret_array_ = source.phase_ret_array_;
-  this->topology_array_ = source.topology_array_;
-  this->phase_timecost_array_ = source.phase_timecost_array_;
-  this->phase_namespace_name_ = source.phase_namespace_name_;
   return 0;
 }
 
+int PhaseScheduler::LoadPlan(const std::string &path) {
+  auto plan = std::make_shared<SchedulerPlan>();
+  int ret = PlanFile::Load(path, plan->dag_plan, plan->phase_param_pool,
+                           plan->phase_namespace_name);
+  if (ret != 0) {
+    DAGPF_LOG_ERROR << "load plan failed: " << path << ", ret = " << ret
+                    << std::endl;
+    return kPhaseSchedulerRetPlanFileFailed;
+  }
+  // 文件中的Phase需已在当前进程注册，FinishPlan中检查
+  return FinishPlan(std::move(plan));
+}
+
+int PhaseScheduler::Attach(SchedulerPlanPtr plan) {
+  if (!plan || !plan->dag_plan) {
+    DAGPF_LOG_ERROR << "invalid plan, cant attach." << std::endl;
+    return kPhaseSchedulerRetDAGInvalidCopy;
+  }
+  // Phase实例随计划保留，重新绑定同一计划时复用，绑定其他计划时丢弃
+  if (plan.get() != phase_plan_) {
+    for (uint32_t id = 0; id < runtime_.Size(); ++id) {
+      runtime_[id].phase.reset();
+    }
+    phase_plan_ = plan.get();
+  }
+  this->plan_ = std::move(plan);
+  this->phase_namespace_name_ = plan_->phase_namespace_name;
+  this->is_DAG_built_ = true;
+  return PreAllocateRes();
+}
+
+int PhaseScheduler::RegisterSubPlan(const std::string &name,
+                                    const PhaseScheduler &sub) {
+  if (name.empty() || !sub.is_DAG_built_) {
+    DAGPF_LOG_ERROR << "sub plan not built, name: " << name << std::endl;
+    return kPhaseSchedulerRetDAGNotBuilt;
+  }
+  sub_plan_map_[name] = sub.plan_;
+  return 0;
+}
+
+// 字段带长度前缀，表达式或别名中的分隔符不会使不同配置得到相同的key
+static void AppendKeyField(const std::string &field, std::string &key) {
+  key.append(std::to_string(field.size())).append(":").append(field);
+}
+
+std::string PhaseScheduler::GetPlanKey(
+    const std::vector<std::string> &exprs,
+    const std::unordered_map<std::string, std::string> &node_alias_name_map)
+    const {
+  std::string key;
+  AppendKeyField(phase_namespace_name_, key);
+  key.append(s_enable_transitive_reduction_ ? "1" : "0");
+  key.append(std::to_string(exprs.size())).append("#");
+  for (const auto &expr : exprs) {
+    AppendKeyField(expr, key);
+  }
+  std::vector<std::pair<std::string, std::string>> alias(
+      node_alias_name_map.begin(), node_alias_name_map.end());
+  std::sort(alias.begin(), alias.end());
+  key.append(std::to_string(alias.size())).append("#");
+  for (const auto &item : alias) {
+    AppendKeyField(item.first, key);
+    AppendKeyField(item.second, key);
+  }
+  // sub plans are kept alive by the cached plan, address is stable
+  std::map<std::string, const void *> sub_plans;
+  for (const auto &item : sub_plan_map_) {
+    sub_plans.emplace(item.first, item.second.get());
+  }
+  key.append(std::to_string(sub_plans.size())).append("#");
+  for (const auto &item : sub_plans) {
+    AppendKeyField(item.first, key);
+    AppendKeyField(std::to_string(reinterpret_cast<uintptr_t>(item.second)),
+                   key);
+  }
+  return key;
+}
+
 int PhaseScheduler::BuildDAG(
     const std::vector<std::pair<std::string, std::string>> &edges,
     const std::vector<std::string> &single_nodes,
     const std::unordered_map<std::string, std::string> &node_alias_name_map) {
-  int ret = dag_.AddNodeLinks(edges, single_nodes, node_alias_name_map);
+  DAG dag;
+  auto is_valid = [this](const std::string &full_name) -> bool {
+    // may be called from pool workers when building in parallel
+    thread_local std::string registry_key;
+    std::string_view class_name(full_name);
+    class_name = class_name.substr(0, class_name.find('('));
+    return FindPhaseGenerator(this->phase_namespace_name_, class_name,
+                              registry_key) != nullptr ||
+           (!sub_plan_map_.empty() &&
+            sub_plan_map_.count(std::string(class_name)) != 0);
+  };
+  dag.EnableTransitiveReduction(s_enable_transitive_reduction_);
+  if (s_enable_transitive_reduction_) {
+    // quorum joins count parents, none of them is redundant
+    dag.SetKeepInEdges([](const std::string &full_name) {
+      PhaseConfigKey config_key;
+      config_key.Parse(full_name);
+      const auto &join = config_key.params["join"];
+      return !join.invalid && join.str != "all";
+    });
+    // the subgraph skipped by skip_children is computed on the reduced plan
+    dag.SetKeepInEdgesBelow([](const std::string &full_name) {
+      PhaseConfigKey config_key;
+      config_key.Parse(full_name);
+      return config_key.params["skip_children"].bv;
+    });
+  }
+  int ret = dag.AddNodeLinks(edges, single_nodes, node_alias_name_map);
   if (ret != 0) {
     DAGPF_LOG_ERROR << "add node links failed: ret = " << ret << std::endl;
     return kPhaseSchedulerRetInvalidDAG;
   }
-  ret = dag_.Init([this] (const auto &name) -> bool {
-      return yapf::HasRegistered(this->phase_namespace_name_, name);
-      });
+  if (s_parallel_build_threshold_ != 0 &&
+      dag.Size() >= s_parallel_build_threshold_ && s_is_global_inited_ &&
+      s_enable_thread_pool_) {
+    dag.SetParallelExecutor(&PhaseScheduler::ParallelFor);
+  }
+  ret = dag.Init(is_valid);
   if (ret != 0) {
     DAGPF_LOG_ERROR << "init DAG failed: ret = " << ret << std::endl;
     return kPhaseSchedulerRetInvalidDAG;
   }
+  if (s_enable_transitive_reduction_) {
+    DAGPF_LOG_INFO << "transitive reduction removed "
+                   << dag.GetReducedEdgeCount() << " edges." << std::endl;
+  }
   DAGPF_LOG_DEBUG << "topology sort node list:" << std::endl;
   // TODO (jattlelin) check if needed
   if (s_verbose_) {
-    dag_.List();
+    dag.List();
   }
-  is_DAG_built_ = true;
-  ret = PreAllocateRes();
+  ret = CompilePlan(dag);
   if (ret != 0) return ret;
   return 0;
 }
@@ -127,228 +341,761 @@ int PhaseScheduler::Start(PhaseContextPtr context_ptr) {
     DAGPF_LOG_ERROR << "preAllocate phase failed." << std::endl;
     return ret;
   }
-  std::vector<DAGNodePtr> nodes(1, dag_.GetStartNode());
-  return Schedule(nodes, context_ptr);
+  std::vector<uint32_t> nodes(1, plan_->dag_plan->GetStartNodeId());
+  return Schedule(nodes, context_ptr, false);
+}
+
+// skip_children:true的节点被跳过时，其支配的子图整体跳过
+// 只需扣减子图之外直接后继的入度，与子图大小无关
+static void BuildSkipFrontier(SchedulerPlan &plan) {
+  const auto &dag_plan = *plan.dag_plan;
+  const size_t node_num = dag_plan.Size();
+  plan.skip_frontier.assign(node_num, {});
+  std::vector<uint32_t> skip_nodes;
+  for (uint32_t id = 0; id < node_num; ++id) {
+    if (plan.phase_param_pool[id].config_key.params["skip_children"].bv) {
+      skip_nodes.push_back(id);
+    }
+  }
+  if (skip_nodes.empty()) return;
+  // dominator tree
+  std::vector<uint32_t> idom;
+  dag_plan.GetImmediateDominators(idom);
+  std::vector<std::vector<uint32_t>> dom_children(node_num);
+  for (uint32_t id = 0; id < node_num; ++id) {
+    if (id != dag_plan.GetStartNodeId()) {
+      dom_children[idom[id]].push_back(id);
+    }
+  }
+  const uint32_t end_node_id = dag_plan.GetEndNodeId();
+  std::vector<uint32_t> dominated_stamp(node_num, 0u);
+  std::vector<int> frontier_count(node_num, 0);
+  std::vector<uint32_t> dominated, stack;
+  uint32_t stamp = 0;
+  for (const auto &skip_id : skip_nodes) {
+    // dominated subgraph, EndPhase always runs
+    ++stamp;
+    dominated.clear();
+    stack.assign(1, skip_id);
+    while (!stack.empty()) {
+      uint32_t id = stack.back();
+      stack.pop_back();
+      dominated.push_back(id);
+      dominated_stamp[id] = stamp;
+      for (const auto &child : dom_children[id]) {
+        if (child != end_node_id) stack.push_back(child);
+      }
+    }
+    // edges leaving the subgraph
+    auto &frontier = plan.skip_frontier[skip_id];
+    for (const auto &id : dominated) {
+      for (const auto &child : dag_plan.GetLinks(id)) {
+        if (dominated_stamp[child] == stamp) continue;
+        if (frontier_count[child]++ == 0) {
+          frontier.emplace_back(child, 0);
+        }
+      }
+    }
+    for (auto &item : frontier) {
+      item.second = frontier_count[item.first];
+      frontier_count[item.first] = 0;
+    }
+    DAGPF_LOG_DEBUG << "skip_children of " << dag_plan.GetNode(skip_id).name
+                    << ", dominated: " << dominated.size() - 1
+                    << ", frontier: " << frontier.size() << std::endl;
+  }
+}
+
+// 编译只读调度计划: DAG拓扑 + 预解析的Phase参数
+int PhaseScheduler::CompilePlan(const DAG &dag) {
+  auto plan = std::make_shared<SchedulerPlan>();
+  int ret = dag.Compile(plan->dag_plan);
+  if (ret != 0) {
+    DAGPF_LOG_ERROR << "compile DAG failed: ret = " << ret << std::endl;
+    return kPhaseSchedulerRetInvalidDAG;
+  }
+  const auto &dag_plan = *plan->dag_plan;
+  plan->phase_param_pool.resize(dag_plan.Size());
+  for (uint32_t id = 0; id < dag_plan.Size(); ++id) {
+    DAGPF_LOG_DEBUG << "parse phase param: " << dag_plan.GetNode(id).name
+                    << std::endl;
+    plan->phase_param_pool[id].config_key.Parse(
+        dag_plan.GetNode(id).full_name);
+  }
+  plan->phase_namespace_name = this->phase_namespace_name_;
+  return FinishPlan(std::move(plan));
+}
+
+int PhaseScheduler::FinishPlan(std::shared_ptr<SchedulerPlan> plan) {
+  const auto &dag_plan = *plan->dag_plan;
+  // critical path, cost_hint is given in ms
+  static constexpr int64_t kDefaultCostUs = 1;
+  dag_plan.GetTopologyOrder(plan->topology_order);
+  plan->cost_hint.assign(dag_plan.Size(), kDefaultCostUs);
+  plan->cost_ewma.reset(new std::atomic<int64_t>[dag_plan.Size()]);
+  plan->critical_path.reset(new std::atomic<int64_t>[dag_plan.Size()]);
+  for (uint32_t id = 0; id < dag_plan.Size(); ++id) {
+    const auto &params = plan->phase_param_pool[id].config_key.params;
+    const auto &hint = params["cost_hint"];
+    if (!hint.invalid && hint.iv > 0) {
+      plan->cost_hint[id] = hint.iv * 1000;
+    }
+    plan->cost_ewma[id].store(0, std::memory_order_relaxed);
+  }
+  // nested plans
+  plan->sub_plans.assign(dag_plan.Size(), nullptr);
+  for (uint32_t id = 0; id < dag_plan.Size(); ++id) {
+    auto iter = sub_plan_map_.find(plan->phase_param_pool[id].config_key.name);
+    if (iter != sub_plan_map_.end()) {
+      plan->sub_plans[id] = iter->second;
+    }
+  }
+  // phase generators, looked up once instead of on every PreAllocateRes
+  std::string registry_key;
+  plan->phase_generators.assign(dag_plan.Size(), nullptr);
+  for (uint32_t id = 0; id < dag_plan.Size(); ++id) {
+    if (plan->sub_plans[id]) continue;
+    const auto &name = plan->phase_param_pool[id].config_key.name;
+    plan->phase_generators[id] =
+        FindPhaseGenerator(plan->phase_namespace_name, name, registry_key);
+    if (!plan->phase_generators[id]) {
+      DAGPF_LOG_ERROR << "not registered: " << name << ", namespace name: "
+                      << plan->phase_namespace_name << std::endl;
+      return kPhaseSchedulerRetHasInvalidPhase;
+    }
+  }
+  // builtin params, resolved once instead of on every run
+  static constexpr int kRedoDefaultRetryTimes = 3;
+  static constexpr int kRedoDefaultRetryInterval = 1000;
+  static constexpr int kDefaultDelayTimeout = 5 * 1000;
+  plan->builtin_params.assign(dag_plan.Size(), PhaseBuiltinParams());
+  for (uint32_t id = 0; id < dag_plan.Size(); ++id) {
+    const auto &params = plan->phase_param_pool[id].config_key.params;
+    auto &builtin = plan->builtin_params[id];
+    builtin.flow_control = params["flow_control"].bv;
+    if (builtin.flow_control) {
+      builtin.flow_limit_delay = params["flow_limit_delay"].bv;
+      builtin.flow_win_size = params["flow_win_size"].iv;
+      builtin.flow_limit = params["flow_limit"].iv;
+      builtin.delay_timeout = params["delay_timeout"].iv;
+      if (builtin.delay_timeout == 0) {
+        builtin.delay_timeout = kDefaultDelayTimeout;
+      }
+      builtin.flow_name.assign(dag_plan.GetNode(id).full_name);
+    }
+    builtin.redo = params["redo"].bv;
+    builtin.redo_retry_times = params["redo_retry_times"].iv;
+    if (builtin.redo_retry_times == 0) {
+      builtin.redo_retry_times = kRedoDefaultRetryTimes;
+    }
+    builtin.redo_retry_interval = params["redo_retry_interval"].iv;
+    if (builtin.redo_retry_interval == 0) {
+      builtin.redo_retry_interval = kRedoDefaultRetryInterval;
+    }
+    builtin.memo_ttl_ms = params["memo_ttl_ms"].iv;
+  }
+  plan->scheduler_pool.Init(s_scheduler_pool_capacity_);
+  BuildSkipFrontier(*plan);
+  // map nodes
+  plan->map_nodes.assign(dag_plan.Size(), false);
+  for (uint32_t id = 0; id < dag_plan.Size(); ++id) {
+    if (plan->phase_param_pool[id].config_key.params["map"].bv &&
+        !plan->sub_plans[id]) {
+      plan->map_nodes[id] = true;
+      plan->has_map_node = true;
+    }
+  }
+  // hedged nodes, map/redo/sub plan nodes are never hedged
+  plan->hedge_policies.assign(dag_plan.Size(), HedgePolicy());
+  for (uint32_t id = 0; id < dag_plan.Size(); ++id) {
+    const auto &params = plan->phase_param_pool[id].config_key.params;
+    if (plan->map_nodes[id] || plan->sub_plans[id] ||
+        plan->builtin_params[id].redo ||
+        id == dag_plan.GetStartNodeId() || id == dag_plan.GetEndNodeId()) {
+      continue;
+    }
+    auto &policy = plan->hedge_policies[id];
+    policy.after_ms = std::max<int64_t>(params["hedge_after_ms"].iv, 0);
+    policy.percentile = ParseHedgePercentile(params["hedge_percentile"]);
+    if (policy.after_ms > 0 || policy.percentile > 0.0) {
+      plan->has_hedge_node = true;
+    }
+  }
+  if (plan->has_hedge_node) {
+    plan->latency_histograms.reset(new LatencyHistogram[dag_plan.Size()]);
+  }
+  // join policies, join:all by default
+  plan->join_quorum.assign(dag_plan.Size(), 0);
+  for (uint32_t id = 0; id < dag_plan.Size(); ++id) {
+    const auto &join = plan->phase_param_pool[id].config_key.params["join"];
+    if (join.invalid || join.str == "all") continue;
+    int quorum = join.str == "any" ? 1 : static_cast<int>(join.iv);
+    if (quorum <= 0) {
+      DAGPF_LOG_ERROR << "invalid join policy: " << join.str
+                      << ", phase: " << dag_plan.GetNode(id).name << std::endl;
+      return kPhaseSchedulerRetParamInvalid;
+    }
+    if (quorum < dag_plan.GetNode(id).indegree) {
+      plan->join_quorum[id] = quorum;
+      plan->has_quorum_node = true;
+    }
+  }
+  // memoized nodes
+  plan->memo_nodes.assign(dag_plan.Size(), false);
+  for (uint32_t id = 0; id < dag_plan.Size(); ++id) {
+    if (plan->phase_param_pool[id].config_key.params["memo"].bv &&
+        !plan->map_nodes[id] && !plan->sub_plans[id] &&
+        id != dag_plan.GetStartNodeId() && id != dag_plan.GetEndNodeId()) {
+      plan->memo_nodes[id] = true;
+      plan->has_memo_node = true;
+    }
+  }
+  // linear chains, run in the job of the only parent
+  plan->chained.assign(dag_plan.Size(), false);
+  for (uint32_t id = 0; id < dag_plan.Size(); ++id) {
+    auto parents = dag_plan.GetParents(id);
+    plan->chained[id] = parents.size() == 1u &&
+                        dag_plan.GetLinks(*parents.begin()).size() == 1u;
+  }
+  plan->RefreshCriticalPath();
+  return Attach(std::move(plan));
+}
+
+void PhaseScheduler::RefreshCriticalPath() const {
+  if (plan_) {
+    plan_->RefreshCriticalPath();
+  }
 }
 
-int PhaseScheduler::ParsePhaseParam(DAGNodePtr node) {
-  DAGPF_LOG_DEBUG << "parse phase param: " << node->GetName() << std::endl;
-  phase_param_pool_[node->GetId()].config_key.Parse(node->GetFullName());
+int PhaseScheduler::EstimatePlan(
+    const std::unordered_map<std::string, int64_t> &durations,
+    PlanEstimate &estimate) const {
+  if (!is_DAG_built_ || !plan_) {
+    DAGPF_LOG_ERROR << "DAG not built, cant estimate." << std::endl;
+    return kPhaseSchedulerRetDAGNotBuilt;
+  }
+  const auto &dag_plan = *plan_->dag_plan;
+  std::vector<int64_t> node_durations(dag_plan.Size(), 0);
+  for (uint32_t id = 0; id < dag_plan.Size(); ++id) {
+    auto iter = durations.find(std::string(dag_plan.GetNode(id).name));
+    if (iter != durations.end()) {
+      node_durations[id] = iter->second;
+    } else if (id != dag_plan.GetStartNodeId() &&
+               id != dag_plan.GetEndNodeId()) {
+      int64_t cost = plan_->cost_ewma[id].load(std::memory_order_relaxed);
+      node_durations[id] = cost > 0 ? cost : plan_->cost_hint[id];
+    }
+  }
+  int ret = PlanEstimator::Estimate(dag_plan, node_durations, estimate);
+  if (ret != 0) {
+    DAGPF_LOG_ERROR << "estimate plan failed: ret = " << ret << std::endl;
+    return kPhaseSchedulerRetParamInvalid;
+  }
   return 0;
 }
 
-int PhaseScheduler::PreAllocatePhase(DAGNodePtr node) {
-  const std::string &name =
-      (*phase_param_pool_ptr_)[node->GetId()].config_key.name;
-  std::shared_ptr<Phase> phase_ptr(
-      CreateObject<Phase>(this->phase_namespace_name_, name));
+void SchedulerPlan::RefreshCriticalPath() const {
+  // longest remaining path, visit nodes in reverse topology order
+  for (auto iter = topology_order.rbegin(); iter != topology_order.rend();
+       ++iter) {
+    int64_t cost = cost_ewma[*iter].load(std::memory_order_relaxed);
+    if (cost <= 0) {
+      cost = cost_hint[*iter];
+    }
+    int64_t longest_child = 0;
+    for (const auto &child : dag_plan->GetLinks(*iter)) {
+      longest_child = std::max(
+          longest_child, critical_path[child].load(std::memory_order_relaxed));
+    }
+    critical_path[*iter].store(cost + longest_child,
+                               std::memory_order_relaxed);
+  }
+}
+
+int PhaseScheduler::PreAllocatePhase(uint32_t node_id) {
+  PhasePtr &phase_ptr = runtime_[node_id].phase;
+  // 上一请求留下的实例，没有其他持有者且实现同意时原地重置复用
+  if (phase_ptr) {
+    if (phase_ptr.use_count() == 1 && phase_ptr->Reuse()) return 0;
+    phase_ptr.reset();
+  }
+  if (plan_->sub_plans[node_id]) {
+    phase_ptr = std::make_shared<SubPlanPhase>(plan_->sub_plans[node_id]);
+    return 0;
+  }
+  // boundary of sub plan never runs
+  if (IsSubPlanBoundary(node_id)) return 0;
+  const std::string &name = plan_->phase_param_pool[node_id].config_key.name;
+  phase_ptr.reset(NewPhase(node_id));
   if (not phase_ptr) {
     DAGPF_LOG_ERROR << "cant create phase instance: " << name
                     << ", namespace name:" << this->phase_namespace_name_
-                    << ", full name: " << node->GetFullName() << std::endl;
+                    << ", full name: " << GetNode(node_id).full_name
+                    << std::endl;
     return kPhaseSchedulerRetCreatePhaseFailed;
   }
-  phase_pool_[node->GetId()] = phase_ptr;
   return 0;
 }
 
 int PhaseScheduler::PreAllocatePhases() {
-  auto functor =
-      std::bind(&PhaseScheduler::PreAllocatePhase, this, std::placeholders::_1);
-  int ret = dag_.TraverseAction(functor);
-  if (ret != 0) return ret;
+  for (uint32_t id = 0; id < plan_->dag_plan->Size(); ++id) {
+    int ret = PreAllocatePhase(id);
+    if (ret != 0) return ret;
+  }
   return 0;
 }
 
+// 请求级存储，按计划大小分配，计划本身不复制
 int PhaseScheduler::PreAllocateRes() {
-  //在DAG构建后预先分配存储
-  static const FutureWrapper<int> default_ret;
-  phase_ret_array_.resize(dag_.Size(), default_ret);
-  phase_param_pool_.resize(dag_.Size());
-  topology_array_.resize(dag_.Size(), nullptr);
-  phase_timecost_array_.resize(dag_.Size(), 0);
-  phase_pool_.resize(dag_.Size(), PhasePtr());
-  auto functor =
-      std::bind(&PhaseScheduler::ParsePhaseParam, this, std::placeholders::_1);
-  int ret = dag_.TraverseAction(functor);
-  if (ret != 0) {
-    DAGPF_LOG_ERROR << "traverse action failed, ret = " << ret << std::endl;
-    return ret;
+  const auto &dag_plan = *plan_->dag_plan;
+  runtime_.Allocate(dag_plan.Size());
+  for (uint32_t id = 0; id < dag_plan.Size(); ++id) {
+    const int indegree = dag_plan.GetNode(id).indegree;
+    if (plan_->has_quorum_node && plan_->join_quorum[id] > 0) {
+      // counts successful parents, all parents are tracked by join_pending
+      runtime_[id].indegree.store(plan_->join_quorum[id],
+                                  std::memory_order_relaxed);
+      runtime_[id].join_pending.store(indegree, std::memory_order_relaxed);
+    } else {
+      runtime_[id].indegree.store(indegree, std::memory_order_relaxed);
+    }
+  }
+  if (plan_->has_memo_node) {
+    memo_keys_.assign(dag_plan.Size(), std::string());
+  } else {
+    memo_keys_.clear();
   }
-  phase_param_pool_ptr_ = &phase_param_pool_;
+  schedule_cursor_.store(0, std::memory_order_relaxed);
+  is_sig_interrupted_.store(false, std::memory_order_relaxed);
+  ir_reason_.store(0, std::memory_order_relaxed);
   return 0;
 }
 
-int PhaseScheduler::ScheduleChildren(DAGNodePtr parent,
+RequestRuntime::~RequestRuntime() { Release(); }
+
+void RequestRuntime::Allocate(size_t node_num) {
+  if (block_ != nullptr && node_num == node_num_) {
+    // same plan size, reset in place without reallocating, phase instances
+    // are kept for the scheduler to reuse or drop
+    for (size_t id = 0; id < node_num_; ++id) {
+      PhasePtr phase = std::move(nodes_[id].phase);
+      nodes_[id].~NodeRuntime();
+      new (&nodes_[id]) NodeRuntime();
+      nodes_[id].phase = std::move(phase);
+    }
+    return;
+  }
+  Release();
+  const size_t nodes_size = sizeof(NodeRuntime) * node_num;
+  const size_t topology_size = sizeof(uint32_t) * node_num;
+  block_ = ::operator new(nodes_size + topology_size,
+                          std::align_val_t(alignof(NodeRuntime)));
+  node_num_ = node_num;
+  nodes_ = static_cast<NodeRuntime *>(block_);
+  for (size_t id = 0; id < node_num_; ++id) {
+    new (&nodes_[id]) NodeRuntime();
+  }
+  topology_ = reinterpret_cast<uint32_t *>(static_cast<char *>(block_) +
+                                           nodes_size);
+}
+
+void RequestRuntime::Release() {
+  if (block_ == nullptr) return;
+  for (size_t id = 0; id < node_num_; ++id) {
+    nodes_[id].~NodeRuntime();
+  }
+  ::operator delete(block_, std::align_val_t(alignof(NodeRuntime)));
+  block_ = nullptr;
+  nodes_ = nullptr;
+  topology_ = nullptr;
+  node_num_ = 0;
+}
+
+int PhaseScheduler::ScheduleChildren(uint32_t parent_id,
                                      PhaseContextPtr context_ptr) {
-  std::vector<DAGNodePtr> nodes;
+  std::vector<uint32_t> nodes;
+  bool is_parent_ok = false;
+  if (plan_->has_quorum_node) {
+    is_parent_ok = runtime_[parent_id].ret == kPhaseProcessingRetOk;
+  }
   // pop ready children nodes
-  int ret = dag_.Pop(parent, nodes);
-  if (ret != 0) {
-    DAGPF_LOG_DEBUG << "pop failed. parent name: " << parent->GetName()
-                    << ", children nodes size: " << nodes.size()
-                    << ", ret = " << ret << std::endl;
+  for (const auto &child : plan_->dag_plan->GetLinks(parent_id)) {
+    if (plan_->has_quorum_node && plan_->join_quorum[child] > 0) {
+      if (JoinQuorum(child, 1, is_parent_ok)) {
+        nodes.push_back(child);
+      }
+      continue;
+    }
+    if (runtime_[child].indegree.fetch_sub(1, std::memory_order_acq_rel) ==
+        1) {
+      nodes.push_back(child);
+    }
+  }
+  if (nodes.empty()) {
+    DAGPF_LOG_DEBUG << "no ready children. parent name: "
+                    << GetNode(parent_id).name << std::endl;
+    return kPhaseSchedulerRetNoReadyPhase;
+  }
+  SortByCriticalPath(nodes);
+  return Schedule(nodes, context_ptr, true);
+}
+
+// skip the dominated subgraph as a whole, release nodes right after it
+int PhaseScheduler::ScheduleSkipFrontier(uint32_t node_id,
+                                         PhaseContextPtr context_ptr) {
+  std::vector<uint32_t> nodes;
+  for (const auto &item : plan_->skip_frontier[node_id]) {
+    if (plan_->has_quorum_node && plan_->join_quorum[item.first] > 0) {
+      if (JoinQuorum(item.first, item.second, false)) {
+        nodes.push_back(item.first);
+      }
+      continue;
+    }
+    if (runtime_[item.first].indegree.fetch_sub(
+            item.second, std::memory_order_acq_rel) == item.second) {
+      nodes.push_back(item.first);
+    }
+  }
+  if (nodes.empty()) {
     return kPhaseSchedulerRetNoReadyPhase;
   }
-  return Schedule(nodes, context_ptr);
+  SortByCriticalPath(nodes);
+  return Schedule(nodes, context_ptr, true);
 }
 
-int PhaseScheduler::Schedule(const std::vector<DAGNodePtr> &nodes,
-                             PhaseContextPtr context_ptr) {
-  DAGPF_LOG_INFO << "schedule phases. nodes size: " << nodes.size()
+// 成功完成的父节点数达到quorum时就绪，之后完成的父节点被忽略
+// 全部父节点完成仍不足quorum时同样就绪，由节点按父节点返回值自行处理
+bool PhaseScheduler::JoinQuorum(uint32_t node_id, int arrived, bool is_ok) {
+  auto &node_runtime = runtime_[node_id];
+  bool is_ready =
+      is_ok &&
+      node_runtime.indegree.fetch_sub(1, std::memory_order_acq_rel) == 1;
+  // decremented after the quorum counter, the last parent sees all successes
+  const bool is_last = node_runtime.join_pending.fetch_sub(
+                           arrived, std::memory_order_acq_rel) == arrived;
+  if (!is_ready && is_last &&
+      node_runtime.indegree.load(std::memory_order_acquire) > 0) {
+    is_ready = true;
+  }
+  return is_ready;
+}
+
+// run map_size instances of the phase, downstream waits on one join counter
+int PhaseScheduler::ScheduleMap(uint32_t node_id, size_t map_size,
+                                PhaseContextPtr context_ptr) {
+  const auto &node = GetNode(node_id);
+  DAGPF_LOG_DEBUG << "schedule map phase: " << node.name
+                  << ", map size: " << map_size << std::endl;
+  runtime_[node_id].map_failed.store(0, std::memory_order_relaxed);
+  runtime_[node_id].map_pending.store(map_size, std::memory_order_release);
+  for (size_t i = 0; i < map_size; ++i) {
+    PhasePtr phase_ptr = runtime_[node_id].phase;
+    if (i > 0) {
+      phase_ptr.reset(NewPhase(node_id));
+    }
+    if (!phase_ptr) {
+      DAGPF_LOG_ERROR << "cant create map phase instance: " << node.name
+                      << ", index: " << i << std::endl;
+      ScheduleCB(context_ptr, node_id, kPhaseProcessingRetSkip);
+      continue;
+    }
+    phase_ptr->SetName(node.name);
+    phase_ptr->SetMapIndex(i, map_size);
+    if (s_enable_thread_pool_) {
+      JobClosure jc = std::bind(&PhaseScheduler::RunPoolJob, this, phase_ptr,
+                                context_ptr, node_id);
+      s_cb_thread_pool_.Submit(std::move(jc));
+    } else {
+      RunPhaseJob(phase_ptr, context_ptr, node_id);
+    }
+  }
+  return 0;
+}
+
+bool PhaseScheduler::JoinMap(uint32_t node_id, int instance_ret,
+                             int &map_ret) {
+  if (instance_ret != kPhaseProcessingRetOk) {
+    runtime_[node_id].map_failed.fetch_add(1, std::memory_order_relaxed);
+  }
+  if (runtime_[node_id].map_pending.fetch_sub(1, std::memory_order_acq_rel) !=
+      1) {
+    return false;
+  }
+  // all instances done
+  const int map_size = runtime_[node_id].phase->GetMapSize();
+  const int failed =
+      runtime_[node_id].map_failed.load(std::memory_order_relaxed);
+  map_ret = kPhaseProcessingRetOk;
+  if (failed == map_size) {
+    map_ret = kPhaseProcessingDepPhaseRetAllFailed;
+  } else if (failed > 0) {
+    map_ret = kPhaseProcessingDepPhaseRetPartialFailed;
+  }
+  return true;
+}
+
+bool PhaseScheduler::LookupMemo(uint32_t node_id, PhaseContextPtr ctx_ptr) {
+  if (!s_memo_cache_.Enabled()) return false;
+  const auto &phase_name = runtime_[node_id].phase->GetName();
+  std::string memo_key = ctx_ptr->GetMemoKey(phase_name);
+  if (memo_key.empty()) return false;
+  // results are shared by the same phase with the same params
+  std::string key;
+  const auto &full_name = GetNode(node_id).full_name;
+  key.reserve(full_name.size() + 1 + memo_key.size());
+  key.append(full_name).append(1, '\n').append(memo_key);
+  MemoValue value;
+  if (!s_memo_cache_.Get(key, value)) {
+    memo_keys_[node_id] = std::move(key);
+    return false;
+  }
+  DAGPF_LOG_DEBUG << "memo hit, phase_name: " << phase_name << std::endl;
+  ctx_ptr->ImportMemo(phase_name, value.data);
+  if (s_enable_thread_pool_ &&
+      t_memo_hit_depth >= s_inline_continuation_depth_) {
+    const int ret = value.ret;
+    s_cb_thread_pool_.Submit([this, ctx_ptr, node_id, ret]() {
+      ScheduleCB(ctx_ptr, node_id, ret);
+    });
+    return true;
+  }
+  ++t_memo_hit_depth;
+  ScheduleCB(ctx_ptr, node_id, value.ret);
+  --t_memo_hit_depth;
+  return true;
+}
+
+void PhaseScheduler::StoreMemo(uint32_t node_id, PhaseContextPtr ctx_ptr,
+                               int ret) {
+  std::string key = std::move(memo_keys_[node_id]);
+  memo_keys_[node_id].clear();
+  // only successful results are cached
+  if (ret != kPhaseProcessingRetOk) return;
+  MemoValue value;
+  value.ret = kPhaseProcessingRetOk;
+  value.data = ctx_ptr->ExportMemo(runtime_[node_id].phase->GetName());
+  s_memo_cache_.Put(key, std::move(value),
+                    plan_->builtin_params[node_id].memo_ttl_ms);
+}
+
+void PhaseScheduler::SortByCriticalPath(std::vector<uint32_t> &nodes) const {
+  if (nodes.size() < 2u) return;
+  // dispatch the longest remaining path first
+  const auto &critical_path = plan_->critical_path;
+  std::stable_sort(nodes.begin(), nodes.end(),
+                   [&critical_path](uint32_t lhs, uint32_t rhs) {
+                     return critical_path[lhs].load(
+                                std::memory_order_relaxed) >
+                            critical_path[rhs].load(std::memory_order_relaxed);
+                   });
+}
+
+int PhaseScheduler::Schedule(const std::vector<uint32_t> &node_ids,
+                             PhaseContextPtr context_ptr,
+                             bool is_continuation) {
+  DAGPF_LOG_INFO << "schedule phases. nodes size: " << node_ids.size()
                  << std::endl;
-  for (const auto &node : nodes) {
-    DAGPF_LOG_DEBUG << "schedule phase: " << node->GetName() << std::endl;
+  const uint32_t end_node_id = plan_->dag_plan->GetEndNodeId();
+  for (const auto &node_id : node_ids) {
+    const auto &node = GetNode(node_id);
+    DAGPF_LOG_DEBUG << "schedule phase: " << node.name << std::endl;
     // TODO parse phase param detail
-    auto &phase_ptr = phase_pool_[node->GetId()];
-    phase_ptr->SetName(node->GetName());
-    DAGPF_LOG_DEBUG << "prepare to launch phase: " << node->GetName()
+    auto &phase_ptr = runtime_[node_id].phase;
+    DAGPF_LOG_DEBUG << "prepare to launch phase: " << node.name
                     << ", timestamp: " << Utils::getNowMs() << std::endl;
     if (s_enable_statis_) {
       // record start time
-      phase_timecost_array_[node->GetId()] = Utils::getNowMs();
+      runtime_[node_id].timecost = Utils::getNowUs();
     }
-    if (is_sig_interrupted_.load(std::memory_order_relaxed) &&
-        node != dag_.GetEndNode()) {
+    const bool is_boundary = IsSubPlanBoundary(node_id);
+    if (is_boundary || (is_sig_interrupted_.load(std::memory_order_relaxed) &&
+                        node_id != end_node_id)) {
       // skip running phase other than EndPhase if scheduler has been
-      // interrupted
-      FutureWrapper<int> ret;
-      // PromiseWrapper<int> promise_ret;
-      PromiseWrapper<int> promise_ret{true};
-      promise_ret.SetValue(kPhaseProcessingRetSkip);
-      ret = promise_ret.GetFuture();
-      ret.Then(std::bind(&PhaseScheduler::ScheduleCB, this, context_ptr, node,
-                         std::placeholders::_1));
+      // interrupted, StartPhase/EndPhase of sub plan pass through
+      ScheduleCB(context_ptr, node_id,
+                 is_boundary ? kPhaseProcessingRetOk : kPhaseProcessingRetSkip);
     } else {
+      phase_ptr->SetName(node.name);
+      if (plan_->has_memo_node && plan_->memo_nodes[node_id] &&
+          LookupMemo(node_id, context_ptr)) {
+        // completed by cached result, no pool submission
+        continue;
+      }
+      if (plan_->map_nodes[node_id]) {
+        size_t map_size = context_ptr->GetMapSize(phase_ptr->GetName());
+        if (map_size == 0u) {
+          // nothing to map in this request
+          ScheduleCB(context_ptr, node_id, kPhaseProcessingRetSkip);
+          continue;
+        }
+        phase_ptr->SetMapIndex(0, map_size);
+        if (map_size > 1u) {
+          ScheduleMap(node_id, map_size, context_ptr);
+          continue;
+        }
+      }
       // if coroutine enabled or thread pool enabled, submit job to thread pool
       if (s_enable_thread_pool_) {
-        JobClosure jc = std::bind(
-            &PhaseScheduler::RunPhaseJob, this, phase_ptr, context_ptr,
-            (*phase_param_pool_ptr_)[node->GetId()], node);
+        auto &chained_job = t_chained_job;
+        const bool is_chained =
+            s_enable_chain_fusion_ && plan_->chained[node_id];
+        const bool is_same_job = is_continuation && chained_job.in_pool_job &&
+                                 chained_job.running_scheduler == this &&
+                                 chained_job.running_ctx == context_ptr.get();
+        if (is_same_job && !chained_job.ctx_ptr &&
+            (is_chained ||
+             chained_job.depth < s_inline_continuation_depth_)) {
+          // continue on current worker after the parent job returns,
+          // nodes are sorted by critical path, the longest one stays here
+          if (!is_chained) {
+            plan_->inlined_count.fetch_add(1, std::memory_order_relaxed);
+          }
+          chained_job.scheduler = this;
+          chained_job.node_id = node_id;
+          chained_job.ctx_ptr = context_ptr;
+          continue;
+        }
+        JobClosure jc = std::bind(&PhaseScheduler::RunPoolJob, this, phase_ptr,
+                                  context_ptr, node_id);
+        auto parents = plan_->dag_plan->GetParents(node_id);
+        // a continuation keeps this worker busy, siblings go to idle ones
+        if (s_enable_affinity_ && parents.size() == 1u &&
+            !(is_same_job && chained_job.ctx_ptr)) {
+          // parent's output is likely still hot in that worker's cache
+          s_cb_thread_pool_.SubmitAffinity(
+              std::move(jc),
+              runtime_[*parents.begin()].worker.load(
+                  std::memory_order_relaxed));
+          continue;
+        }
         s_cb_thread_pool_.Submit(std::move(jc));
       } else {
-        RunPhaseJob(phase_ptr, context_ptr,
-                    (*phase_param_pool_ptr_)[node->GetId()], node);
+        RunPhaseJob(phase_ptr, context_ptr, node_id);
       }
     }
   }
   return 0;
 }
 
+void PhaseScheduler::RunPoolJob(PhasePtr phase_ptr, PhaseContextPtr ctx_ptr,
+                                uint32_t node_id) {
+  auto &chained_job = t_chained_job;
+  chained_job.in_pool_job = true;
+  chained_job.depth = 0;
+  chained_job.running_scheduler = this;
+  chained_job.running_ctx = ctx_ptr.get();
+  RunPhaseJob(phase_ptr, ctx_ptr, node_id);
+  // this may be released once EndPhase done, use scheduler of chained job
+  while (chained_job.ctx_ptr) {
+    PhaseScheduler *scheduler = chained_job.scheduler;
+    uint32_t next_id = chained_job.node_id;
+    PhaseContextPtr next_ctx_ptr = std::move(chained_job.ctx_ptr);
+    chained_job.ctx_ptr.reset();
+    ++chained_job.depth;
+    chained_job.running_scheduler = scheduler;
+    chained_job.running_ctx = next_ctx_ptr.get();
+    DAGPF_LOG_DEBUG << "run chained phase: " << scheduler->GetNode(next_id).name
+                    << std::endl;
+    scheduler->RunPhaseJob(scheduler->runtime_[next_id].phase, next_ctx_ptr,
+                           next_id);
+  }
+  chained_job.in_pool_job = false;
+  chained_job.running_scheduler = nullptr;
+  chained_job.running_ctx = nullptr;
+}
+
 void PhaseScheduler::RunPhaseJob(PhasePtr phase_ptr, PhaseContextPtr ctx_ptr,
-                                 const PhaseParamDetail &detail,
-                                 DAGNodePtr node) {
+                                 uint32_t node_id) {
   size_t run_id = s_run_id_.fetch_add(1, std::memory_order_relaxed) + 1;
+  if (s_enable_affinity_) {
+    runtime_[node_id].worker.store(s_cb_thread_pool_.GetCurrentWorker(),
+                                   std::memory_order_relaxed);
+  }
+  const auto &builtin = plan_->builtin_params[node_id];
   DAGPF_LOG_DEBUG << "run phase job " << phase_ptr->GetName()
-                  << ", flow_control = "
-                  << detail.config_key.params["flow_control"].bv << std::endl;
-  FutureWrapper<int> ret;
-  // PromiseWrapper<int> promise_ret;
-  PromiseWrapper<int> promise_ret{true};
-  do {
-    // check flow control
-    if (detail.config_key.params["flow_control"].bv) {
-      size_t flow_win_size = detail.config_key.params["flow_win_size"].iv;
-      size_t flow_limit = detail.config_key.params["flow_limit"].iv;
-      bool delay = detail.config_key.params["flow_limit_delay"].bv;
-      int delay_timeout = detail.config_key.params["delay_timeout"].iv;
-      static constexpr size_t kDelayTimeout = 5 * 1000;
-      auto flow_controller =
-          FlowControlFactory::getInstance()->getFlowController(
-              node->GetFullName(), flow_win_size, flow_limit);
-      if (flow_controller->rateLimited()) {
-        DAGPF_LOG_DEBUG << "flow limited." << std::endl;
-        if (!delay) {
-          promise_ret.SetValue(kPhaseProcessingRetFlowLimited);
-          ret = promise_ret.GetFuture();
-          break;
-        } else {
-          DAGPF_LOG_DEBUG << "submit delay task." << std::endl;
-          // submit delay task
-          if (delay_timeout == 0) delay_timeout = kDelayTimeout;
-          flow_controller->delay2(
-              run_id, delay_timeout,
-              [phase_ptr, this, ctx_ptr, node](long id, size_t timeout) {
-                JobClosure jc = std::bind([this, ctx_ptr, node]() {
-                  FutureWrapper<int> ret;
-                  // PromiseWrapper<int> promise_ret;
-                  PromiseWrapper<int> promise_ret{true};
-                  promise_ret.SetValue(kPhaseProcessingRetDelayTimeout);
-                  ret = promise_ret.GetFuture();
-                  ret.Then(std::bind(&PhaseScheduler::ScheduleCB, this, ctx_ptr,
-                                     node, std::placeholders::_1));
-                });
-                PhaseScheduler::s_cb_thread_pool_.Submit(std::move(jc));
-              },
-              &PhaseScheduler::RunPhaseJobThin, this, phase_ptr, ctx_ptr,
-              detail, node);
-          return;
-        }
+                  << ", flow_control = " << builtin.flow_control << std::endl;
+  // check flow control
+  if (builtin.flow_control) {
+    auto flow_controller = FlowControlFactory::getInstance()->getFlowController(
+        builtin.flow_name, builtin.flow_win_size, builtin.flow_limit);
+    if (flow_controller->rateLimited()) {
+      DAGPF_LOG_DEBUG << "flow limited." << std::endl;
+      if (!builtin.flow_limit_delay) {
+        ScheduleCB(ctx_ptr, node_id, kPhaseProcessingRetFlowLimited);
+        return;
       }
+      DAGPF_LOG_DEBUG << "submit delay task." << std::endl;
+      // submit delay task
+      flow_controller->delay2(
+          run_id, builtin.delay_timeout,
+          [phase_ptr, this, ctx_ptr, node_id](long id, size_t timeout) {
+            JobClosure jc = std::bind([this, ctx_ptr, node_id]() {
+              ScheduleCB(ctx_ptr, node_id, kPhaseProcessingRetDelayTimeout);
+            });
+            PhaseScheduler::s_cb_thread_pool_.Submit(std::move(jc));
+          },
+          &PhaseScheduler::RunPhaseJobThin, this, phase_ptr, ctx_ptr,
+          node_id);
+      return;
     }
-  } while (0);
-  if (ret.IsDone()) {
-    // flow limited
-    ret.Then(std::bind(&PhaseScheduler::ScheduleCB, this, ctx_ptr, node,
-                       std::placeholders::_1));
-  } else {
-    RunPhaseJobThin(phase_ptr, ctx_ptr, detail, node);
   }
+  RunPhaseJobThin(phase_ptr, ctx_ptr, node_id);
 }
 
 void PhaseScheduler::RunPhaseJobThin(PhasePtr phase_ptr,
                                      PhaseContextPtr ctx_ptr,
-                                     const PhaseParamDetail &detail,
-                                     DAGNodePtr node) {
+                                     uint32_t node_id) {
   DAGPF_LOG_DEBUG << "run phase job without other top level logic: "
                   << phase_ptr->GetName() << std::endl;
-  FutureWrapper<int> ret;
-  // PromiseWrapper<int> promise_ret;
-  PromiseWrapper<int> promise_ret{true};
-  do {
-    try {
-      ret = phase_ptr->Run(ctx_ptr, detail);
-      break;
-    } catch (std::exception &ex) {
-      DAGPF_LOG_ERROR << "run phase: " << phase_ptr->GetName()
-                      << " catch exception: " << ex.what() << std::endl;
-    } catch (...) {
-      DAGPF_LOG_ERROR << "run phase: " << phase_ptr->GetName()
-                      << " catch unknown exception: " << std::endl;
-    }
-    promise_ret.SetValue(kPhaseProcessingRetSkip);
-    ret = promise_ret.GetFuture();
-  } while (0);
+  std::shared_ptr<NodeHedgeContext> hedge_ctx;
+  if (plan_->has_hedge_node) {
+    hedge_ctx = StartHedge(ctx_ptr, node_id);
+  }
+  CompletionRef<int> ret;
+  try {
+    ret = phase_ptr->Run(ctx_ptr, plan_->phase_param_pool[node_id]);
+  } catch (std::exception &ex) {
+    DAGPF_LOG_ERROR << "run phase: " << phase_ptr->GetName()
+                    << " catch exception: " << ex.what() << std::endl;
+  } catch (...) {
+    DAGPF_LOG_ERROR << "run phase: " << phase_ptr->GetName()
+                    << " catch unknown exception: " << std::endl;
+  }
+  if (!ret) {
+    // exception is taken as skipped, no redo
+    if (hedge_ctx) {
+      hedge_ctx->Finish(kPhaseProcessingRetSkip, true);
+      return;
+    }
+    ScheduleCB(ctx_ptr, node_id, kPhaseProcessingRetSkip);
+    return;
+  }
   if (ret.IsDone()) {
     DAGPF_LOG_DEBUG << "ret is Done, value = " << ret.GetValue() << std::endl;
   }
+  if (hedge_ctx) {
+    ret.Then(std::bind(&NodeHedgeContext::Finish, hedge_ctx,
+                       std::placeholders::_1, true));
+    return;
+  }
   // redo logic
-  static constexpr size_t kRedoDefaultRetryTimes = 3;
-  static constexpr size_t kRedoDefaultRetryInterval =
-      1000;  // retry every 500ms
-  if (detail.config_key.params["redo"].bv and s_enable_thread_pool_) {
+  const auto &builtin = plan_->builtin_params[node_id];
+  if (builtin.redo and s_enable_thread_pool_) {
     do {
       if (ret.IsDone() and ret.GetValue() != kPhaseProcessingRetRedo) break;
-      int max_retry_times = detail.config_key.params["redo_retry_times"].iv;
-      if (max_retry_times == 0) {
-        max_retry_times = kRedoDefaultRetryTimes;
-      }
-      int retry_interval = detail.config_key.params["redo_retry_interval"].iv;
-      if (retry_interval == 0) {
-        retry_interval = kRedoDefaultRetryInterval;
-      }
-      auto redo_ctx =
-          std::make_shared<NodeRedoContext>(max_retry_times, retry_interval);
+      const int retry_interval = builtin.redo_retry_interval;
+      auto redo_ctx = std::make_shared<NodeRedoContext>(
+          builtin.redo_retry_times, retry_interval);
       size_t run_id = s_run_id_.fetch_add(std::memory_order_relaxed) + 1;
       redo_ctx->run_id = run_id;
       redo_ctx->phase_ptr = phase_ptr;
-      redo_ctx->node = node;
+      redo_ctx->node = &GetNode(node_id);
       redo_ctx->ctx_ptr = ctx_ptr;
       using std::placeholders::_1;
       using std::placeholders::_2;
       using std::placeholders::_3;
       redo_ctx->redo_scheduler_fn =
-          std::bind(&PhaseScheduler::RunPhaseJobThin, this, _1, _2, detail, _3);
+          std::bind(&PhaseScheduler::RunPhaseJobThin, this, _1, _2, _3);
       DAGPF_LOG_DEBUG << "set redo. phase_name: " << phase_ptr->GetName()
                       << ", retry_times: "
                       << redo_ctx->phase_ptr->GetRedoRetryTimes()
@@ -359,90 +1106,115 @@ void PhaseScheduler::RunPhaseJobThin(PhasePtr phase_ptr,
       return;
     } while (0);
   }
-  ret.Then(std::bind(&PhaseScheduler::ScheduleCB, this, ctx_ptr, node,
+  ret.Then(std::bind(&PhaseScheduler::ScheduleCB, this, ctx_ptr, node_id,
                      std::placeholders::_1));
 }
 
 int PhaseScheduler::ScheduleRedoCB(std::shared_ptr<NodeRedoContext> redo_ctx,
-                                   const FutureWrapper<int> &last_phase_ret) {
+                                   int last_phase_ret) {
   DAGPF_LOG_DEBUG << "phase_name: " << redo_ctx->phase_ptr->GetName()
                   << ", max_retry_times: " << redo_ctx->max_retry_times
                   << ", phase retry_times: "
                   << redo_ctx->phase_ptr->GetRedoRetryTimes() << std::endl;
   // if need redo
-  if (redo_ctx->node != dag_.GetEndNode() and last_phase_ret.IsDone() and
-      last_phase_ret.GetValue() == kPhaseProcessingRetRedo) {
+  if (redo_ctx->node->id != plan_->dag_plan->GetEndNodeId() and
+      last_phase_ret == kPhaseProcessingRetRedo) {
     int retry_times = redo_ctx->phase_ptr->GetRedoRetryTimes();
     if (retry_times > redo_ctx->max_retry_times) {
       DAGPF_LOG_DEBUG << "max retry limit, phase_name: "
-                      << redo_ctx->node->GetName() << std::endl;
-      FutureWrapper<int> phase_ret;
-      // PromiseWrapper<int> promise_ret;
-      PromiseWrapper<int> promise_ret{true};
-      promise_ret.SetValue(kPhaseProcessingRetMaxRetry);
-      phase_ret = promise_ret.GetFuture();
-      return this->ScheduleCB(redo_ctx->ctx_ptr, redo_ctx->node, phase_ret);
+                      << redo_ctx->node->name << std::endl;
+      return this->ScheduleCB(redo_ctx->ctx_ptr, redo_ctx->node->id,
+                              kPhaseProcessingRetMaxRetry);
     }
     DAGPF_LOG_DEBUG << "submit redo timer callback, phase_name: "
-                    << redo_ctx->node->GetName() << std::endl;
+                    << redo_ctx->node->name << std::endl;
     // submit redo timer callback
     return s_timer_thread_.push(
         redo_ctx->run_id, std::bind(&NodeRedoContext::RedoCallback, redo_ctx),
         redo_ctx->retry_interval);
   } else {
-    return this->ScheduleCB(redo_ctx->ctx_ptr, redo_ctx->node, last_phase_ret);
+    return this->ScheduleCB(redo_ctx->ctx_ptr, redo_ctx->node->id,
+                            last_phase_ret);
   }
 }
 
-int PhaseScheduler::UpdateStatis(DAGNodePtr node,
-                                 const FutureWrapper<int> &last_phase_ret) {
+int64_t PhaseScheduler::GetHedgeDelayMs(uint32_t node_id) const {
+  static constexpr uint64_t kHedgeMinSamples = 16;
+  const auto &policy = plan_->hedge_policies[node_id];
+  if (policy.percentile > 0.0) {
+    int64_t cost = plan_->latency_histograms[node_id].GetPercentile(
+        policy.percentile, kHedgeMinSamples);
+    if (cost >= 0) {
+      // timer is in ms
+      return std::max<int64_t>((cost + 999) / 1000, 1);
+    }
+  }
+  return policy.after_ms;
+}
+
+std::shared_ptr<NodeHedgeContext> PhaseScheduler::StartHedge(
+    PhaseContextPtr ctx_ptr, uint32_t node_id) {
+  // hedge instance runs in pool, launched by timer
+  if (!s_enable_thread_pool_ || !s_enable_timer_thread_) return nullptr;
+  int64_t delay_ms = GetHedgeDelayMs(node_id);
+  if (delay_ms <= 0) return nullptr;
+  auto hedge_ctx = std::make_shared<NodeHedgeContext>();
+  hedge_ctx->run_id = s_run_id_.fetch_add(1, std::memory_order_relaxed) + 1;
+  hedge_ctx->scheduler = this;
+  hedge_ctx->ctx_ptr = std::move(ctx_ptr);
+  hedge_ctx->node_id = node_id;
+  hedge_ctx->start_us = Utils::getNowUs();
+  DAGPF_LOG_DEBUG << "set hedge. phase_name: " << GetNode(node_id).name
+                  << ", delay_ms: " << delay_ms << std::endl;
+  s_timer_thread_.push(hedge_ctx->run_id,
+                       std::bind(&NodeHedgeContext::HedgeCallback, hedge_ctx),
+                       delay_ms);
+  return hedge_ctx;
+}
+
+int PhaseScheduler::UpdateStatis(uint32_t node_id, int last_phase_ret) {
   // record phase ret
   if (!s_enable_statis_) return 0;
   // record scheduler path
-  // topology_array_[schedule_cursor_++] = node;
-  topology_array_[schedule_cursor_.fetch_add(1, std::memory_order_relaxed)] =
-      node;
+  runtime_.GetTopology()[schedule_cursor_.fetch_add(
+      1, std::memory_order_relaxed)] = node_id;
   // calculate timecost
-  phase_timecost_array_[node->GetId()] =
-      Utils::getNowMs() - phase_timecost_array_[node->GetId()];
+  runtime_[node_id].timecost =
+      Utils::getNowUs() - runtime_[node_id].timecost;
+  // update observed cost, ewma with alpha = 1/8
+  auto &cost_ewma = plan_->cost_ewma[node_id];
+  int64_t last_cost = cost_ewma.load(std::memory_order_relaxed);
+  int64_t cost = runtime_[node_id].timecost;
+  cost_ewma.store(last_cost == 0 ? cost : last_cost + (cost - last_cost) / 8,
+                  std::memory_order_relaxed);
   return 0;
 }
 
 std::string PhaseScheduler::GetPhaseRetDescription(uint32_t id) {
-  std::string ret_str;
-  const FutureWrapper<int> &ret = phase_ret_array_[id];
-  if (ret.IsDone()) {
-    ret_str.append("ret:").append(std::to_string(ret.GetValue()));
-  } else {
-    ret_str.append("ret: None.");
-  }
+  // only completed nodes are recorded in the schedule path
+  std::string ret_str("ret:");
+  ret_str.append(std::to_string(runtime_[id].ret));
   return ret_str;
 }
 
-//打印统计日志:包括业务自定义日志、每阶段耗时及返回值
-int PhaseScheduler::ReportStatis(PhaseContextPtr ctx_ptr) {
-  if (!s_enable_statis_ || !ctx_ptr->log_switch) {
-    return 0;
-  }
-  //业务自定义log部分
-  const std::string &str_head = ctx_ptr->GetLogHead();
-  std::string str_procedure_statis;
-  for (auto iter = topology_array_.begin(); iter != topology_array_.end();
-       ++iter) {
-    int64_t timecost = phase_timecost_array_[(*iter)->GetId()];
-    std::string desc = GetPhaseRetDescription((*iter)->GetId());
-    if (!str_head.empty()) {
-      str_procedure_statis.append("|");
-    } else if (iter != topology_array_.begin()) {
-      str_procedure_statis.append("|");
-    }
-    str_procedure_statis.append((*iter)->GetName())
-        .append("(phase_ret[")
-        .append(desc)
-        .append("],timecost[")
-        .append(std::to_string(timecost))
-        .append("])");
+// 追加单个阶段的返回值及耗时，有业务日志头时每段均以|分隔
+static void AppendPhaseStatis(std::string_view name, const std::string &desc,
+                              int64_t timecost_us, bool need_separator,
+                              std::string &str_procedure_statis) {
+  if (need_separator) {
+    str_procedure_statis.append("|");
   }
+  str_procedure_statis.append(name)
+      .append("(phase_ret[")
+      .append(desc)
+      .append("],timecost[")
+      .append(std::to_string(timecost_us / 1000))
+      .append("])");
+}
+
+// 追加总耗时后输出到日志及业务handler
+static void ExportStatis(PhaseContextPtr ctx_ptr, const std::string &str_head,
+                         std::string &str_procedure_statis) {
   DAGPF_LOG_DEBUG << "report statis." << std::endl;
   str_procedure_statis.append("|total_timecost:")
       .append(std::to_string(Utils::getNowMs() - ctx_ptr->create_time_ms));
@@ -455,34 +1227,222 @@ int PhaseScheduler::ReportStatis(PhaseContextPtr ctx_ptr) {
       handler(log_content);
     }
   }
+}
+
+//打印统计日志:包括业务自定义日志、每阶段耗时及返回值
+int PhaseScheduler::ReportStatis(PhaseContextPtr ctx_ptr) {
+  if (!s_enable_statis_ || !ctx_ptr->log_switch) {
+    return 0;
+  }
+  //业务自定义log部分
+  const std::string &str_head = ctx_ptr->GetLogHead();
+  std::string str_procedure_statis;
+  const uint32_t *topology_begin = runtime_.GetTopology();
+  const uint32_t *topology_end =
+      topology_begin + schedule_cursor_.load(std::memory_order_relaxed);
+  for (auto iter = topology_begin; iter != topology_end; ++iter) {
+    AppendPhaseStatis(GetNode(*iter).name, GetPhaseRetDescription(*iter),
+                      runtime_[*iter].timecost,
+                      !str_head.empty() || iter != topology_begin,
+                      str_procedure_statis);
+  }
+  ExportStatis(ctx_ptr, str_head, str_procedure_statis);
   return 0;
 }
 
 /// phase执行完毕后的回调
-int PhaseScheduler::ScheduleCB(PhaseContextPtr ctx_ptr, DAGNodePtr node,
-                               const FutureWrapper<int> &last_phase_ret) {
-  DAGPF_LOG_DEBUG << "cb return of phase: " << node->GetName()
+int PhaseScheduler::ScheduleCB(PhaseContextPtr ctx_ptr, uint32_t node_id,
+                               int last_phase_ret) {
+  DAGPF_LOG_DEBUG << "cb return of phase: " << GetNode(node_id).name
                   << ", timestamp: " << Utils::getNowMs() << std::endl;
+  if (plan_->map_nodes[node_id] &&
+      runtime_[node_id].map_pending.load(std::memory_order_acquire) > 0) {
+    // map instance done, the last one goes on with the joined ret
+    int map_ret = kPhaseProcessingRetOk;
+    if (!JoinMap(node_id, last_phase_ret, map_ret)) return 0;
+    return ScheduleCB(ctx_ptr, node_id, map_ret);
+  }
   //记录返回值
-  phase_ret_array_[node->GetId()] = last_phase_ret;
-  UpdateStatis(node, last_phase_ret);
-  if (node != dag_.GetEndNode() && last_phase_ret.IsDone() &&
-      (last_phase_ret.GetValue() == kPhaseProcessingRetInterrupt ||
-       last_phase_ret.GetValue() == kPhaseProcessingRetFlowLimited) &&
+  runtime_[node_id].ret = last_phase_ret;
+  UpdateStatis(node_id, last_phase_ret);
+  if (plan_->has_memo_node && !memo_keys_[node_id].empty()) {
+    StoreMemo(node_id, ctx_ptr, last_phase_ret);
+  }
+  const bool is_end_node = node_id == plan_->dag_plan->GetEndNodeId();
+  if (!is_end_node &&
+      (last_phase_ret == kPhaseProcessingRetInterrupt ||
+       last_phase_ret == kPhaseProcessingRetFlowLimited) &&
       !is_sig_interrupted_.load(std::memory_order_acquire)) {
     //设置中断标记
-    ir_reason_.store(last_phase_ret.GetValue(), std::memory_order_relaxed);
+    ir_reason_.store(last_phase_ret, std::memory_order_relaxed);
     is_sig_interrupted_.store(true, std::memory_order_release);
   }
   // last phase
-  if (node == dag_.GetEndNode()) {
-    ctx_ptr->is_interrupted =
+  if (is_end_node) {
+    uint64_t finished_count =
+        plan_->finished_count.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (s_critical_path_refresh_interval_ > 0 &&
+        finished_count % s_critical_path_refresh_interval_ == 0) {
+      plan_->RefreshCriticalPath();
+    }
+    const bool is_interrupted =
         is_sig_interrupted_.load(std::memory_order_relaxed);
-    ctx_ptr->ir_reason = ir_reason_.load(std::memory_order_relaxed);
+    const int ir_reason = ir_reason_.load(std::memory_order_relaxed);
+    if (finish_fn_) {
+      // sub plan done, interruption is passed on to the outer node
+      finish_fn_(is_interrupted ? ir_reason : kPhaseProcessingRetOk);
+      return 0;
+    }
+    ctx_ptr->is_interrupted = is_interrupted;
+    ctx_ptr->ir_reason = ir_reason;
     ReportStatis(ctx_ptr);
     return 0;
   }
-  return ScheduleChildren(node, ctx_ptr);
+  if (!plan_->skip_frontier[node_id].empty() &&
+      last_phase_ret == kPhaseProcessingRetSkip) {
+    return ScheduleSkipFrontier(node_id, ctx_ptr);
+  }
+  return ScheduleChildren(node_id, ctx_ptr);
+}
+
+int PhaseScheduler::StartBatch(const std::vector<PhaseContextPtr> &context_ptrs,
+                               BatchRunResult *result) const {
+  if (!is_DAG_built_) {
+    DAGPF_LOG_ERROR << "DAG is not built." << std::endl;
+    return kPhaseSchedulerRetDAGNotBuilt;
+  }
+  BatchRunResult local_result;
+  BatchRunResult &batch_result = result ? *result : local_result;
+  const int64_t now_ms = Utils::getNowMs();
+  for (const auto &ctx_ptr : context_ptrs) {
+    ctx_ptr->create_time_ms = now_ms;
+  }
+  std::vector<int> ir_reasons;
+  RunBatch(*plan_, context_ptrs, false, batch_result, ir_reasons);
+  const auto &topology_order = plan_->topology_order;
+  for (size_t i = 0; i < context_ptrs.size(); ++i) {
+    const auto &ctx_ptr = context_ptrs[i];
+    ctx_ptr->is_interrupted = ir_reasons[i] != 0;
+    ctx_ptr->ir_reason = ir_reasons[i];
+    if (!s_enable_statis_ || !ctx_ptr->log_switch) continue;
+    // 按执行顺序输出本上下文调度过的节点
+    const std::string &str_head = ctx_ptr->GetLogHead();
+    std::string str_procedure_statis;
+    for (auto node_id : topology_order) {
+      const int ret = batch_result.rets[i][node_id];
+      if (ret == BatchRunResult::kRetNone) continue;
+      AppendPhaseStatis(GetNode(node_id).name,
+                        "ret:" + std::to_string(ret),
+                        batch_result.timecost[node_id],
+                        !str_head.empty() || !str_procedure_statis.empty(),
+                        str_procedure_statis);
+    }
+    ExportStatis(ctx_ptr, str_head, str_procedure_statis);
+  }
+  return 0;
+}
+
+// 逐上下文记录剩余入度，按拓扑序到达节点时其父节点均已处理
+// 入度未减到0的上下文属于被跳过的子图，不调度该节点
+void PhaseScheduler::RunBatch(const SchedulerPlan &plan,
+                              const std::vector<PhaseContextPtr> &context_ptrs,
+                              bool is_sub_plan, BatchRunResult &result,
+                              std::vector<int> &ir_reasons) {
+  const auto &dag_plan = *plan.dag_plan;
+  const size_t node_num = dag_plan.Size();
+  const size_t batch_size = context_ptrs.size();
+  const uint32_t start_node_id = dag_plan.GetStartNodeId();
+  const uint32_t end_node_id = dag_plan.GetEndNodeId();
+  result.rets.assign(batch_size,
+                     std::vector<int>(node_num, BatchRunResult::kRetNone));
+  result.timecost.assign(node_num, 0);
+  ir_reasons.assign(batch_size, 0);
+  std::vector<int> pending(node_num * batch_size);
+  for (uint32_t id = 0; id < node_num; ++id) {
+    std::fill_n(pending.begin() + id * batch_size, batch_size,
+                dag_plan.GetNode(id).indegree);
+  }
+  std::vector<PhaseContextPtr> active_ctxs;
+  std::vector<size_t> active_index;
+  std::vector<int> active_rets;
+  for (auto node_id : plan.topology_order) {
+    const int *node_pending = &pending[node_id * batch_size];
+    const bool is_boundary =
+        is_sub_plan && (node_id == start_node_id || node_id == end_node_id);
+    active_ctxs.clear();
+    active_index.clear();
+    for (size_t i = 0; i < batch_size; ++i) {
+      if (node_pending[i] > 0) continue;
+      if (is_boundary) {
+        result.rets[i][node_id] = kPhaseProcessingRetOk;
+      } else if (ir_reasons[i] != 0 && node_id != end_node_id) {
+        result.rets[i][node_id] = kPhaseProcessingRetSkip;
+      } else {
+        active_ctxs.push_back(context_ptrs[i]);
+        active_index.push_back(i);
+      }
+    }
+    if (!active_ctxs.empty()) {
+      const int64_t start_us = Utils::getNowUs();
+      RunBatchNode(plan, node_id, active_ctxs, active_rets);
+      result.timecost[node_id] = Utils::getNowUs() - start_us;
+      for (size_t j = 0; j < active_index.size(); ++j) {
+        result.rets[active_index[j]][node_id] = active_rets[j];
+      }
+    }
+    const auto &skip_frontier = plan.skip_frontier[node_id];
+    for (size_t i = 0; i < batch_size; ++i) {
+      if (node_pending[i] > 0) continue;
+      const int ret = result.rets[i][node_id];
+      if (node_id != end_node_id && ir_reasons[i] == 0 &&
+          (ret == kPhaseProcessingRetInterrupt ||
+           ret == kPhaseProcessingRetFlowLimited)) {
+        ir_reasons[i] = ret;
+      }
+      if (!skip_frontier.empty() && ret == kPhaseProcessingRetSkip) {
+        for (const auto &item : skip_frontier) {
+          pending[item.first * batch_size + i] -= item.second;
+        }
+        continue;
+      }
+      for (auto child : dag_plan.GetLinks(node_id)) {
+        --pending[child * batch_size + i];
+      }
+    }
+  }
+}
+
+void PhaseScheduler::RunBatchNode(
+    const SchedulerPlan &plan, uint32_t node_id,
+    const std::vector<PhaseContextPtr> &context_ptrs,
+    std::vector<int> &rets) {
+  const auto &node = plan.dag_plan->GetNode(node_id);
+  if (plan.sub_plans[node_id]) {
+    // sub plan runs as a batch too, interruption is the node's ret
+    BatchRunResult sub_result;
+    RunBatch(*plan.sub_plans[node_id], context_ptrs, true, sub_result, rets);
+    return;
+  }
+  auto generator = plan.phase_generators[node_id];
+  std::unique_ptr<Phase> phase_ptr(generator ? (*generator)() : nullptr);
+  if (!phase_ptr) {
+    DAGPF_LOG_ERROR << "cant create phase instance: " << node.full_name
+                    << std::endl;
+    rets.assign(context_ptrs.size(), kPhaseProcessingRetSkip);
+    return;
+  }
+  phase_ptr->SetName(node.name);
+  try {
+    phase_ptr->RunBatch(context_ptrs, plan.phase_param_pool[node_id], rets);
+    return;
+  } catch (std::exception &ex) {
+    DAGPF_LOG_ERROR << "run batch phase: " << node.name
+                    << " catch exception: " << ex.what() << std::endl;
+  } catch (...) {
+    DAGPF_LOG_ERROR << "run batch phase: " << node.name
+                    << " catch unknown exception: " << std::endl;
+  }
+  rets.assign(context_ptrs.size(), kPhaseProcessingRetSkip);
 }
 
 void PhaseScheduler::InitSchedulerThreadPool(const SchedulerOption &option) {
@@ -505,21 +1465,156 @@ void PhaseScheduler::InitSchedulerThreadPool(const SchedulerOption &option) {
     s_timer_thread_.start();
   }
   s_enable_timeout_check_ = option.enable_timeout;
+  s_critical_path_refresh_interval_ = option.critical_path_refresh_interval;
+  s_enable_transitive_reduction_ = option.enable_transitive_reduction;
+  s_enable_chain_fusion_ = option.enable_chain_fusion;
+  s_inline_continuation_depth_ = option.inline_continuation_depth;
+  s_parallel_build_threshold_ = option.parallel_build_threshold;
+  s_enable_affinity_ = option.enable_affinity;
+  s_pool_thread_num_ = option.pool_option.thread_num;
+  s_scheduler_pool_capacity_ = option.scheduler_pool_capacity;
+  s_memo_cache_.Init(option.memo_cache_capacity, option.memo_ttl_ms);
+  SchedulerPlanCache::GetInstance()->SetCapacity(option.plan_cache_capacity);
+}
+
+void PhaseScheduler::ParallelFor(
+    size_t n, const std::function<void(size_t, size_t)> &fn) {
+  static constexpr size_t kGrainSize = 1024;
+  const size_t chunk_num = (n + kGrainSize - 1) / kGrainSize;
+  if (chunk_num <= 1 || !s_enable_thread_pool_ || s_pool_thread_num_ == 0) {
+    if (n > 0) fn(0, n);
+    return;
+  }
+  struct ParallelState {
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> done{0};
+    std::mutex mutex;
+    std::condition_variable cond;
+  };
+  auto state = std::make_shared<ParallelState>();
+  // jobs started after all chunks are claimed return without touching fn
+  auto run = [state, chunk_num, n, &fn]() {
+    size_t chunk;
+    while ((chunk = state->next.fetch_add(1, std::memory_order_relaxed)) <
+           chunk_num) {
+      size_t begin = chunk * kGrainSize;
+      fn(begin, std::min(n, begin + kGrainSize));
+      if (state->done.fetch_add(1, std::memory_order_acq_rel) + 1 ==
+          chunk_num) {
+        std::lock_guard<std::mutex> locker(state->mutex);
+        state->cond.notify_all();
+      }
+    }
+  };
+  size_t helper_num = std::min<size_t>(chunk_num - 1, s_pool_thread_num_);
+  for (size_t i = 0; i < helper_num; ++i) {
+    s_cb_thread_pool_.Submit(JobClosure(run));
+  }
+  run();
+  std::unique_lock<std::mutex> locker(state->mutex);
+  state->cond.wait(locker, [&state, chunk_num]() {
+    return state->done.load(std::memory_order_acquire) == chunk_num;
+  });
+}
+
+PhaseScheduler *PhaseScheduler::Acquire(const SchedulerPlanPtr &plan) {
+  PhaseScheduler *scheduler = plan ? plan->scheduler_pool.Pop() : nullptr;
+  if (scheduler == nullptr) {
+    scheduler = new PhaseScheduler();
+  }
+  scheduler->is_pooled_ = true;
+  return scheduler;
+}
+
+void PhaseScheduler::Release(PhaseScheduler *scheduler) {
+  if (scheduler == nullptr) return;
+  if (!scheduler->is_pooled_ || !scheduler->plan_ ||
+      scheduler->runtime_.Size() != scheduler->plan_->dag_plan->Size()) {
+    delete scheduler;
+    return;
+  }
+  // keep runtime storage and phase instances for the next request of the
+  // plan, drop the plan reference, the pool lives no longer than the plan
+  SchedulerPlanPtr plan = std::move(scheduler->plan_);
+  scheduler->plan_.reset();
+  scheduler->is_DAG_built_ = false;
+  scheduler->has_started_ = false;
+  if (!plan->scheduler_pool.Push(scheduler)) {
+    delete scheduler;
+  }
+}
+
+SchedulerFreeList::~SchedulerFreeList() {
+  for (size_t i = 0; i < capacity_; ++i) {
+    delete slots_[i].load(std::memory_order_acquire);
+  }
+}
+
+void SchedulerFreeList::Init(size_t capacity) {
+  capacity_ = capacity;
+  slots_.reset(capacity == 0 ? nullptr
+                             : new std::atomic<PhaseScheduler *>[capacity]);
+  for (size_t i = 0; i < capacity_; ++i) {
+    slots_[i].store(nullptr, std::memory_order_relaxed);
+  }
+  size_.store(0, std::memory_order_relaxed);
+}
+
+// 各线程的起始槽位
+static size_t GetSlotHint() {
+  static std::atomic<size_t> s_next_hint{0};
+  thread_local size_t t_slot_hint =
+      s_next_hint.fetch_add(1, std::memory_order_relaxed);
+  return t_slot_hint;
+}
+
+PhaseScheduler *SchedulerFreeList::Pop() {
+  if (size_.load(std::memory_order_relaxed) <= 0) return nullptr;
+  const size_t hint = GetSlotHint();
+  for (size_t i = 0; i < capacity_; ++i) {
+    auto &slot = slots_[(hint + i) % capacity_];
+    if (slot.load(std::memory_order_relaxed) == nullptr) continue;
+    PhaseScheduler *scheduler =
+        slot.exchange(nullptr, std::memory_order_acquire);
+    if (scheduler != nullptr) {
+      size_.fetch_sub(1, std::memory_order_relaxed);
+      return scheduler;
+    }
+  }
+  return nullptr;
+}
+
+bool SchedulerFreeList::Push(PhaseScheduler *scheduler) {
+  if (size_.load(std::memory_order_relaxed) >=
+      static_cast<int64_t>(capacity_)) {
+    return false;
+  }
+  const size_t hint = GetSlotHint();
+  for (size_t i = 0; i < capacity_; ++i) {
+    auto &slot = slots_[(hint + i) % capacity_];
+    PhaseScheduler *expected = nullptr;
+    if (slot.load(std::memory_order_relaxed) == nullptr &&
+        slot.compare_exchange_strong(expected, scheduler,
+                                     std::memory_order_release,
+                                     std::memory_order_relaxed)) {
+      size_.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+  return false;
 }
 
 void PhaseScheduler::Clear() {
-  dag_.Clear();
+  plan_.reset();
   is_DAG_built_ = false;
   has_started_ = false;
-  topology_array_.clear();
+  runtime_.Release();
+  phase_plan_ = nullptr;
+  memo_keys_.clear();
   schedule_cursor_.store(0, std::memory_order_relaxed);
-  phase_ret_array_.clear();
-  phase_timecost_array_.clear();
   is_sig_interrupted_.store(false, std::memory_order_relaxed);
   ir_reason_.store(0, std::memory_order_relaxed);
-  phase_pool_.clear();
-  phase_param_pool_.clear();
-  phase_param_pool_ptr_ = nullptr;
+  sub_plan_map_.clear();
 }
 
 static std::once_flag init_scheduler_once;
@@ -541,8 +1636,8 @@ int NodeTimeoutContext::DoTimeout() {
 }
 
 void NodeTimeoutContext::AfterTimeout() {
-  DAGPF_LOG_DEBUG << "phase timeout, name = " << node->GetName()
-                  << ", full name = " << node->GetFullName()
+  DAGPF_LOG_DEBUG << "phase timeout, name = " << node->name
+                  << ", full name = " << node->full_name
                   << ", run_id = " << run_id << ", timeout = " << timeout
                   << std::endl;
   phase_ptr->NotifyTimeout();
@@ -557,26 +1652,78 @@ int NodeRedoContext::RedoCallback() {
 }
 
 void NodeRedoContext::Redo(PhasePtr phase_ptr, PhaseContextPtr ctx_ptr,
-                           DAGNodePtr node) {
-  DAGPF_LOG_DEBUG << "redo phase, name = " << node->GetName()
-                  << ", full name = " << node->GetFullName()
+                           const DAGPlanNode *node) {
+  DAGPF_LOG_DEBUG << "redo phase, name = " << node->name
+                  << ", full name = " << node->full_name
                   << ", runId = " << run_id << std::endl;
-  this->redo_scheduler_fn(phase_ptr, ctx_ptr, node);
+  this->redo_scheduler_fn(phase_ptr, ctx_ptr, node->id);
 }
 
 void NodeRedoContext::Redo2() {
-  DAGPF_LOG_DEBUG << "redo phase, name = " << node->GetName()
-                  << ", full name = " << node->GetFullName()
+  DAGPF_LOG_DEBUG << "redo phase, name = " << node->name
+                  << ", full name = " << node->full_name
                   << ", runId = " << run_id << std::endl;
-  this->redo_scheduler_fn(this->phase_ptr, this->ctx_ptr, this->node);
+  this->redo_scheduler_fn(this->phase_ptr, this->ctx_ptr, this->node->id);
+}
+
+int NodeHedgeContext::HedgeCallback() {
+  if (done.load(std::memory_order_acquire)) return 0;
+  JobClosure jc = std::bind(&NodeHedgeContext::Hedge, shared_from_this());
+  PhaseScheduler::s_cb_thread_pool_.Submit(std::move(jc));
+  return 0;
+}
+
+void NodeHedgeContext::Hedge() {
+  if (done.load(std::memory_order_acquire)) return;
+  const auto &node = scheduler->GetNode(node_id);
+  PhasePtr phase_ptr(scheduler->NewPhase(node_id));
+  if (!phase_ptr) {
+    DAGPF_LOG_ERROR << "cant create hedge phase instance: " << node.name
+                    << std::endl;
+    return;
+  }
+  DAGPF_LOG_DEBUG << "hedge phase, name = " << node.name
+                  << ", full name = " << node.full_name
+                  << ", runId = " << run_id << std::endl;
+  phase_ptr->SetName(node.name);
+  hedge_phase_ptr = phase_ptr;
+  scheduler->plan_->hedged_count.fetch_add(1, std::memory_order_relaxed);
+  CompletionRef<int> ret;
+  try {
+    ret = phase_ptr->Run(ctx_ptr, scheduler->plan_->phase_param_pool[node_id]);
+  } catch (...) {
+    // the first instance is still running, leave it to finish
+    DAGPF_LOG_ERROR << "run hedge phase: " << node.name
+                    << " catch exception." << std::endl;
+    return;
+  }
+  ret.Then(std::bind(&NodeHedgeContext::Finish, shared_from_this(),
+                     std::placeholders::_1, false));
+}
+
+int NodeHedgeContext::Finish(int ret, bool is_primary) {
+  const auto &plan = scheduler->plan_;
+  if (is_primary) {
+    // latency without hedging, hedge_percentile is derived from it
+    plan->latency_histograms[node_id].Add(Utils::getNowUs() - start_us);
+  }
+  if (done.exchange(true, std::memory_order_acq_rel)) {
+    // the other instance won, discard this ret
+    return 0;
+  }
+  PhaseScheduler::s_timer_thread_.erase(run_id);
+  if (!is_primary) {
+    plan->hedge_won_count.fetch_add(1, std::memory_order_relaxed);
+  }
+  return scheduler->ScheduleCB(ctx_ptr, node_id, ret);
 }
 
 int PhaseScheduler::ClearTimer(std::shared_ptr<NodeTimeoutContext> ctx,
-                               const FutureWrapper<int> &ret) {
+                               int ret) {
   // normal phase terminate
   int erase_ret = s_timer_thread_.erase(ctx->run_id);
   DAGPF_LOG_DEBUG << "clear timer."
-                  << ", full name = " << ctx->node->GetFullName()
+                  << ", full name = " << ctx->node->full_name
                   << ", runId = " << ctx->run_id
                   << ", timeout = " << ctx->timeout << std::endl;
   if (erase_ret == 0) {
@@ -591,7 +1738,8 @@ int PhaseScheduler::ClearTimer(std::shared_ptr<NodeTimeoutContext> ctx,
 // reusedScheduler: 从已初始化的scheduler复制一份，避免每次重复构建DAG
 int StartScheduler(const PhaseScheduler &reused_scheduler,
                    PhaseContextPtr context_ptr) {
-  context_ptr->scheduler_ptr = new PhaseScheduler();
+  context_ptr->scheduler_ptr =
+      PhaseScheduler::Acquire(reused_scheduler.GetPlan());
   int ret = context_ptr->scheduler_ptr->CopyFrom(reused_scheduler);
   if (ret != 0) {
     DAGPF_LOG_ERROR << "copy scheduler failed." << std::endl;
@@ -602,10 +1750,122 @@ int StartScheduler(const PhaseScheduler &reused_scheduler,
   return context_ptr->scheduler_ptr->Start(context_ptr);
 }
 
+SchedulerPlanPtr SchedulerPlanCache::Get(const std::string &key) {
+  std::lock_guard<std::mutex> locker(mutex_);
+  auto iter = plan_map_.find(key);
+  if (iter == plan_map_.end()) {
+    return nullptr;
+  }
+  plan_list_.splice(plan_list_.begin(), plan_list_, iter->second);
+  return iter->second->second;
+}
+
+SchedulerPlanPtr SchedulerPlanCache::Put(const std::string &key,
+                                         SchedulerPlanPtr plan) {
+  std::lock_guard<std::mutex> locker(mutex_);
+  if (capacity_ == 0) {
+    return plan;
+  }
+  auto iter = plan_map_.find(key);
+  if (iter != plan_map_.end()) {
+    plan_list_.splice(plan_list_.begin(), plan_list_, iter->second);
+    return iter->second->second;
+  }
+  plan_list_.emplace_front(key, plan);
+  plan_map_.emplace(key, plan_list_.begin());
+  while (plan_list_.size() > capacity_) {
+    plan_map_.erase(plan_list_.back().first);
+    plan_list_.pop_back();
+  }
+  return plan;
+}
+
+void SchedulerPlanCache::SetCapacity(size_t capacity) {
+  std::lock_guard<std::mutex> locker(mutex_);
+  capacity_ = capacity;
+  while (plan_list_.size() > capacity_) {
+    plan_map_.erase(plan_list_.back().first);
+    plan_list_.pop_back();
+  }
+}
+
+size_t SchedulerPlanCache::Size() const {
+  std::lock_guard<std::mutex> locker(mutex_);
+  return plan_list_.size();
+}
+
+void SchedulerPlanCache::Clear() {
+  std::lock_guard<std::mutex> locker(mutex_);
+  plan_map_.clear();
+  plan_list_.clear();
+}
+
+SchedulerPlanPtr SchedulerPlanHandle::Load() const {
+  while (true) {
+    uint64_t version = version_.load();
+    const Slot &slot = slots_[version % kSlotNum];
+    slot.readers.fetch_add(1);
+    // slot is only read if the version is still current, the writer waits
+    // for readers before reusing a slot
+    if (version_.load() == version) {
+      SchedulerPlanPtr plan = slot.plan;
+      slot.readers.fetch_sub(1);
+      return plan;
+    }
+    slot.readers.fetch_sub(1);
+  }
+}
+
+uint64_t SchedulerPlanHandle::Publish(SchedulerPlanPtr plan) {
+  std::lock_guard<std::mutex> locker(publish_mutex_);
+  uint64_t version = version_.load();
+  Slot &next_slot = slots_[(version + 1) % kSlotNum];
+  while (next_slot.readers.load() != 0) {
+    std::this_thread::yield();
+  }
+  next_slot.plan = std::move(plan);
+  version_.store(version + 1);
+  // drop the slot reference to the old plan, requests keep their own
+  Slot &last_slot = slots_[version % kSlotNum];
+  while (last_slot.readers.load() != 0) {
+    std::this_thread::yield();
+  }
+  last_slot.plan.reset();
+  return version + 1;
+}
+
+int StartScheduler(const SchedulerPlanHandle &plan_handle,
+                   PhaseContextPtr context_ptr) {
+  SchedulerPlanPtr plan = plan_handle.Load();
+  context_ptr->scheduler_ptr = PhaseScheduler::Acquire(plan);
+  int ret = context_ptr->scheduler_ptr->Attach(std::move(plan));
+  if (ret != 0) {
+    DAGPF_LOG_ERROR << "attach plan failed." << std::endl;
+    return ret;
+  }
+  context_ptr->create_time_ms = Utils::getNowMs();
+  return context_ptr->scheduler_ptr->Start(context_ptr);
+}
+
+int StartSchedulerBatch(const PhaseScheduler &reused_scheduler,
+                        const std::vector<PhaseContextPtr> &context_ptrs,
+                        BatchRunResult *result) {
+  return reused_scheduler.StartBatch(context_ptrs, result);
+}
+
 int InitScheduler(
     const std::vector<std::string> &exprs,
     const std::unordered_map<std::string, std::string> &phase_class_map,
     PhaseScheduler &reused_scheduler) {
+  // identical config shares one compiled plan
+  auto plan_cache = SchedulerPlanCache::GetInstance();
+  const std::string plan_key =
+      reused_scheduler.GetPlanKey(exprs, phase_class_map);
+  auto cached_plan = plan_cache->Get(plan_key);
+  if (cached_plan) {
+    DAGPF_LOG_DEBUG << "plan cache hit." << std::endl;
+    return reused_scheduler.Attach(std::move(cached_plan)) == 0 ? 0 : -2;
+  }
   // parse links
   std::vector<std::pair<std::string, std::string>> links;
   std::vector<std::string> single_nodes;
@@ -619,6 +1879,12 @@ int InitScheduler(
     DAGPF_LOG_ERROR << "build DAG failed." << std::endl;
     return -2;
   }
+  // another thread may have built the same plan
+  auto plan = reused_scheduler.GetPlan();
+  auto shared_plan = plan_cache->Put(plan_key, plan);
+  if (shared_plan != plan) {
+    return reused_scheduler.Attach(std::move(shared_plan)) == 0 ? 0 : -2;
+  }
   return 0;
 }
 
@@ -9,8 +9,11 @@
 #ifndef PHASE_SCHEDULER_H_
 #define PHASE_SCHEDULER_H_
 
+#include <atomic>
+#include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <utility>
@@ -18,11 +21,14 @@
 
 #include "yapf/base/class_register.h"
 #include "yapf/base/dag_processing.h"
+#include "yapf/base/memo_cache.h"
 #include "yapf/base/phase.h"
 #include "yapf/base/phase_common.h"
 #include "yapf/base/phase_context.h"
+#include "yapf/base/plan_estimator.h"
 #include "yapf/base/scheduler_thread_pool.h"
 #include "yapf/base/timer_thread.h"
+#include "yapf/flow_control/safe_singleton.h"
 
 namespace yapf {
 
@@ -34,6 +40,7 @@ enum PhaseSchedulerRet {
   kPhaseSchedulerRetHasInvalidPhase,
   kPhaseSchedulerRetNoReadyPhase,
   kPhaseSchedulerRetCreatePhaseFailed,
+  kPhaseSchedulerRetPlanFileFailed,
 };
 
 struct SchedulerOption {
@@ -41,9 +48,172 @@ struct SchedulerOption {
   bool enable_thread_pool{true};
   bool enable_timer{true};
   bool enable_timeout{false};
+  // 每完成多少次请求按观测耗时刷新一次关键路径，0表示只使用静态耗时提示
+  uint32_t critical_path_refresh_interval{0};
+  // BuildDAG时去除传递冗余边，减少每次请求的入度原子操作
+  bool enable_transitive_reduction{false};
+  // 单入单出的链式节点在父节点所在worker上继续执行，不再重新提交线程池
+  bool enable_chain_fusion{true};
+  // 父节点完成时，最先派发的非链式就绪子节点同样在当前worker上继续执行
+  // 其余子节点提交线程池；每个线程池job最多连续继续执行的节点数，0表示不启用
+  uint32_t inline_continuation_depth{8};
+  // InitScheduler编译计划缓存容量，0表示不缓存
+  size_t plan_cache_capacity{256};
+  // 节点数不小于该值时，BuildDAG使用线程池并行校验节点及拓扑分层，0表示不启用
+  uint32_t parallel_build_threshold{0};
+  // 唯一父节点的子节点优先在父节点所在worker上执行，该worker繁忙时退回共享队列
+  bool enable_affinity{false};
+  // memo:true节点的跨请求结果缓存容量及默认TTL，容量为0表示不启用
+  // 节点可用memo_ttl_ms参数单独指定TTL
+  size_t memo_cache_capacity{10000};
+  int64_t memo_ttl_ms{60 * 1000};
+  // StartScheduler的请求级调度器按计划复用，每个计划缓存的空闲调度器上限
+  // 0表示不复用，每次请求新建；只影响之后编译的计划
+  size_t scheduler_pool_capacity{64};
   SchedulerThreadPoolOption pool_option;
 };
 
+// 节点耗时分布，按2^(1/4)倍数分桶(us)，相对误差约19%
+// 无锁计数，用于按hedge_percentile推导对冲延迟
+class LatencyHistogram {
+ public:
+  void Add(int64_t us);
+  // percentile取值(0, 100)，样本数不足min_samples时返回-1
+  int64_t GetPercentile(double percentile, uint64_t min_samples) const;
+
+ private:
+  static constexpr int kBucketNum = 128;
+  std::atomic<uint64_t> buckets_[kBucketNum]{};
+};
+
+// 对冲执行配置，均为0表示不对冲
+// 同时给出时，耗时样本充足前使用hedge_after_ms
+struct HedgePolicy {
+  int64_t after_ms{0};      // hedge_after_ms:N
+  double percentile{0.0};   // hedge_percentile:p95
+};
+
+// 调度器使用的内置参数，FinishPlan时解析一次，执行时不再按名称查找
+// 未配置的重试次数、间隔及延迟超时已填入默认值
+struct PhaseBuiltinParams {
+  bool flow_control{false};      // flow_control:true
+  bool flow_limit_delay{false};  // 命中流控时延迟提交
+  size_t flow_win_size{0};
+  size_t flow_limit{0};
+  int delay_timeout{0};          // 延迟提交超时(ms)
+  std::string flow_name;         // 流控器名称，即节点完整名称
+  bool redo{false};              // redo:true
+  int redo_retry_times{0};
+  int redo_retry_interval{0};    // 重试间隔(ms)
+  int64_t memo_ttl_ms{0};        // 0表示使用全局TTL
+};
+
+class PhaseScheduler;
+
+// 请求级调度器的空闲列表，按计划复用调度器对象及其运行时存储
+// 固定数量的槽位，取出为exchange、放入为CAS，无锁且没有ABA问题
+// 各线程从各自的起始槽位查找，倾向取回本线程最近归还的调度器
+// 列表中的调度器不持有计划，计划释放时一并销毁
+class SchedulerFreeList {
+ public:
+  SchedulerFreeList() = default;
+  SchedulerFreeList(const SchedulerFreeList &) = delete;
+  SchedulerFreeList &operator=(const SchedulerFreeList &) = delete;
+  ~SchedulerFreeList();
+  void Init(size_t capacity);
+  // 没有空闲调度器时返回nullptr
+  PhaseScheduler *Pop();
+  // 列表已满时返回false，由调用方销毁
+  bool Push(PhaseScheduler *scheduler);
+  // 近似值，并发放入取出时可能短暂偏小
+  size_t Size() const {
+    int64_t size = size_.load(std::memory_order_relaxed);
+    return size > 0 ? size : 0;
+  }
+
+ private:
+  std::unique_ptr<std::atomic<PhaseScheduler *>[]> slots_;
+  size_t capacity_{0};
+  std::atomic<int64_t> size_{0};
+};
+
+// 编译后的调度计划
+// BuildDAG时生成，构建完成后拓扑只读，所有请求通过指针共享
+// 关键路径相关数组为原子量，运行期可按观测耗时刷新，仅影响就绪节点的派发顺序
+struct SchedulerPlan {
+  DAGPlanPtr dag_plan;                             // 只读DAG拓扑
+  std::vector<PhaseParamDetail> phase_param_pool;  // 预解析的Phase参数
+  std::vector<PhaseBuiltinParams> builtin_params;  // 预解析的内置参数
+  std::string phase_namespace_name;
+  std::vector<uint32_t> topology_order;            // 拓扑序
+  std::vector<int64_t> cost_hint;                  // 静态耗时提示(us)
+  std::unique_ptr<std::atomic<int64_t>[]> cost_ewma;  // 观测耗时EWMA(us)
+  std::unique_ptr<std::atomic<int64_t>[]> critical_path;  // 最长剩余路径(us)
+  mutable std::atomic<uint64_t> finished_count{0};  // 已完成请求数
+  std::vector<bool> chained;  // 唯一父节点且为父节点唯一子节点，可链式执行
+  std::vector<std::shared_ptr<const SchedulerPlan>> sub_plans;  // 嵌套子图
+  // skip_children节点跳过时，被支配子图之外受影响节点及需扣减的入度
+  std::vector<std::vector<std::pair<uint32_t, int>>> skip_frontier;
+  std::vector<bool> map_nodes;  // map:true节点，按上下文决定并行实例数
+  std::vector<GenObjectFun<Phase> *> phase_generators;  // 预先查找的生成器
+  bool has_map_node{false};
+  std::vector<HedgePolicy> hedge_policies;  // 幂等慢节点的对冲配置
+  std::unique_ptr<LatencyHistogram[]> latency_histograms;  // 首个实例耗时
+  mutable std::atomic<uint64_t> hedged_count{0};     // 已启动的对冲实例数
+  mutable std::atomic<uint64_t> hedge_won_count{0};  // 对冲实例先完成次数
+  bool has_hedge_node{false};
+  std::vector<bool> memo_nodes;  // memo:true节点，按上下文key缓存结果
+  bool has_memo_node{false};
+  // join:any/join:k节点需成功完成的父节点数，0表示等待全部父节点
+  std::vector<int> join_quorum;
+  bool has_quorum_node{false};
+  // 非链式节点在完成父节点的worker上继续执行的次数
+  mutable std::atomic<uint64_t> inlined_count{0};
+  // 已完成请求归还的调度器，StartScheduler优先从中取用
+  mutable SchedulerFreeList scheduler_pool;
+
+  // 按观测耗时(无观测时使用静态提示)重新计算各节点最长剩余路径
+  void RefreshCriticalPath() const;
+};
+
+using SchedulerPlanPtr = std::shared_ptr<const SchedulerPlan>;
+
+// 单个节点的请求级状态，按cache line对齐
+// 完成回调访问的入度、返回值、耗时等在同一行内，相邻节点的原子量互不干扰
+struct alignas(64) NodeRuntime {
+  std::atomic<int> indegree{0};     // 请求级入度
+  std::atomic<int> map_pending{0};  // map未完成实例数
+  std::atomic<int> map_failed{0};   // map失败实例数
+  std::atomic<int> worker{-1};      // 执行该节点的线程池worker
+  std::atomic<int> join_pending{0};  // quorum节点未完成的父节点数
+  int64_t timecost{0};              // 耗时(us)
+  int ret{kPhaseProcessingRetOk};   // 返回值
+  PhasePtr phase;                   // Phase实例
+};
+
+// 请求级运行时存储，按计划大小一次分配:
+//   NodeRuntime[node_num] | uint32_t topology[node_num](调度结果)
+// 重新绑定同样大小的计划时原地重置，不重新分配，Phase实例保留由调度器决定复用
+class RequestRuntime {
+ public:
+  RequestRuntime() = default;
+  RequestRuntime(const RequestRuntime &) = delete;
+  RequestRuntime &operator=(const RequestRuntime &) = delete;
+  ~RequestRuntime();
+  void Allocate(size_t node_num);
+  void Release();
+  size_t Size() const { return node_num_; }
+  NodeRuntime &operator[](uint32_t id) { return nodes_[id]; }
+  const NodeRuntime &operator[](uint32_t id) const { return nodes_[id]; }
+  uint32_t *GetTopology() { return topology_; }
+
+ private:
+  void *block_{nullptr};
+  NodeRuntime *nodes_{nullptr};
+  uint32_t *topology_{nullptr};
+  size_t node_num_{0};
+};
+
 // timeout logic context
 struct NodeTimeoutContext {
   int DoTimeout();
@@ -51,7 +221,7 @@ struct NodeTimeoutContext {
 
   size_t run_id{};
   PhasePtr phase_ptr;
-  DAGNodePtr node;
+  const DAGPlanNode *node{nullptr};
   int timeout{};
   PhaseContextPtr ctx_ptr;
 };
@@ -61,16 +231,44 @@ struct NodeRedoContext : public std::enable_shared_from_this<NodeRedoContext> {
   explicit NodeRedoContext(int retry_times, int retry_interval)
       : max_retry_times(retry_times), retry_interval(retry_interval) {}
   int RedoCallback();
-  void Redo(PhasePtr, PhaseContextPtr, DAGNodePtr);
+  void Redo(PhasePtr, PhaseContextPtr, const DAGPlanNode *);
   void Redo2();
 
   size_t run_id{};
   PhasePtr phase_ptr;
   PhaseContextPtr ctx_ptr;
-  DAGNodePtr node;
+  const DAGPlanNode *node{nullptr};
   int max_retry_times{};
   int retry_interval{};
-  std::function<void(PhasePtr, PhaseContextPtr, DAGNodePtr)> redo_scheduler_fn;
+  std::function<void(PhasePtr, PhaseContextPtr, uint32_t)> redo_scheduler_fn;
+};
+
+class PhaseScheduler;
+
+// hedge logic context
+// 首个实例超过对冲延迟仍未完成时，在线程池中启动第二个实例
+// 先完成的实例生效，另一实例的结果丢弃
+struct NodeHedgeContext
+    : public std::enable_shared_from_this<NodeHedgeContext> {
+  int HedgeCallback();
+  void Hedge();
+  int Finish(int ret, bool is_primary);
+
+  size_t run_id{};
+  PhaseScheduler *scheduler{nullptr};
+  PhaseContextPtr ctx_ptr;
+  uint32_t node_id{};
+  int64_t start_us{};
+  PhasePtr hedge_phase_ptr;  // 对冲实例
+  std::atomic<bool> done{false};
+};
+
+// 批量执行的逐上下文结果
+struct BatchRunResult {
+  static constexpr int kRetNone = -1;  // 节点未调度(被跳过的子图)
+  // rets[i][node_id]为第i个上下文在该节点的返回值
+  std::vector<std::vector<int>> rets;
+  std::vector<int64_t> timecost;  // 各节点整批耗时(us)，未执行为0
 };
 
 class PhaseScheduler {
@@ -94,8 +292,34 @@ class PhaseScheduler {
       const std::vector<std::pair<std::string, std::string>> &edges,
       const std::vector<std::string> &single_nodes,
       const std::unordered_map<std::string, std::string> &node_alias_name_map);
+  // 计划缓存key，包含表达式、别名映射、命名空间及影响编译结果的配置
+  std::string GetPlanKey(
+      const std::vector<std::string> &exprs,
+      const std::unordered_map<std::string, std::string> &node_alias_name_map)
+      const;
   int CopyFrom(const PhaseScheduler &source);
+  // 保存已编译的调度计划，LoadPlan直接加载，跳过表达式解析及DAG构建校验
+  // 含子图节点的计划不支持保存
+  int SavePlan(const std::string &path) const;
+  int LoadPlan(const std::string &path);
+  // 注册已构建的调度器为子图，BuildDAG前调用
+  // 节点类名与子图名称相同时，整个子图作为一个节点执行，完成后通知外层节点
+  int RegisterSubPlan(const std::string &name, const PhaseScheduler &sub);
+  // 绑定已编译的调度计划，并分配请求级运行时存储
+  int Attach(SchedulerPlanPtr plan);
+  SchedulerPlanPtr GetPlan() const { return plan_; }
+  // 按观测耗时刷新关键路径，就绪节点按关键路径长度从大到小派发
+  void RefreshCriticalPath() const;
+  // 离线估计关键路径、最大宽度、平均并行度及线程数饱和点
+  // durations按节点名给出耗时(us)，未给出时使用观测耗时或cost_hint
+  int EstimatePlan(const std::unordered_map<std::string, int64_t> &durations,
+                   PlanEstimate &estimate) const;
   int Start(PhaseContextPtr context_ptr);
+  // 整批上下文在调用线程上按拓扑序同步执行，返回时整批完成
+  // 每个节点只创建一个Phase实例，对仍需执行的上下文调用一次DoBatchProcess
+  // 不做对冲、memo、重做、超时及流控，map节点按单实例执行
+  int StartBatch(const std::vector<PhaseContextPtr> &context_ptrs,
+                 BatchRunResult *result = nullptr) const;
   void SetPhaseNameSpace(const std::string &ns) {
     this->phase_namespace_name_ = ns;
   }
@@ -105,65 +329,179 @@ class PhaseScheduler {
   static int GlobalInit(const SchedulerOption &option);
   // 全局销毁
   static void GlobalDestroy();
+  // memo节点的结果缓存及命中统计
+  static MemoCache &GetMemoCache() { return s_memo_cache_; }
+  // 调度线程池，用于读取亲和提交等统计
+  static const SchedulerThreadPool &GetThreadPool() {
+    return s_cb_thread_pool_;
+  }
+  // 请求级调度器优先从计划的空闲列表中取得，之后仍需Attach该计划
+  // 请求上下文销毁时归还，此时对冲实例等迟到的回调均已结束
+  static PhaseScheduler *Acquire(const SchedulerPlanPtr &plan);
+  static void Release(PhaseScheduler *scheduler);
 
  private:
   PhaseScheduler(const PhaseScheduler &rhs);
   PhaseScheduler &operator=(const PhaseScheduler &rhs);
   int PreAllocateRes();
+  // 调用线程与线程池共同领取区间执行，在worker中调用也不会死锁
+  static void ParallelFor(size_t n,
+                          const std::function<void(size_t, size_t)> &fn);
   int PreAllocatePhases();
-  int ParsePhaseParam(DAGNodePtr node);
-  int PreAllocatePhase(DAGNodePtr node);
-  int ScheduleCB(PhaseContextPtr, const DAGNodePtr node,
-                 const FutureWrapper<int> &);
-  int ScheduleChildren(DAGNodePtr parent, PhaseContextPtr);
-  int Schedule(const std::vector<DAGNodePtr> &top_nodes, PhaseContextPtr);
-  int UpdateStatis(DAGNodePtr node, const FutureWrapper<int> &);
+  int CompilePlan(const DAG &dag);
+  // 由DAG计划及Phase参数生成派生数据(关键路径、链式节点等)并绑定
+  int FinishPlan(std::shared_ptr<SchedulerPlan> plan);
+  int PreAllocatePhase(uint32_t node_id);
+  Phase *NewPhase(uint32_t node_id) const {
+    auto generator = plan_->phase_generators[node_id];
+    return generator ? (*generator)() : nullptr;
+  }
+  bool IsSubPlanBoundary(uint32_t node_id) const {
+    return finish_fn_ && (node_id == plan_->dag_plan->GetStartNodeId() ||
+                          node_id == plan_->dag_plan->GetEndNodeId());
+  }
+  const DAGPlanNode &GetNode(uint32_t node_id) const {
+    return plan_->dag_plan->GetNode(node_id);
+  }
+  int ScheduleCB(PhaseContextPtr, uint32_t node_id, int last_phase_ret);
+  int ScheduleChildren(uint32_t parent_id, PhaseContextPtr);
+  int ScheduleSkipFrontier(uint32_t node_id, PhaseContextPtr);
+  // quorum节点的arrived个父节点完成，达到汇合条件时返回true(只返回一次)
+  bool JoinQuorum(uint32_t node_id, int arrived, bool is_ok);
+  int ScheduleMap(uint32_t node_id, size_t map_size, PhaseContextPtr);
+  // map实例完成时计数，全部完成返回true并输出汇总结果
+  bool JoinMap(uint32_t node_id, int instance_ret, int &map_ret);
+  // 命中缓存时直接完成节点返回true，未命中时记录key，完成后写入
+  bool LookupMemo(uint32_t node_id, PhaseContextPtr);
+  void StoreMemo(uint32_t node_id, PhaseContextPtr, int ret);
+  void SortByCriticalPath(std::vector<uint32_t> &node_ids) const;
+  // is_continuation: 由本请求节点完成触发(ScheduleChildren等)
+  // 只有此时就绪节点才可能在当前worker上继续执行，Start时总是提交线程池
+  int Schedule(const std::vector<uint32_t> &node_ids, PhaseContextPtr,
+               bool is_continuation);
+  int UpdateStatis(uint32_t node_id, int last_phase_ret);
   std::string GetPhaseRetDescription(uint32_t id);
   int ReportStatis(PhaseContextPtr);
 
-  void RunPhaseJob(PhasePtr, PhaseContextPtr, const PhaseParamDetail &,
-                   DAGNodePtr);
+  // 线程池job入口，执行完成后继续执行同一worker上链式就绪的节点
+  // job只携带节点id，参数从计划中按id取得
+  void RunPoolJob(PhasePtr, PhaseContextPtr, uint32_t node_id);
+
+  void RunPhaseJob(PhasePtr, PhaseContextPtr, uint32_t node_id);
 
-  void RunPhaseJobThin(PhasePtr, PhaseContextPtr,
-                       const PhaseParamDetail &detail, DAGNodePtr node);
+  void RunPhaseJobThin(PhasePtr, PhaseContextPtr, uint32_t node_id);
 
-  int ClearTimer(std::shared_ptr<NodeTimeoutContext> ctx,
-                 const FutureWrapper<int> &ret);
+  int ClearTimer(std::shared_ptr<NodeTimeoutContext> ctx, int ret);
 
   int ScheduleRedoCB(std::shared_ptr<NodeRedoContext> redoCtx,
-                     const FutureWrapper<int> &last_phase_ret);
+                     int last_phase_ret);
+
+  // 按对冲配置及首个实例的耗时分布计算对冲延迟(ms)，不对冲时返回0
+  int64_t GetHedgeDelayMs(uint32_t node_id) const;
+  std::shared_ptr<NodeHedgeContext> StartHedge(PhaseContextPtr,
+                                               uint32_t node_id);
+
+  // 批量执行计划，作为子图运行时起止节点直接通过
+  // ir_reasons输出各上下文的中断原因，0表示未中断
+  static void RunBatch(const SchedulerPlan &plan,
+                       const std::vector<PhaseContextPtr> &context_ptrs,
+                       bool is_sub_plan, BatchRunResult &result,
+                       std::vector<int> &ir_reasons);
+  static void RunBatchNode(const SchedulerPlan &plan, uint32_t node_id,
+                           const std::vector<PhaseContextPtr> &context_ptrs,
+                           std::vector<int> &rets);
 
   static void InitSchedulerThreadPool(const SchedulerOption &);
 
  private:
-  // TODO support clear
-  DAG dag_;                                          // 底层的Phase关系图
-  bool is_DAG_built_{false};                         //
-  bool has_started_{false};                          //
-  std::vector<DAGNodePtr> topology_array_;           // 保存调度结果
-  std::atomic<int> schedule_cursor_{0};              // 调度顺序
-  std::vector<FutureWrapper<int>> phase_ret_array_;  // 记录每个阶段的返回值
-  std::vector<int64_t> phase_timecost_array_;    // 记录每个阶段的耗时
+  SchedulerPlanPtr plan_;     // 共享的只读调度计划
+  bool is_DAG_built_{false};  //
+  bool has_started_{false};   //
+  RequestRuntime runtime_;                        // 请求级节点状态
+  std::atomic<int> schedule_cursor_{0};          // 调度顺序
   std::atomic<bool> is_sig_interrupted_{false};  // 中断标记
   std::atomic<int> ir_reason_{0};                // 中断原因
-  std::vector<PhasePtr> phase_pool_;             // Phase存储池
-  std::vector<PhaseParamDetail> phase_param_pool_;  // Phase静态参数池(可共享)
-  std::vector<PhaseParamDetail> *phase_param_pool_ptr_{
-      nullptr};                                // 共享指针，避免复制
   std::string phase_namespace_name_;
+  std::unordered_map<std::string, SchedulerPlanPtr> sub_plan_map_;  // 子图
+  std::function<void(int)> finish_fn_;  // 作为子图运行时，完成外层节点
+  std::vector<std::string> memo_keys_;  // 未命中的memo节点待写入的key
+  bool is_pooled_{false};  // 由Acquire取得，Release时归还空闲列表
+  const SchedulerPlan *phase_plan_{nullptr};  // runtime_中Phase实例所属计划
   inline static bool s_enable_statis_{false};  // 是否打印统计数据日志(全局开关)
   inline static bool s_verbose_{false};  // 是否输出详细信息
   inline static bool s_enable_thread_pool_{
       false};  // 是否使用线程池并发调度Phase
   inline static bool s_enable_timer_thread_{false};  // 是否使用超时队列
   inline static bool s_enable_timeout_check_{false};  // 是否启用Phase超时检查
+  inline static uint32_t s_critical_path_refresh_interval_{0};
+  inline static bool s_enable_transitive_reduction_{false};  // 是否约简冗余边
+  inline static bool s_enable_chain_fusion_{false};  // 是否链式执行
+  inline static uint32_t s_inline_continuation_depth_{0};
+  inline static uint32_t s_parallel_build_threshold_{0};
+  inline static bool s_enable_affinity_{false};  // 是否亲和调度
+  inline static uint32_t s_pool_thread_num_{0};
+  inline static size_t s_scheduler_pool_capacity_{0};
   inline static std::atomic<size_t> s_run_id_{0};
   // 调度线程池相关
   inline static bool s_is_global_inited_{false};
   inline static SchedulerThreadPool s_cb_thread_pool_;
   inline static TimerThread s_timer_thread_;
+  inline static MemoCache s_memo_cache_;
   friend class NodeTimeoutContext;
   friend class NodeRedoContext;
+  friend class NodeHedgeContext;
+  friend class SubPlanPhase;
+};
+
+// 进程级编译计划缓存，相同配置的InitScheduler共享同一份计划
+// LRU淘汰，容量由SchedulerOption::plan_cache_capacity指定
+class SchedulerPlanCache : public SafeSingleton<SchedulerPlanCache> {
+ public:
+  // 未命中返回nullptr
+  SchedulerPlanPtr Get(const std::string &key);
+  // 已存在时保留先放入的计划并返回，保证相同配置只有一份计划
+  SchedulerPlanPtr Put(const std::string &key, SchedulerPlanPtr plan);
+  void SetCapacity(size_t capacity);
+  size_t Size() const;
+  void Clear();
+
+ private:
+  using PlanList = std::list<std::pair<std::string, SchedulerPlanPtr>>;
+  mutable std::mutex mutex_;
+  size_t capacity_{256};
+  PlanList plan_list_;  // 按最近使用排序，头部最新
+  std::unordered_map<std::string, PlanList::iterator> plan_map_;
+};
+
+// 可热更新的版本化调度计划
+// 读取方无锁获取当前计划快照，写入方原子发布新版本
+// 旧计划由持有它的请求引用计数，最后一个请求结束时释放
+class SchedulerPlanHandle {
+ public:
+  SchedulerPlanHandle() = default;
+  SchedulerPlanHandle(const SchedulerPlanHandle &) = delete;
+  SchedulerPlanHandle &operator=(const SchedulerPlanHandle &) = delete;
+
+  // 获取当前计划，未发布时返回nullptr
+  SchedulerPlanPtr Load() const;
+  // 发布新计划，返回新版本号
+  uint64_t Publish(SchedulerPlanPtr plan);
+  uint64_t Publish(const PhaseScheduler &scheduler) {
+    return Publish(scheduler.GetPlan());
+  }
+  uint64_t GetVersion() const {
+    return version_.load(std::memory_order_acquire);
+  }
+
+ private:
+  struct Slot {
+    mutable std::atomic<int> readers{0};
+    SchedulerPlanPtr plan;
+  };
+  static constexpr size_t kSlotNum = 2;
+  Slot slots_[kSlotNum];
+  std::atomic<uint64_t> version_{0};  // 当前版本，所在slot为version % kSlotNum
+  std::mutex publish_mutex_;          // 写入方互斥
 };
 
 ///
@@ -174,6 +512,16 @@ class PhaseScheduler {
 int StartScheduler(const PhaseScheduler &reused_scheduler,
                    PhaseContextPtr context_ptr);
 
+// 使用计划句柄的当前版本启动，热更新期间无锁
+int StartScheduler(const SchedulerPlanHandle &plan_handle,
+                   PhaseContextPtr context_ptr);
+
+// 同一计划批量执行一组上下文，每个Phase对整批只执行一次
+// 逐上下文的中断标记写回上下文，result非空时输出各节点返回值及耗时
+int StartSchedulerBatch(const PhaseScheduler &reused_scheduler,
+                        const std::vector<PhaseContextPtr> &context_ptrs,
+                        BatchRunResult *result = nullptr);
+
 // 预分配并初始化一个scheduler，后续可以重用减少开销
 int InitScheduler(
     const std::vector<std::string> &exprs,
@@ -0,0 +1,171 @@
+// File Name: phase_scheduler_affinity_test.cc
+// Description: 开启亲和调度(enable_affinity)时的调度测试
+//
+// GlobalInit每个进程只生效一次，亲和调度使用单独的测试程序，
+// phase_scheduler_test覆盖默认配置
+
+#include "yapf/base/phase_scheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace yapf {
+
+struct AffinityContext : public yapf::PhaseContext {
+  std::mutex local_mutex;
+  std::vector<std::string> executed_phases;
+  std::map<std::string, std::thread::id> threads;  // 各Phase的执行线程
+  std::vector<int64_t> start_us;  // SleepPhase开始时间
+  std::vector<int64_t> end_us;    // SleepPhase结束时间
+  std::promise<int> promise_val;
+};
+
+class StartPhase : public yapf::Phase {
+ protected:
+  int DoProcess(yapf::PhaseContextPtr context_ptr,
+                const yapf::PhaseParamDetail &detail) override {
+    auto biz_ctx = ToBizCtxPtr<AffinityContext>(context_ptr);
+    std::unique_lock<std::mutex> locker(biz_ctx->local_mutex);
+    biz_ctx->threads[this->GetName()] = std::this_thread::get_id();
+    return NotifyDone(0);
+  }
+};
+
+REGISTER_CLASS(yapf, Phase, yapf, StartPhase);
+
+class EndPhase : public yapf::Phase {
+ protected:
+  int DoProcess(yapf::PhaseContextPtr context_ptr,
+                const yapf::PhaseParamDetail &detail) override {
+    ToBizCtxPtr<AffinityContext>(context_ptr)->promise_val.set_value(0);
+    return NotifyDone(0);
+  }
+};
+
+REGISTER_CLASS(yapf, Phase, yapf, EndPhase);
+
+class RecordPhase : public yapf::Phase {
+ protected:
+  int DoProcess(yapf::PhaseContextPtr context_ptr,
+                const yapf::PhaseParamDetail &detail) override {
+    auto biz_ctx = ToBizCtxPtr<AffinityContext>(context_ptr);
+    std::unique_lock<std::mutex> locker(biz_ctx->local_mutex);
+    biz_ctx->executed_phases.emplace_back(this->GetName());
+    biz_ctx->threads[this->GetName()] = std::this_thread::get_id();
+    return NotifyDone(0);
+  }
+};
+
+REGISTER_CLASS(yapf, Phase, yapf, RecordPhase);
+
+// 休眠sleep_ms毫秒，记录起止时间
+class SleepPhase : public yapf::Phase {
+ protected:
+  int DoProcess(yapf::PhaseContextPtr context_ptr,
+                const yapf::PhaseParamDetail &detail) override {
+    auto biz_ctx = ToBizCtxPtr<AffinityContext>(context_ptr);
+    int64_t start_us = Utils::getNowUs();
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(detail.config_key.params["sleep_ms"].iv));
+    std::unique_lock<std::mutex> locker(biz_ctx->local_mutex);
+    biz_ctx->start_us.push_back(start_us);
+    biz_ctx->end_us.push_back(Utils::getNowUs());
+    biz_ctx->threads[this->GetName()] = std::this_thread::get_id();
+    return NotifyDone(0);
+  }
+};
+
+REGISTER_CLASS(yapf, Phase, yapf, SleepPhase);
+
+class PhaseSchedulerAffinityTest : public ::testing::Test {
+ public:
+  void SetUp() override {
+    SchedulerOption scheduler_option;
+    scheduler_option.enable_thread_pool = true;
+    scheduler_option.pool_option.scheduler_name = "default";
+    scheduler_option.pool_option.thread_num = 4;
+    scheduler_option.enable_affinity = true;
+    // nodes scheduled by a continuation go through the affinity path,
+    // only the first child of a pool job continues inline
+    scheduler_option.enable_chain_fusion = false;
+    scheduler_option.inline_continuation_depth = 1;
+    // long enough for a parent job to return under a loaded test machine
+    scheduler_option.pool_option.steal_delay_us = 20000;
+    PhaseScheduler::GlobalInit(scheduler_option);
+  }
+};
+
+TEST_F(PhaseSchedulerAffinityTest, Diamond) {
+  // a continues inline after StartPhase, its children go through the
+  // affinity path: b waits on a's worker, c goes to the shared queue;
+  // d continues inline after the later one of b and c, e waits on d's worker
+  const auto &pool = PhaseScheduler::GetThreadPool();
+  const uint64_t placed_count = pool.GetLocalPlacedCount();
+  const uint64_t stolen_count = pool.GetStolenCount();
+  PhaseScheduler scheduler;
+  scheduler.SetPhaseNameSpace("yapf");
+  EXPECT_EQ(0, InitScheduler({"a->b", "a->c", "b->d", "c->d", "d->e"},
+                             {{"a", "RecordPhase"},
+                              {"b", "RecordPhase"},
+                              {"c", "RecordPhase"},
+                              {"d", "RecordPhase"},
+                              {"e", "RecordPhase"}},
+                             scheduler));
+  for (int i = 0; i < 20; ++i) {
+    auto context = std::make_shared<AffinityContext>();
+    std::future<int> f = context->promise_val.get_future();
+    EXPECT_EQ(0, StartScheduler(scheduler, context));
+    EXPECT_EQ(0, f.get());
+    std::unique_lock<std::mutex> locker(context->local_mutex);
+    EXPECT_EQ(5u, context->executed_phases.size());
+    EXPECT_EQ(context->threads["a"], context->threads["b"]);
+    EXPECT_EQ(context->threads["d"], context->threads["e"]);
+  }
+  EXPECT_EQ(placed_count + 40, pool.GetLocalPlacedCount());
+  EXPECT_EQ(stolen_count, pool.GetStolenCount());
+}
+
+TEST_F(PhaseSchedulerAffinityTest, Siblings) {
+  // one child continues on StartPhase's worker, the sibling is not queued
+  // behind it but runs on an idle worker at the same time
+  static constexpr int64_t kSleepMs = 50;
+  const auto &pool = PhaseScheduler::GetThreadPool();
+  const uint64_t placed_count = pool.GetLocalPlacedCount();
+  PhaseScheduler scheduler;
+  scheduler.SetPhaseNameSpace("yapf");
+  EXPECT_EQ(0, InitScheduler({"b", "c"},
+                             {{"b", "SleepPhase(sleep_ms:50)"},
+                              {"c", "SleepPhase(sleep_ms:50)"}},
+                             scheduler));
+  static constexpr int kRunNum = 5;
+  int64_t total_span_us = 0;
+  for (int i = 0; i < kRunNum; ++i) {
+    auto context = std::make_shared<AffinityContext>();
+    std::future<int> f = context->promise_val.get_future();
+    EXPECT_EQ(0, StartScheduler(scheduler, context));
+    EXPECT_EQ(0, f.get());
+    std::unique_lock<std::mutex> locker(context->local_mutex);
+    ASSERT_EQ(2u, context->start_us.size());
+    const auto start_thread = context->threads["StartPhase"];
+    EXPECT_NE(context->threads["b"], context->threads["c"]);
+    EXPECT_TRUE(context->threads["b"] == start_thread ||
+                context->threads["c"] == start_thread);
+    total_span_us +=
+        *std::max_element(context->end_us.begin(), context->end_us.end()) -
+        *std::min_element(context->start_us.begin(), context->start_us.end());
+  }
+  // serialized siblings would take twice as long
+  EXPECT_LT(total_span_us / kRunNum, kSleepMs * 1000 * 14 / 10);
+  // the sibling of a continuation is never placed on a local queue
+  EXPECT_EQ(placed_count, pool.GetLocalPlacedCount());
+}
+
+}  // namespace yapf
@@ -6,14 +6,53 @@
 
 #include "yapf/base/phase_scheduler.h"
 
+#include <unistd.h>
+
+#include <algorithm>
 #include <chrono>
+#include <cstdlib>
 #include <future>
 #include <iostream>
 #include <mutex>
+#include <new>
+#include <set>
 #include <thread>
 
 #include "gtest/gtest.h"
 
+namespace {
+// 当前线程的堆分配次数
+thread_local size_t t_alloc_count = 0;
+}  // namespace
+
+// 替换非对齐的new/delete全家，统计当前线程的分配次数
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  ++t_alloc_count;
+  return std::malloc(size == 0 ? 1 : size);
+}
+void *operator new(size_t size) {
+  void *ptr = operator new(size, std::nothrow);
+  if (ptr == nullptr) throw std::bad_alloc();
+  return ptr;
+}
+void *operator new[](size_t size) { return operator new(size); }
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+  return operator new(size, std::nothrow);
+}
+// 不内联，避免编译器把内联后的free与new误判为不匹配
+__attribute__((noinline)) void operator delete(void *ptr) noexcept {
+  std::free(ptr);
+}
+void operator delete(void *ptr, size_t) noexcept { operator delete(ptr); }
+void operator delete(void *ptr, const std::nothrow_t &) noexcept {
+  operator delete(ptr);
+}
+void operator delete[](void *ptr) noexcept { operator delete(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { operator delete(ptr); }
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept {
+  operator delete(ptr);
+}
+
 namespace yapf {
 
 struct TestContext : public yapf::PhaseContext {
@@ -28,8 +67,37 @@ struct TestContext : public yapf::PhaseContext {
   std::vector<std::string> executed_phases;
   std::mutex local_mutex;
   std::string redo_phase;
+  std::set<std::thread::id> thread_ids;
+  size_t map_size{1};
+  std::atomic<int> slow_phase_runs{0};
+  size_t GetMapSize(const std::string &phase_name) const override {
+    return map_size;
+  }
   int ret{-1};
   std::promise<int> promise_val;
+  // nested phase input and output
+  const PhaseScheduler *inner_scheduler{nullptr};
+  int inner_ret{-1};
+  // batch phase input and output
+  bool interrupt{false};
+  size_t batch_size{0};
+  // block phase input and output
+  std::shared_future<void> unblock;
+  std::atomic<int> *blocked{nullptr};
+  // memo phase input and output
+  int memo_input{0};
+  int memo_output{0};
+  std::string GetMemoKey(const std::string &phase_name) const override {
+    return std::to_string(memo_input);
+  }
+  std::shared_ptr<const void> ExportMemo(
+      const std::string &phase_name) const override {
+    return std::make_shared<const int>(memo_output);
+  }
+  void ImportMemo(const std::string &phase_name,
+                  const std::shared_ptr<const void> &data) override {
+    memo_output = *std::static_pointer_cast<const int>(data);
+  }
 };
 
 class StartPhase : public yapf::Phase {
@@ -163,6 +231,10 @@ class EPhase : public yapf::Phase {
     }
     return NotifyDone(0);
   }
+  bool Recycle() override {
+    redo_flag_ = false;
+    return true;
+  }
 
  private:
   bool redo_flag_{false};
@@ -170,6 +242,192 @@ class EPhase : public yapf::Phase {
 
 REGISTER_CLASS(yapf, Phase, yapf, EPhase);
 
+class ThreadPhase : public yapf::Phase {
+ public:
+  ThreadPhase() {}
+
+ protected:
+  int DoProcess(yapf::PhaseContextPtr context_ptr,
+                const yapf::PhaseParamDetail &detail) override {
+    auto biz_ctx = ToBizCtxPtr<TestContext>(context_ptr);
+    {
+      std::unique_lock<std::mutex> locker(biz_ctx->local_mutex);
+      biz_ctx->executed_phases.emplace_back(this->GetName());
+      biz_ctx->thread_ids.insert(std::this_thread::get_id());
+    }
+    return NotifyDone(0);
+  }
+};
+
+REGISTER_CLASS(yapf, Phase, yapf, ThreadPhase);
+
+// 在DoProcess中同步启动另一个请求并等待其完成
+class NestedPhase : public yapf::Phase {
+ public:
+  NestedPhase() {}
+
+ protected:
+  int DoProcess(yapf::PhaseContextPtr context_ptr,
+                const yapf::PhaseParamDetail &detail) override {
+    auto biz_ctx = ToBizCtxPtr<TestContext>(context_ptr);
+    auto inner_context = std::make_shared<TestContext>();
+    std::future<int> f = inner_context->promise_val.get_future();
+    if (StartScheduler(*biz_ctx->inner_scheduler, inner_context) != 0 ||
+        f.wait_for(std::chrono::seconds(2)) != std::future_status::ready) {
+      return NotifySkip();
+    }
+    biz_ctx->inner_ret = f.get();
+    return NotifyDone(0);
+  }
+};
+
+REGISTER_CLASS(yapf, Phase, yapf, NestedPhase);
+
+// 占住所在worker直到unblock就绪
+class BlockPhase : public yapf::Phase {
+ public:
+  BlockPhase() {}
+
+ protected:
+  int DoProcess(yapf::PhaseContextPtr context_ptr,
+                const yapf::PhaseParamDetail &detail) override {
+    auto biz_ctx = ToBizCtxPtr<TestContext>(context_ptr);
+    biz_ctx->blocked->fetch_add(1);
+    biz_ctx->unblock.wait();
+    return NotifyDone(0);
+  }
+};
+
+REGISTER_CLASS(yapf, Phase, yapf, BlockPhase);
+
+class MapPhase : public yapf::Phase {
+ public:
+  MapPhase() {}
+
+ protected:
+  int DoProcess(yapf::PhaseContextPtr context_ptr,
+                const yapf::PhaseParamDetail &detail) override {
+    auto biz_ctx = ToBizCtxPtr<TestContext>(context_ptr);
+    {
+      std::unique_lock<std::mutex> locker(biz_ctx->local_mutex);
+      biz_ctx->executed_phases.emplace_back(
+          this->GetName() + std::to_string(GetMapIndex()));
+    }
+    // the last instance fails
+    return NotifyDone(GetMapIndex() + 1 == GetMapSize() ? -1 : 0);
+  }
+};
+
+REGISTER_CLASS(yapf, Phase, yapf, MapPhase);
+
+class SlowPhase : public yapf::Phase {
+ public:
+  SlowPhase() {}
+
+ protected:
+  int DoProcess(yapf::PhaseContextPtr context_ptr,
+                const yapf::PhaseParamDetail &detail) override {
+    auto biz_ctx = ToBizCtxPtr<TestContext>(context_ptr);
+    // the first instance of each request is slow
+    if (biz_ctx->slow_phase_runs.fetch_add(1) == 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(300));
+      return NotifyDone(-1);
+    }
+    {
+      std::unique_lock<std::mutex> locker(biz_ctx->local_mutex);
+      biz_ctx->executed_phases.emplace_back(this->GetName());
+    }
+    return NotifyDone(0);
+  }
+};
+
+REGISTER_CLASS(yapf, Phase, yapf, SlowPhase);
+
+class MemoPhase : public yapf::Phase {
+ public:
+  MemoPhase() {}
+
+ protected:
+  int DoProcess(yapf::PhaseContextPtr context_ptr,
+                const yapf::PhaseParamDetail &detail) override {
+    auto biz_ctx = ToBizCtxPtr<TestContext>(context_ptr);
+    {
+      std::unique_lock<std::mutex> locker(biz_ctx->local_mutex);
+      biz_ctx->executed_phases.emplace_back(this->GetName());
+    }
+    biz_ctx->memo_output = biz_ctx->memo_input * 2;
+    return NotifyDone(0);
+  }
+};
+
+REGISTER_CLASS(yapf, Phase, yapf, MemoPhase);
+
+class DelayPhase : public yapf::Phase {
+ public:
+  DelayPhase() {}
+
+ protected:
+  int DoProcess(yapf::PhaseContextPtr context_ptr,
+                const yapf::PhaseParamDetail &detail) override {
+    auto biz_ctx = ToBizCtxPtr<TestContext>(context_ptr);
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(detail.config_key.params["delay_ms"].iv));
+    {
+      std::unique_lock<std::mutex> locker(biz_ctx->local_mutex);
+      biz_ctx->executed_phases.emplace_back(this->GetName());
+    }
+    return NotifyDone(0);
+  }
+};
+
+REGISTER_CLASS(yapf, Phase, yapf, DelayPhase);
+
+class BatchPhase : public yapf::Phase {
+ public:
+  BatchPhase() {}
+
+ protected:
+  int DoProcess(yapf::PhaseContextPtr context_ptr,
+                const yapf::PhaseParamDetail &detail) override {
+    return NotifyDone(-1);
+  }
+  int DoBatchProcess(const std::vector<yapf::PhaseContextPtr> &context_ptrs,
+                     const yapf::PhaseParamDetail &detail,
+                     std::vector<int> &rets) override {
+    for (size_t i = 0; i < context_ptrs.size(); ++i) {
+      auto biz_ctx = ToBizCtxPtr<TestContext>(context_ptrs[i]);
+      biz_ctx->executed_phases.emplace_back(this->GetName());
+      biz_ctx->batch_size = context_ptrs.size();
+      rets[i] = biz_ctx->interrupt ? kPhaseProcessingRetInterrupt : 0;
+    }
+    return 0;
+  }
+};
+
+REGISTER_CLASS(yapf, Phase, yapf, BatchPhase);
+
+class CountPhase : public yapf::Phase {
+ public:
+  CountPhase() { s_created.fetch_add(1, std::memory_order_relaxed); }
+  inline static std::atomic<int> s_created{0};
+
+ protected:
+  int DoProcess(yapf::PhaseContextPtr context_ptr,
+                const yapf::PhaseParamDetail &detail) override {
+    return NotifyDone(0);
+  }
+};
+
+REGISTER_CLASS(yapf, Phase, yapf, CountPhase);
+
+// holds state that can not be reset, a new instance for every request
+class OneShotPhase : public CountPhase {
+ protected:
+  bool Recycle() override { return false; }
+};
+
+REGISTER_CLASS(yapf, Phase, yapf, OneShotPhase);
+
 class PhaseSchedulerTest : public ::testing::Test {
  public:
   void SetUp() override {
@@ -180,6 +438,7 @@ class PhaseSchedulerTest : public ::testing::Test {
     scheduler_option.pool_option.scheduler_name = "default";
     scheduler_option.pool_option.thread_num = 2;
     scheduler_option.pool_option.max_queue_size = 100;
+    scheduler_option.parallel_build_threshold = 2048;
     PhaseScheduler::GlobalInit(scheduler_option);
     // create a reused scheduler
     reused_scheduler.SetPhaseNameSpace("yapf");
@@ -212,5 +471,845 @@ TEST_F(PhaseSchedulerTest, StartScheduler) {
   EXPECT_EQ(std::string("e"), test_context->redo_phase);
 }
 
-}  // namespace yapf
+TEST_F(PhaseSchedulerTest, SharedPlan) {
+  // requests only own their runtime state, the compiled plan is shared
+  std::vector<std::shared_ptr<TestContext>> contexts;
+  for (int i = 0; i < 4; ++i) {
+    auto test_context = std::make_shared<TestContext>();
+    contexts.push_back(test_context);
+  }
+  std::vector<std::future<int>> futures;
+  for (auto &test_context : contexts) {
+    futures.emplace_back(test_context->promise_val.get_future());
+    EXPECT_EQ(0, StartScheduler(reused_scheduler, test_context));
+    EXPECT_EQ(test_context->scheduler_ptr->GetPlan(),
+              reused_scheduler.GetPlan());
+  }
+  for (size_t i = 0; i < contexts.size(); ++i) {
+    EXPECT_EQ(0, futures[i].get());
+    EXPECT_EQ(7u, contexts[i]->executed_phases.size());
+  }
+}
 
+TEST_F(PhaseSchedulerTest, SchedulerPool) {
+  // a plan of its own, the free list starts empty
+  SchedulerPlanCache::GetInstance()->Clear();
+  PhaseScheduler scheduler;
+  scheduler.SetPhaseNameSpace("yapf");
+  EXPECT_EQ(0, InitScheduler(
+                   {"a->b", "a->c"},
+                   {{"a", "APhase"}, {"b", "BPhase"}, {"c", "CPhase"}},
+                   scheduler));
+  auto plan = scheduler.GetPlan();
+  ASSERT_TRUE(plan != nullptr);
+  EXPECT_EQ(0u, plan->scheduler_pool.Size());
+  const PhaseScheduler *last_scheduler = nullptr;
+  for (int i = 0; i < 4; ++i) {
+    auto test_context = std::make_shared<TestContext>();
+    std::future<int> f = test_context->promise_val.get_future();
+    EXPECT_EQ(0, StartScheduler(scheduler, test_context));
+    EXPECT_EQ(0, f.get());
+    EXPECT_EQ(5u, test_context->executed_phases.size());
+    // released with the context, reused by the next request
+    if (last_scheduler != nullptr) {
+      EXPECT_EQ(last_scheduler, test_context->scheduler_ptr);
+    }
+    last_scheduler = test_context->scheduler_ptr;
+    EXPECT_EQ(0u, plan->scheduler_pool.Size());
+    // pool jobs may hold the context for a moment after the end phase
+    std::weak_ptr<TestContext> weak_context = test_context;
+    test_context.reset();
+    while (!weak_context.expired()) {
+      std::this_thread::yield();
+    }
+    EXPECT_EQ(1u, plan->scheduler_pool.Size());
+  }
+  // pooled schedulers do not keep the plan alive
+  std::weak_ptr<const SchedulerPlan> weak_plan = plan;
+  plan.reset();
+  scheduler.Clear();
+  SchedulerPlanCache::GetInstance()->Clear();
+  EXPECT_TRUE(weak_plan.expired());
+}
+
+TEST_F(PhaseSchedulerTest, ReusePhase) {
+  SchedulerPlanCache::GetInstance()->Clear();
+  PhaseScheduler sub_scheduler;
+  sub_scheduler.SetPhaseNameSpace("yapf");
+  EXPECT_EQ(0, InitScheduler({"x->y"},
+                             {{"x", "CountPhase"}, {"y", "CountPhase"}},
+                             sub_scheduler));
+  PhaseScheduler scheduler;
+  scheduler.SetPhaseNameSpace("yapf");
+  EXPECT_EQ(0, scheduler.RegisterSubPlan("SubPlan", sub_scheduler));
+  EXPECT_EQ(0, InitScheduler({"a->b", "a->c", "b->s", "c->s", "s->d", "e"},
+                             {{"a", "CountPhase"},
+                              {"b", "CountPhase"},
+                              {"c", "CountPhase"},
+                              {"s", "SubPlan"},
+                              {"d", "CountPhase"},
+                              {"e", "OneShotPhase"}},
+                             scheduler));
+  const size_t node_num = scheduler.GetPlan()->dag_plan->Size();
+  for (int i = 0; i < 4; ++i) {
+    auto test_context = std::make_shared<TestContext>();
+    std::future<int> f = test_context->promise_val.get_future();
+    const int created = CountPhase::s_created.load();
+    const size_t allocs = t_alloc_count;
+    EXPECT_EQ(0, StartScheduler(scheduler, test_context));
+    const size_t start_allocs = t_alloc_count - allocs;
+    EXPECT_EQ(0, f.get());
+    std::weak_ptr<TestContext> weak_context = test_context;
+    test_context.reset();
+    while (!weak_context.expired()) {
+      std::this_thread::yield();
+    }
+    if (i == 0) {
+      // a, b, c, d, e and x, y of the sub plan
+      EXPECT_EQ(7, CountPhase::s_created.load() - created);
+      EXPECT_GE(start_allocs, node_num);
+      continue;
+    }
+    // warm pool: only the opt-out phase is created again, what is left is
+    // per request work independent of the node count
+    EXPECT_EQ(1, CountPhase::s_created.load() - created);
+    EXPECT_LT(start_allocs, node_num);
+  }
+}
+
+TEST_F(PhaseSchedulerTest, CriticalPath) {
+  PhaseScheduler scheduler;
+  scheduler.SetPhaseNameSpace("yapf");
+  const std::vector<std::string> exprs{"a->b", "b->c", "a->d", "a->e"};
+  const std::unordered_map<std::string, std::string> alias_map{
+      {"a", "APhase"},
+      {"b", "BPhase(cost_hint:10)"},
+      {"c", "CPhase(cost_hint:20)"},
+      {"d", "DPhase(cost_hint:50)"},
+      {"e", "APhase"}};
+  EXPECT_EQ(0, InitScheduler(exprs, alias_map, scheduler));
+  auto plan = scheduler.GetPlan();
+  ASSERT_TRUE(plan != nullptr);
+  std::unordered_map<std::string, uint32_t> ids;
+  for (uint32_t id = 0; id < plan->dag_plan->Size(); ++id) {
+    ids[std::string(plan->dag_plan->GetNode(id).name)] = id;
+  }
+  auto critical_path = [&](const std::string &name) {
+    return plan->critical_path[ids[name]].load();
+  };
+  // b->c chains two phases, but d alone is the longest path
+  EXPECT_EQ(20000 + 1, critical_path("c"));
+  EXPECT_EQ(30000 + 1, critical_path("b"));
+  EXPECT_EQ(50000 + 1, critical_path("d"));
+  EXPECT_EQ(1 + 1, critical_path("e"));
+  EXPECT_EQ(1 + 50000 + 1, critical_path("a"));
+  EXPECT_EQ(critical_path("a") + 1, critical_path("StartPhase"));
+  // observed durations take precedence over hints once refreshed
+  plan->cost_ewma[ids["b"]].store(100000);
+  scheduler.RefreshCriticalPath();
+  EXPECT_EQ(1 + 100000 + 20000 + 1, critical_path("a"));
+}
+
+TEST_F(PhaseSchedulerTest, CriticalPathDispatch) {
+  // block all workers but one, ready nodes then run in dispatch order
+  PhaseScheduler block_scheduler;
+  block_scheduler.SetPhaseNameSpace("yapf");
+  EXPECT_EQ(0, InitScheduler({"x"}, {{"x", "BlockPhase"}}, block_scheduler));
+  std::promise<void> unblock;
+  std::shared_future<void> unblock_future = unblock.get_future().share();
+  std::atomic<int> blocked{0};
+  std::vector<std::shared_ptr<TestContext>> block_contexts;
+  std::vector<std::future<int>> block_futures;
+  for (int i = 0; i < 3; ++i) {
+    auto block_context = std::make_shared<TestContext>();
+    block_context->unblock = unblock_future;
+    block_context->blocked = &blocked;
+    block_futures.emplace_back(block_context->promise_val.get_future());
+    EXPECT_EQ(0, StartScheduler(block_scheduler, block_context));
+    block_contexts.emplace_back(std::move(block_context));
+  }
+  for (int i = 0; i < 200 && blocked.load() < 3; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  ASSERT_EQ(3, blocked.load());
+
+  PhaseScheduler scheduler;
+  scheduler.SetPhaseNameSpace("yapf");
+  const std::vector<std::string> exprs{"b", "d", "e"};
+  const std::unordered_map<std::string, std::string> alias_map{
+      {"b", "BPhase(cost_hint:10)"},
+      {"d", "DPhase(cost_hint:50)"},
+      {"e", "APhase"}};
+  EXPECT_EQ(0, InitScheduler(exprs, alias_map, scheduler));
+  auto test_context = new TestContext();
+  PhaseContextPtr ctx_ptr{test_context};
+  std::future<int> f = test_context->promise_val.get_future();
+  EXPECT_EQ(0, StartScheduler(scheduler, ctx_ptr));
+  EXPECT_EQ(std::future_status::ready,
+            f.wait_for(std::chrono::seconds(2)));
+  const std::vector<std::string> expected{"StartPhase", "d", "b", "e",
+                                          "EndPhase"};
+  EXPECT_EQ(expected, test_context->executed_phases);
+
+  unblock.set_value();
+  for (auto &block_future : block_futures) {
+    EXPECT_EQ(std::future_status::ready,
+              block_future.wait_for(std::chrono::seconds(2)));
+  }
+}
+
+TEST_F(PhaseSchedulerTest, BuiltinParams) {
+  PhaseScheduler scheduler;
+  scheduler.SetPhaseNameSpace("yapf");
+  const std::vector<std::string> exprs{"a->b"};
+  const std::unordered_map<std::string, std::string> alias_map{
+      {"a", "APhase(flow_control:true,flow_win_size:5,flow_limit:50)"},
+      {"b", "BPhase(redo:true,redo_retry_times:2,memo_ttl_ms:300)"}};
+  EXPECT_EQ(0, InitScheduler(exprs, alias_map, scheduler));
+  auto plan = scheduler.GetPlan();
+  ASSERT_TRUE(plan != nullptr);
+  std::unordered_map<std::string, uint32_t> ids;
+  for (uint32_t id = 0; id < plan->dag_plan->Size(); ++id) {
+    ids[std::string(plan->dag_plan->GetNode(id).name)] = id;
+  }
+  ASSERT_EQ(plan->dag_plan->Size(), plan->builtin_params.size());
+  // 未配置的参数使用默认值
+  const auto &a = plan->builtin_params[ids["a"]];
+  EXPECT_TRUE(a.flow_control);
+  EXPECT_FALSE(a.flow_limit_delay);
+  EXPECT_EQ(5u, a.flow_win_size);
+  EXPECT_EQ(50u, a.flow_limit);
+  EXPECT_EQ(5000, a.delay_timeout);
+  EXPECT_EQ(std::string(plan->dag_plan->GetNode(ids["a"]).full_name),
+            a.flow_name);
+  EXPECT_FALSE(a.redo);
+  const auto &b = plan->builtin_params[ids["b"]];
+  EXPECT_FALSE(b.flow_control);
+  EXPECT_TRUE(b.redo);
+  EXPECT_EQ(2, b.redo_retry_times);
+  EXPECT_EQ(1000, b.redo_retry_interval);
+  EXPECT_EQ(300, b.memo_ttl_ms);
+  // 按节点id取参数执行
+  auto test_context = new TestContext();
+  PhaseContextPtr ctx_ptr{test_context};
+  std::future<int> f = test_context->promise_val.get_future();
+  EXPECT_EQ(0, StartScheduler(scheduler, ctx_ptr));
+  f.get();
+  EXPECT_EQ(0, test_context->ret);
+}
+
+TEST_F(PhaseSchedulerTest, ChainFusion) {
+  PhaseScheduler scheduler;
+  scheduler.SetPhaseNameSpace("yapf");
+  const std::vector<std::string> exprs{"a->b", "b->c", "c->d"};
+  const std::unordered_map<std::string, std::string> alias_map{
+      {"a", "ThreadPhase"},
+      {"b", "ThreadPhase"},
+      {"c", "ThreadPhase"},
+      {"d", "ThreadPhase"}};
+  EXPECT_EQ(0, InitScheduler(exprs, alias_map, scheduler));
+  auto plan = scheduler.GetPlan();
+  for (uint32_t id = 0; id < plan->dag_plan->Size(); ++id) {
+    EXPECT_EQ(id != plan->dag_plan->GetStartNodeId(), plan->chained[id]);
+  }
+  for (int i = 0; i < 8; ++i) {
+    auto test_context = std::make_shared<TestContext>();
+    std::future<int> f = test_context->promise_val.get_future();
+    EXPECT_EQ(0, StartScheduler(scheduler, test_context));
+    EXPECT_EQ(0, f.get());
+    // whole chain runs as one job on the same worker
+    EXPECT_EQ(6u, test_context->executed_phases.size());
+    EXPECT_EQ(1u, test_context->thread_ids.size());
+  }
+}
+
+TEST_F(PhaseSchedulerTest, InlineContinuation) {
+  PhaseScheduler scheduler;
+  scheduler.SetPhaseNameSpace("yapf");
+  // no chained node, each fork keeps one child on the completing worker
+  EXPECT_EQ(0, InitScheduler({"a->b", "a->c", "b->d", "c->d", "d->e",
+                              "d->f", "e->g", "f->g"},
+                             {{"a", "ThreadPhase"},
+                              {"b", "ThreadPhase"},
+                              {"c", "ThreadPhase"},
+                              {"d", "ThreadPhase"},
+                              {"e", "ThreadPhase"},
+                              {"f", "ThreadPhase"},
+                              {"g", "ThreadPhase"}},
+                             scheduler));
+  auto plan = scheduler.GetPlan();
+  const uint64_t inlined_count = plan->inlined_count.load();
+  for (int i = 0; i < 8; ++i) {
+    auto test_context = std::make_shared<TestContext>();
+    std::future<int> f = test_context->promise_val.get_future();
+    EXPECT_EQ(0, StartScheduler(scheduler, test_context));
+    EXPECT_EQ(0, f.get());
+    std::unique_lock<std::mutex> locker(test_context->local_mutex);
+    EXPECT_EQ(9u, test_context->executed_phases.size());
+    EXPECT_EQ("EndPhase", test_context->executed_phases.back());
+  }
+  // at least b or c, e or f and the join nodes per request
+  EXPECT_GE(plan->inlined_count.load() - inlined_count, 8u * 2);
+}
+
+TEST_F(PhaseSchedulerTest, NestedStart) {
+  // the inner request is never parked behind the job waiting for it
+  PhaseScheduler scheduler;
+  scheduler.SetPhaseNameSpace("yapf");
+  EXPECT_EQ(0, InitScheduler({"a->n", "n->b"},
+                             {{"a", "ThreadPhase"},
+                              {"n", "NestedPhase"},
+                              {"b", "ThreadPhase"}},
+                             scheduler));
+  PhaseScheduler inner_scheduler;
+  inner_scheduler.SetPhaseNameSpace("yapf");
+  EXPECT_EQ(0, InitScheduler({"x->y"},
+                             {{"x", "ThreadPhase"}, {"y", "ThreadPhase"}},
+                             inner_scheduler));
+  for (int i = 0; i < 4; ++i) {
+    auto test_context = std::make_shared<TestContext>();
+    test_context->inner_scheduler = &inner_scheduler;
+    std::future<int> f = test_context->promise_val.get_future();
+    EXPECT_EQ(0, StartScheduler(scheduler, test_context));
+    EXPECT_EQ(0, f.get());
+    EXPECT_EQ(0, test_context->inner_ret);
+  }
+}
+
+TEST_F(PhaseSchedulerTest, SubPlan) {
+  PhaseScheduler sub_scheduler;
+  sub_scheduler.SetPhaseNameSpace("yapf");
+  EXPECT_EQ(0, InitScheduler({"x->y", "x->z"},
+                             {{"x", "ThreadPhase"},
+                              {"y", "ThreadPhase"},
+                              {"z", "ThreadPhase"}},
+                             sub_scheduler));
+  PhaseScheduler scheduler;
+  scheduler.SetPhaseNameSpace("yapf");
+  EXPECT_EQ(0, scheduler.RegisterSubPlan("SubPlan", sub_scheduler));
+  EXPECT_EQ(0, InitScheduler({"a->s", "s->b"},
+                             {{"a", "ThreadPhase"},
+                              {"s", "SubPlan"},
+                              {"b", "ThreadPhase"}},
+                             scheduler));
+  for (int i = 0; i < 4; ++i) {
+    auto test_context = std::make_shared<TestContext>();
+    std::future<int> f = test_context->promise_val.get_future();
+    EXPECT_EQ(0, StartScheduler(scheduler, test_context));
+    EXPECT_EQ(0, f.get());
+    // StartPhase/EndPhase of the sub plan do not run
+    const auto &phases = test_context->executed_phases;
+    ASSERT_EQ(7u, phases.size());
+    EXPECT_EQ("a", phases[1]);
+    EXPECT_EQ("x", phases[2]);
+    EXPECT_EQ("b", phases[5]);
+    EXPECT_EQ("EndPhase", phases[6]);
+  }
+}
+
+TEST_F(PhaseSchedulerTest, SkipChildren) {
+  PhaseScheduler scheduler;
+  scheduler.SetPhaseNameSpace("yapf");
+  // b and f are only reachable through d, c also depends on e
+  const std::vector<std::string> exprs{"a->d", "d->b", "b->c",
+                                       "a->e", "e->c", "d->f"};
+  const std::unordered_map<std::string, std::string> alias_map{
+      {"a", "APhase"},
+      {"b", "BPhase"},
+      {"c", "CPhase"},
+      {"d", "DPhase(skip_children:true)"},
+      {"e", "APhase"},
+      {"f", "APhase"}};
+  EXPECT_EQ(0, InitScheduler(exprs, alias_map, scheduler));
+  auto test_context = std::make_shared<TestContext>();
+  std::future<int> f = test_context->promise_val.get_future();
+  EXPECT_EQ(0, StartScheduler(scheduler, test_context));
+  EXPECT_EQ(0, f.get());
+  // start, a, d, e, c, end
+  std::set<std::string> phases(test_context->executed_phases.begin(),
+                               test_context->executed_phases.end());
+  EXPECT_EQ(6u, test_context->executed_phases.size());
+  EXPECT_EQ(0u, phases.count("b"));
+  EXPECT_EQ(0u, phases.count("f"));
+  EXPECT_EQ(1u, phases.count("c"));
+  EXPECT_EQ("EndPhase", test_context->executed_phases.back());
+  // g also depends on a directly, it is not skipped with d
+  PhaseScheduler direct_scheduler;
+  direct_scheduler.SetPhaseNameSpace("yapf");
+  EXPECT_EQ(0, InitScheduler({"a->d", "d->g", "a->g"},
+                             {{"a", "APhase"},
+                              {"d", "DPhase(skip_children:true)"},
+                              {"g", "APhase"}},
+                             direct_scheduler));
+  test_context = std::make_shared<TestContext>();
+  f = test_context->promise_val.get_future();
+  EXPECT_EQ(0, StartScheduler(direct_scheduler, test_context));
+  EXPECT_EQ(0, f.get());
+  // start, a, d, g, end
+  EXPECT_EQ(5u, test_context->executed_phases.size());
+}
+
+TEST_F(PhaseSchedulerTest, PlanCache) {
+  auto plan_cache = SchedulerPlanCache::GetInstance();
+  // same config shares the plan built in SetUp
+  PhaseScheduler scheduler;
+  scheduler.SetPhaseNameSpace("yapf");
+  EXPECT_EQ(0, InitScheduler(exprs, alias_map, scheduler));
+  EXPECT_EQ(reused_scheduler.GetPlan(), scheduler.GetPlan());
+  // alias map order does not matter, expressions do
+  std::vector<std::pair<std::string, std::string>> alias_list(
+      alias_map.begin(), alias_map.end());
+  std::unordered_map<std::string, std::string> other_alias_map(
+      alias_list.rbegin(), alias_list.rend());
+  PhaseScheduler other_scheduler;
+  other_scheduler.SetPhaseNameSpace("yapf");
+  EXPECT_EQ(0, InitScheduler(exprs, other_alias_map, other_scheduler));
+  EXPECT_EQ(reused_scheduler.GetPlan(), other_scheduler.GetPlan());
+  PhaseScheduler chain_scheduler;
+  chain_scheduler.SetPhaseNameSpace("yapf");
+  EXPECT_EQ(0, InitScheduler({"a->b", "b->c", "c->d", "d->e"}, alias_map,
+                             chain_scheduler));
+  EXPECT_NE(reused_scheduler.GetPlan(), chain_scheduler.GetPlan());
+  // separators inside expressions or aliases do not collide
+  EXPECT_NE(scheduler.GetPlanKey({"a->b;b->c"}, {}),
+            scheduler.GetPlanKey({"a->b", "b->c"}, {}));
+  EXPECT_NE(scheduler.GetPlanKey({"a->b"}, {{"a", "APhase;b=BPhase"}}),
+            scheduler.GetPlanKey({"a->b"}, {{"a", "APhase"}, {"b", "BPhase"}}));
+  // bounded
+  plan_cache->SetCapacity(1);
+  EXPECT_EQ(1u, plan_cache->Size());
+  PhaseScheduler evicted_scheduler;
+  evicted_scheduler.SetPhaseNameSpace("yapf");
+  EXPECT_EQ(0, InitScheduler(exprs, alias_map, evicted_scheduler));
+  EXPECT_NE(reused_scheduler.GetPlan(), evicted_scheduler.GetPlan());
+  plan_cache->SetCapacity(256);
+  // cached plan still runs
+  auto test_context = std::make_shared<TestContext>();
+  std::future<int> f = test_context->promise_val.get_future();
+  EXPECT_EQ(0, StartScheduler(other_scheduler, test_context));
+  EXPECT_EQ(0, f.get());
+  EXPECT_EQ(7u, test_context->executed_phases.size());
+}
+
+TEST_F(PhaseSchedulerTest, PlanHandle) {
+  SchedulerPlanHandle plan_handle;
+  EXPECT_TRUE(plan_handle.Load() == nullptr);
+  EXPECT_EQ(1u, plan_handle.Publish(reused_scheduler));
+  PhaseScheduler chain_scheduler;
+  chain_scheduler.SetPhaseNameSpace("yapf");
+  EXPECT_EQ(0, InitScheduler({"a->b", "b->c"}, alias_map, chain_scheduler));
+  // readers keep getting a valid plan while plans are swapped
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 4; ++i) {
+    readers.emplace_back([&plan_handle, &stop]() {
+      while (!stop.load()) {
+        auto plan = plan_handle.Load();
+        EXPECT_TRUE(plan != nullptr);
+      }
+    });
+  }
+  for (int i = 0; i < 1000; ++i) {
+    plan_handle.Publish(i % 2 == 0 ? chain_scheduler : reused_scheduler);
+  }
+  stop.store(true);
+  for (auto &reader : readers) {
+    reader.join();
+  }
+  EXPECT_EQ(1001u, plan_handle.GetVersion());
+  // in-flight request keeps the old plan, which is released afterwards
+  auto test_context = std::make_shared<TestContext>();
+  std::future<int> f = test_context->promise_val.get_future();
+  EXPECT_EQ(0, StartScheduler(plan_handle, test_context));
+  PhaseScheduler temp_scheduler;
+  temp_scheduler.SetPhaseNameSpace("yapf");
+  EXPECT_EQ(0, InitScheduler({"a->c"}, alias_map, temp_scheduler));
+  std::weak_ptr<const SchedulerPlan> temp_plan = temp_scheduler.GetPlan();
+  plan_handle.Publish(temp_scheduler);
+  EXPECT_EQ(temp_plan.lock(), plan_handle.Load());
+  plan_handle.Publish(chain_scheduler);
+  temp_scheduler.Clear();
+  SchedulerPlanCache::GetInstance()->Clear();
+  EXPECT_TRUE(temp_plan.expired());
+  EXPECT_EQ(0, f.get());
+  EXPECT_EQ(7u, test_context->executed_phases.size());
+}
+
+TEST_F(PhaseSchedulerTest, MapPhase) {
+  PhaseScheduler scheduler;
+  scheduler.SetPhaseNameSpace("yapf");
+  EXPECT_EQ(0, InitScheduler({"a->m", "m->b"},
+                             {{"a", "APhase"},
+                              {"m", "MapPhase(map:true)"},
+                              {"b", "BPhase"}},
+                             scheduler));
+  for (size_t map_size : {0u, 1u, 4u}) {
+    auto test_context = std::make_shared<TestContext>();
+    test_context->map_size = map_size;
+    std::promise<std::string> statis_log;
+    std::future<std::string> statis_log_future = statis_log.get_future();
+    test_context->AddLogHandler(
+        [&statis_log](const std::string &log) { statis_log.set_value(log); });
+    std::future<int> f = test_context->promise_val.get_future();
+    EXPECT_EQ(0, StartScheduler(scheduler, test_context));
+    EXPECT_EQ(0, f.get());
+    // start, a, m * map_size, b, end
+    const auto &phases = test_context->executed_phases;
+    ASSERT_EQ(map_size + 4u, phases.size());
+    std::set<std::string> instances(phases.begin() + 2,
+                                    phases.begin() + 2 + map_size);
+    EXPECT_EQ(map_size, instances.size());
+    EXPECT_EQ("b", phases[map_size + 2]);
+    // empty map is skipped without running any instance
+    int map_ret = kPhaseProcessingDepPhaseRetPartialFailed;
+    if (map_size == 0u) {
+      map_ret = kPhaseProcessingRetSkip;
+    } else if (map_size == 1u) {
+      map_ret = -1;
+    }
+    // log is exported after EndPhase notified
+    EXPECT_NE(std::string::npos,
+              statis_log_future.get().find("m(phase_ret[ret:" +
+                                           std::to_string(map_ret)));
+  }
+}
+
+TEST_F(PhaseSchedulerTest, PlanFile) {
+  std::string path =
+      "/tmp/phase_scheduler_test." + std::to_string(getpid()) + ".plan";
+  EXPECT_EQ(0, reused_scheduler.SavePlan(path));
+  // loaded plan skips expression parsing and DAG validation
+  PhaseScheduler loaded_scheduler;
+  EXPECT_EQ(0, loaded_scheduler.LoadPlan(path));
+  unlink(path.c_str());
+  auto plan = loaded_scheduler.GetPlan();
+  ASSERT_TRUE(plan != nullptr);
+  EXPECT_EQ("yapf", plan->phase_namespace_name);
+  EXPECT_EQ(reused_scheduler.GetPlan()->dag_plan->Size(),
+            plan->dag_plan->Size());
+  auto test_context = std::make_shared<TestContext>();
+  std::future<int> f = test_context->promise_val.get_future();
+  EXPECT_EQ(0, StartScheduler(loaded_scheduler, test_context));
+  EXPECT_EQ(0, f.get());
+  EXPECT_EQ(7u, test_context->executed_phases.size());
+  EXPECT_EQ(std::string("e"), test_context->redo_phase);
+  EXPECT_EQ(kPhaseSchedulerRetPlanFileFailed,
+            loaded_scheduler.LoadPlan(path));
+}
+
+TEST_F(PhaseSchedulerTest, EstimatePlan) {
+  // a->b->{c,d} runs beside e
+  PlanEstimate estimate;
+  EXPECT_EQ(0, reused_scheduler.EstimatePlan(
+                   {{"a", 10}, {"b", 10}, {"c", 10}, {"d", 10}, {"e", 5}},
+                   estimate));
+  EXPECT_EQ(30, estimate.critical_path);
+  EXPECT_EQ(45, estimate.total_work);
+  EXPECT_EQ(2u, estimate.max_width);
+  EXPECT_DOUBLE_EQ(1.5, estimate.average_parallelism);
+  EXPECT_EQ(2u, estimate.saturated_thread_num);
+  PhaseScheduler empty_scheduler;
+  EXPECT_EQ(kPhaseSchedulerRetDAGNotBuilt,
+            empty_scheduler.EstimatePlan({}, estimate));
+}
+
+TEST_F(PhaseSchedulerTest, ParallelBuild) {
+  // wide enough to be validated and layered by the pool
+  constexpr size_t kWidth = 3000;
+  std::vector<std::string> exprs;
+  std::unordered_map<std::string, std::string> alias_map{{"a", "APhase"},
+                                                         {"b", "BPhase"}};
+  for (size_t i = 0; i < kWidth; ++i) {
+    std::string name = "m" + std::to_string(i);
+    exprs.push_back("a->" + name);
+    exprs.push_back(name + "->b");
+    alias_map[name] = "CPhase";
+  }
+  PhaseScheduler scheduler;
+  scheduler.SetPhaseNameSpace("yapf");
+  EXPECT_EQ(0, InitScheduler(exprs, alias_map, scheduler));
+  const auto &dag_plan = *scheduler.GetPlan()->dag_plan;
+  EXPECT_EQ(kWidth + 4, dag_plan.Size());
+  for (uint32_t id = 0; id < dag_plan.Size(); ++id) {
+    const auto &node = dag_plan.GetNode(id);
+    uint32_t level = node.name == "StartPhase" ? 0
+                     : node.name == "a"        ? 1
+                     : node.name == "b"        ? 3
+                     : node.name == "EndPhase" ? 4
+                                               : 2;
+    EXPECT_EQ(level, node.level);
+  }
+  alias_map["m7"] = "NotRegisteredPhase";
+  PhaseScheduler invalid_scheduler;
+  invalid_scheduler.SetPhaseNameSpace("yapf");
+  EXPECT_NE(0, InitScheduler(exprs, alias_map, invalid_scheduler));
+}
+
+TEST_F(PhaseSchedulerTest, Hedge) {
+  PhaseScheduler scheduler;
+  scheduler.SetPhaseNameSpace("yapf");
+  EXPECT_EQ(0, InitScheduler({"a->h", "h->b"},
+                             {{"a", "APhase"},
+                              {"h", "SlowPhase(hedge_after_ms:20)"},
+                              {"b", "BPhase"}},
+                             scheduler));
+  auto plan = scheduler.GetPlan();
+  ASSERT_TRUE(plan->has_hedge_node);
+  auto test_context = std::make_shared<TestContext>();
+  std::promise<std::string> statis_log;
+  std::future<std::string> statis_log_future = statis_log.get_future();
+  test_context->AddLogHandler(
+      [&statis_log](const std::string &log) { statis_log.set_value(log); });
+  std::future<int> f = test_context->promise_val.get_future();
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_EQ(0, StartScheduler(scheduler, test_context));
+  EXPECT_EQ(0, f.get());
+  // the hedge instance wins, not waiting for the slow one
+  EXPECT_LT(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(250));
+  EXPECT_NE(std::string::npos,
+            statis_log_future.get().find("h(phase_ret[ret:0]"));
+  EXPECT_EQ(1u, plan->hedged_count.load());
+  EXPECT_EQ(1u, plan->hedge_won_count.load());
+  const std::vector<std::string> phases{"StartPhase", "a", "h", "b",
+                                        "EndPhase"};
+  EXPECT_EQ(phases, test_context->executed_phases);
+  EXPECT_EQ(2, test_context->slow_phase_runs.load());
+  // the slow loser holds the context until it returns
+  for (int i = 0; i < 100 && test_context.use_count() > 1; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(1, test_context.use_count());
+}
+
+TEST_F(PhaseSchedulerTest, Memo) {
+  PhaseScheduler scheduler;
+  scheduler.SetPhaseNameSpace("yapf");
+  EXPECT_EQ(0, InitScheduler({"a->m", "m->b"},
+                             {{"a", "APhase"},
+                              {"m", "MemoPhase(memo:true,memo_ttl_ms:5000)"},
+                              {"b", "BPhase"}},
+                             scheduler));
+  ASSERT_TRUE(scheduler.GetPlan()->has_memo_node);
+  auto &memo_cache = PhaseScheduler::GetMemoCache();
+  memo_cache.Clear();
+  const uint64_t hit_count = memo_cache.GetHitCount();
+  const uint64_t miss_count = memo_cache.GetMissCount();
+  // input 7 runs, then hits; input 8 runs
+  const std::vector<std::pair<int, bool>> cases{
+      {7, true}, {7, false}, {8, true}};
+  for (const auto &item : cases) {
+    const int input = item.first;
+    auto test_context = std::make_shared<TestContext>();
+    test_context->memo_input = input;
+    std::future<int> f = test_context->promise_val.get_future();
+    EXPECT_EQ(0, StartScheduler(scheduler, test_context));
+    EXPECT_EQ(0, f.get());
+    EXPECT_EQ(input * 2, test_context->memo_output);
+    const bool executed =
+        std::find(test_context->executed_phases.begin(),
+                  test_context->executed_phases.end(),
+                  "m") != test_context->executed_phases.end();
+    EXPECT_EQ(item.second, executed);
+  }
+  EXPECT_EQ(hit_count + 1, memo_cache.GetHitCount());
+  EXPECT_EQ(miss_count + 2, memo_cache.GetMissCount());
+  EXPECT_EQ(2u, memo_cache.Size());
+}
+
+TEST_F(PhaseSchedulerTest, MemoHitChain) {
+  // same phase with same params shares results, every node after the first
+  // one hits the memo cache within a single request
+  constexpr int kChainSize = 64;
+  std::vector<std::string> exprs;
+  std::unordered_map<std::string, std::string> alias_map;
+  for (int i = 0; i < kChainSize; ++i) {
+    const std::string name = "m" + std::to_string(i);
+    alias_map[name] = "MemoPhase(memo:true,memo_ttl_ms:5000)";
+    if (i > 0) {
+      exprs.push_back("m" + std::to_string(i - 1) + "->" + name);
+    }
+  }
+  PhaseScheduler scheduler;
+  scheduler.SetPhaseNameSpace("yapf");
+  EXPECT_EQ(0, InitScheduler(exprs, alias_map, scheduler));
+  auto &memo_cache = PhaseScheduler::GetMemoCache();
+  memo_cache.Clear();
+  const uint64_t hit_count = memo_cache.GetHitCount();
+  auto test_context = std::make_shared<TestContext>();
+  test_context->memo_input = 3;
+  std::future<int> f = test_context->promise_val.get_future();
+  EXPECT_EQ(0, StartScheduler(scheduler, test_context));
+  ASSERT_EQ(std::future_status::ready, f.wait_for(std::chrono::seconds(2)));
+  EXPECT_EQ(6, test_context->memo_output);
+  EXPECT_EQ(1, std::count(test_context->executed_phases.begin(),
+                          test_context->executed_phases.end(), "m0"));
+  // start, m0, end
+  EXPECT_EQ(3u, test_context->executed_phases.size());
+  EXPECT_EQ(hit_count + kChainSize - 1, memo_cache.GetHitCount());
+}
+
+TEST_F(PhaseSchedulerTest, JoinQuorum) {
+  // q goes on after 2 of 3 replicas, the slow one is ignored
+  PhaseScheduler scheduler;
+  scheduler.SetPhaseNameSpace("yapf");
+  EXPECT_EQ(0, InitScheduler({"s->r1", "s->r2", "s->r3", "r1->q", "r2->q",
+                              "r3->q"},
+                             {{"s", "APhase"},
+                              {"r1", "BPhase"},
+                              {"r2", "CPhase"},
+                              {"r3", "DelayPhase(delay_ms:300)"},
+                              {"q", "APhase(join:2)"}},
+                             scheduler));
+  ASSERT_TRUE(scheduler.GetPlan()->has_quorum_node);
+  auto test_context = std::make_shared<TestContext>();
+  std::future<int> f = test_context->promise_val.get_future();
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_EQ(0, StartScheduler(scheduler, test_context));
+  EXPECT_EQ(0, f.get());
+  EXPECT_LT(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(250));
+  {
+    std::unique_lock<std::mutex> locker(test_context->local_mutex);
+    const auto &phases = test_context->executed_phases;
+    EXPECT_NE(phases.end(), std::find(phases.begin(), phases.end(), "q"));
+  }
+
+  // failed parents dont count, any waits for the slow successful one
+  PhaseScheduler any_scheduler;
+  any_scheduler.SetPhaseNameSpace("yapf");
+  EXPECT_EQ(0, InitScheduler({"d->q", "w->q"},
+                             {{"d", "DPhase"},
+                              {"w", "DelayPhase(delay_ms:100)"},
+                              {"q", "APhase(join:any)"}},
+                             any_scheduler));
+  test_context = std::make_shared<TestContext>();
+  f = test_context->promise_val.get_future();
+  EXPECT_EQ(0, StartScheduler(any_scheduler, test_context));
+  EXPECT_EQ(0, f.get());
+  const auto &phases = test_context->executed_phases;
+  auto w_iter = std::find(phases.begin(), phases.end(), "w");
+  ASSERT_NE(phases.end(), w_iter);
+  EXPECT_NE(phases.end(), std::find(w_iter, phases.end(), "q"));
+
+  PhaseScheduler invalid_scheduler;
+  invalid_scheduler.SetPhaseNameSpace("yapf");
+  EXPECT_NE(0, InitScheduler({"d->q", "w->q"},
+                             {{"d", "DPhase"},
+                              {"w", "APhase"},
+                              {"q", "APhase(join:some)"}},
+                             invalid_scheduler));
+}
+
+TEST_F(PhaseSchedulerTest, Batch) {
+  PhaseScheduler sub_scheduler;
+  sub_scheduler.SetPhaseNameSpace("yapf");
+  EXPECT_EQ(0, InitScheduler({"x->y"},
+                             {{"x", "ThreadPhase"}, {"y", "ThreadPhase"}},
+                             sub_scheduler));
+  PhaseScheduler scheduler;
+  scheduler.SetPhaseNameSpace("yapf");
+  EXPECT_EQ(0, scheduler.RegisterSubPlan("SubPlan", sub_scheduler));
+  // b is dominated by the skipped d, c also depends on s
+  EXPECT_EQ(0, InitScheduler({"a->d", "d->b", "b->c", "a->s", "s->c"},
+                             {{"a", "BatchPhase"},
+                              {"b", "BPhase"},
+                              {"c", "CPhase"},
+                              {"d", "DPhase(skip_children:true)"},
+                              {"s", "SubPlan"}},
+                             scheduler));
+  std::vector<std::shared_ptr<TestContext>> contexts;
+  std::vector<PhaseContextPtr> context_ptrs;
+  for (int i = 0; i < 4; ++i) {
+    contexts.push_back(std::make_shared<TestContext>());
+    context_ptrs.push_back(contexts.back());
+  }
+  contexts[3]->interrupt = true;
+  std::string log_content;
+  contexts[0]->AddLogHandler(
+      [&log_content](const std::string &log) { log_content = log; });
+  BatchRunResult result;
+  EXPECT_EQ(0, StartSchedulerBatch(scheduler, context_ptrs, &result));
+  const auto &dag_plan = *scheduler.GetPlan()->dag_plan;
+  std::unordered_map<std::string, uint32_t> ids;
+  for (uint32_t id = 0; id < dag_plan.Size(); ++id) {
+    ids[std::string(dag_plan.GetNode(id).name)] = id;
+  }
+  ASSERT_EQ(4u, result.rets.size());
+  for (int i = 0; i < 3; ++i) {
+    const auto &phases = contexts[i]->executed_phases;
+    // start, a, d, x, y, c, end
+    EXPECT_EQ(7u, phases.size());
+    EXPECT_EQ(4u, contexts[i]->batch_size);
+    EXPECT_EQ(0, contexts[i]->ret);
+    EXPECT_FALSE(contexts[i]->is_interrupted);
+    EXPECT_EQ(phases.end(), std::find(phases.begin(), phases.end(), "b"));
+    EXPECT_EQ(0, result.rets[i][ids["a"]]);
+    EXPECT_EQ(kPhaseProcessingRetSkip, result.rets[i][ids["d"]]);
+    EXPECT_EQ(BatchRunResult::kRetNone, result.rets[i][ids["b"]]);
+    EXPECT_EQ(0, result.rets[i][ids["s"]]);
+    EXPECT_EQ(0, result.rets[i][ids["c"]]);
+  }
+  // statis is reported per context, skipped sub graph is not listed
+  EXPECT_NE(std::string::npos, log_content.find("|a(phase_ret[ret:0]"));
+  EXPECT_EQ(std::string::npos, log_content.find("|b("));
+  // only EndPhase runs after interruption
+  const auto &phases = contexts[3]->executed_phases;
+  ASSERT_EQ(3u, phases.size());
+  EXPECT_EQ("a", phases[1]);
+  EXPECT_EQ("EndPhase", phases[2]);
+  EXPECT_TRUE(contexts[3]->is_interrupted);
+  EXPECT_EQ(kPhaseProcessingRetInterrupt, contexts[3]->ir_reason);
+  EXPECT_EQ(kPhaseProcessingRetSkip, result.rets[3][ids["c"]]);
+
+  PhaseScheduler empty_scheduler;
+  EXPECT_EQ(kPhaseSchedulerRetDAGNotBuilt,
+            StartSchedulerBatch(empty_scheduler, context_ptrs));
+}
+
+TEST(LatencyHistogramTest, Percentile) {
+  LatencyHistogram histogram;
+  for (int64_t ms = 1; ms <= 100; ++ms) {
+    histogram.Add(ms * 1000);
+    // not enough samples
+    if (ms < 16) {
+      EXPECT_EQ(-1, histogram.GetPercentile(95, 16));
+    }
+  }
+  // bucket upper bound, at most 2^(1/4) times of the real value
+  int64_t p95 = histogram.GetPercentile(95, 16);
+  EXPECT_GE(p95, 95000);
+  EXPECT_LE(p95, 95000 * 1.19);
+  int64_t p50 = histogram.GetPercentile(50, 16);
+  EXPECT_GE(p50, 50000);
+  EXPECT_LT(p50, p95);
+}
+
+TEST(RequestRuntimeTest, SingleBlock) {
+  RequestRuntime runtime;
+  runtime.Allocate(5);
+  ASSERT_EQ(5u, runtime.Size());
+  for (uint32_t id = 0; id < runtime.Size(); ++id) {
+    // one cache line per node
+    EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(&runtime[id]) % 64);
+  }
+  // topology is laid out right after the node states
+  EXPECT_EQ(reinterpret_cast<char *>(&runtime[0]) + sizeof(NodeRuntime) * 5,
+            reinterpret_cast<char *>(runtime.GetTopology()));
+  runtime[3].indegree.store(2);
+  runtime[3].phase = std::make_shared<APhase>();
+  std::weak_ptr<Phase> phase = runtime[3].phase;
+  NodeRuntime *nodes = &runtime[0];
+  // same size is reset in place, phase instances are kept
+  runtime.Allocate(5);
+  EXPECT_EQ(nodes, &runtime[0]);
+  EXPECT_EQ(0, runtime[3].indegree.load());
+  EXPECT_FALSE(phase.expired());
+  runtime.Allocate(9);
+  EXPECT_EQ(9u, runtime.Size());
+  EXPECT_TRUE(phase.expired());
+  runtime.Release();
+  EXPECT_EQ(0u, runtime.Size());
+}
+
+}  // namespace yapf
@@ -0,0 +1,124 @@
+// File Name: plan_estimator.cpp
+// Description:
+
+#include "yapf/base/plan_estimator.h"
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <utility>
+
+#include "yapf/base/logging.h"
+
+namespace yapf {
+
+int PlanEstimator::Estimate(const DAGPlan &dag_plan,
+                            const std::vector<int64_t> &durations,
+                            PlanEstimate &estimate) {
+  const size_t node_num = dag_plan.Size();
+  if (durations.size() != node_num) {
+    DAGPF_LOG_ERROR << "durations size mismatch: " << durations.size()
+                    << ", node num: " << node_num << std::endl;
+    return kPlanEstimatorRetInvalidDuration;
+  }
+  for (auto duration : durations) {
+    if (duration < 0) {
+      DAGPF_LOG_ERROR << "negative duration: " << duration << std::endl;
+      return kPlanEstimatorRetInvalidDuration;
+    }
+  }
+  estimate = PlanEstimate();
+  std::vector<uint32_t> order;
+  dag_plan.GetTopologyOrder(order);
+  // 最早开始时间
+  std::vector<int64_t> earliest_start(node_num, 0);
+  for (auto id : order) {
+    for (auto parent : dag_plan.GetParents(id)) {
+      earliest_start[id] = std::max(earliest_start[id],
+                                    earliest_start[parent] + durations[parent]);
+    }
+    estimate.critical_path =
+        std::max(estimate.critical_path, earliest_start[id] + durations[id]);
+    estimate.total_work += durations[id];
+  }
+  // 最长剩余路径，作为模拟调度的优先级
+  std::vector<int64_t> critical_path(node_num, 0);
+  for (auto iter = order.rbegin(); iter != order.rend(); ++iter) {
+    int64_t longest_child = 0;
+    for (auto child : dag_plan.GetLinks(*iter)) {
+      longest_child = std::max(longest_child, critical_path[child]);
+    }
+    critical_path[*iter] = durations[*iter] + longest_child;
+  }
+  // 最大宽度，同一时刻先结束后开始，耗时为0的节点不占线程
+  std::vector<std::pair<int64_t, int>> events;
+  events.reserve(node_num * 2);
+  for (uint32_t id = 0; id < node_num; ++id) {
+    if (durations[id] == 0) continue;
+    events.emplace_back(earliest_start[id], 1);
+    events.emplace_back(earliest_start[id] + durations[id], -1);
+  }
+  std::sort(events.begin(), events.end());
+  size_t width = 0;
+  for (const auto &event : events) {
+    width += event.second;
+    estimate.max_width = std::max(estimate.max_width, width);
+  }
+  if (estimate.critical_path == 0) {
+    return 0;
+  }
+  estimate.average_parallelism =
+      static_cast<double>(estimate.total_work) / estimate.critical_path;
+  // 完成时间不小于total_work / thread_num，从下界开始逐个模拟;
+  // 线程数不小于max_width时一定达到关键路径长度
+  size_t thread_num = std::max<size_t>(
+      1, (estimate.total_work + estimate.critical_path - 1) /
+             estimate.critical_path);
+  for (; thread_num < estimate.max_width; ++thread_num) {
+    if (Simulate(dag_plan, durations, critical_path, thread_num) ==
+        estimate.critical_path) {
+      break;
+    }
+  }
+  estimate.saturated_thread_num = std::max<size_t>(1, thread_num);
+  return 0;
+}
+
+int64_t PlanEstimator::Simulate(const DAGPlan &dag_plan,
+                                const std::vector<int64_t> &durations,
+                                const std::vector<int64_t> &critical_path,
+                                size_t thread_num) {
+  const size_t node_num = dag_plan.Size();
+  std::vector<int> indegrees(node_num);
+  for (uint32_t id = 0; id < node_num; ++id) {
+    indegrees[id] = dag_plan.GetParents(id).size();
+  }
+  // 就绪节点按最长剩余路径降序，运行节点按结束时间升序
+  using Item = std::pair<int64_t, uint32_t>;
+  std::priority_queue<Item> ready;
+  std::priority_queue<Item, std::vector<Item>, std::greater<Item>> running;
+  ready.emplace(critical_path[dag_plan.GetStartNodeId()],
+                dag_plan.GetStartNodeId());
+  int64_t now = 0;
+  while (true) {
+    while (!ready.empty() && running.size() < thread_num) {
+      uint32_t id = ready.top().second;
+      ready.pop();
+      running.emplace(now + durations[id], id);
+    }
+    if (running.empty()) break;
+    now = running.top().first;
+    while (!running.empty() && running.top().first == now) {
+      uint32_t id = running.top().second;
+      running.pop();
+      for (auto child : dag_plan.GetLinks(id)) {
+        if (--indegrees[child] == 0) {
+          ready.emplace(critical_path[child], child);
+        }
+      }
+    }
+  }
+  return now;
+}
+
+}  // namespace yapf
@@ -0,0 +1,43 @@
+// File Name: plan_estimator.h
+// Description: 按各Phase耗时估计离线估计DAG计划的完成时间及并行度
+//
+// 用于评估SchedulerThreadPoolOption::thread_num的合理取值
+
+#ifndef PLAN_ESTIMATOR_H_
+#define PLAN_ESTIMATOR_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "yapf/base/dag_processing.h"
+
+namespace yapf {
+
+enum EPlanEstimatorRet {
+  kPlanEstimatorRetInvalidDuration = 80300,
+};
+
+struct PlanEstimate {
+  int64_t critical_path{0};  // 关键路径长度(us)，即线程充足时的完成时间
+  int64_t total_work{0};     // 所有节点耗时之和(us)，即单线程完成时间
+  size_t max_width{0};  // 线程充足时按最早开始时间调度，同时运行的最大节点数
+  double average_parallelism{0.0};  // total_work / critical_path
+  size_t saturated_thread_num{1};   // 线程数达到该值后完成时间不再缩短
+};
+
+class PlanEstimator {
+ public:
+  // durations为各节点耗时(us)，按节点id索引，长度等于dag_plan.Size()
+  static int Estimate(const DAGPlan &dag_plan,
+                      const std::vector<int64_t> &durations,
+                      PlanEstimate &estimate);
+  // 模拟thread_num个线程按关键路径优先派发就绪节点，返回完成时间(us)
+  static int64_t Simulate(const DAGPlan &dag_plan,
+                          const std::vector<int64_t> &durations,
+                          const std::vector<int64_t> &critical_path,
+                          size_t thread_num);
+};
+
+}  // namespace yapf
+
+#endif
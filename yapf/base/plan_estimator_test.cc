@@ -0,0 +1,88 @@
+// File Name: plan_estimator_test.cc
+// Description:
+
+#include "yapf/base/plan_estimator.h"
+
+#include <unordered_map>
+
+#include "yapf/base/phase_common.h"
+
+#include "gtest/gtest.h"
+
+namespace yapf {
+
+static DAGPlanPtr CompileTestPlan(const std::vector<std::string> &exprs) {
+  DAG dag;
+  std::vector<std::pair<std::string, std::string> > pairs;
+  std::vector<std::string> single_nodes;
+  EXPECT_EQ(0, ParseExprs(exprs, pairs, single_nodes));
+  EXPECT_EQ(0, dag.AddNodeLinks(pairs, single_nodes));
+  EXPECT_EQ(0, dag.Init([](const auto &t) -> bool { return true; }));
+  DAGPlanPtr plan;
+  EXPECT_EQ(0, dag.Compile(plan));
+  return plan;
+}
+
+static std::vector<int64_t> ToDurations(
+    const DAGPlan &plan,
+    const std::unordered_map<std::string, int64_t> &name_durations) {
+  std::vector<int64_t> durations(plan.Size(), 0);
+  for (uint32_t id = 0; id < plan.Size(); ++id) {
+    auto iter = name_durations.find(std::string(plan.GetNode(id).name));
+    if (iter != name_durations.end()) {
+      durations[id] = iter->second;
+    }
+  }
+  return durations;
+}
+
+TEST(PlanEstimatorTest, Diamond) {
+  auto plan = CompileTestPlan({"a->b", "a->c", "b->d", "c->d"});
+  auto durations =
+      ToDurations(*plan, {{"a", 10}, {"b", 20}, {"c", 30}, {"d", 10}});
+  PlanEstimate estimate;
+  EXPECT_EQ(0, PlanEstimator::Estimate(*plan, durations, estimate));
+  EXPECT_EQ(50, estimate.critical_path);
+  EXPECT_EQ(70, estimate.total_work);
+  EXPECT_EQ(2u, estimate.max_width);
+  EXPECT_DOUBLE_EQ(1.4, estimate.average_parallelism);
+  EXPECT_EQ(2u, estimate.saturated_thread_num);
+}
+
+TEST(PlanEstimatorTest, Saturation) {
+  // b dominates, c/d/e fit into one thread beside it
+  auto plan = CompileTestPlan({"a->b", "a->c", "a->d", "a->e"});
+  auto durations = ToDurations(
+      *plan, {{"a", 10}, {"b", 100}, {"c", 10}, {"d", 10}, {"e", 10}});
+  PlanEstimate estimate;
+  EXPECT_EQ(0, PlanEstimator::Estimate(*plan, durations, estimate));
+  EXPECT_EQ(110, estimate.critical_path);
+  EXPECT_EQ(4u, estimate.max_width);
+  EXPECT_EQ(2u, estimate.saturated_thread_num);
+  // single thread runs all work serially
+  EXPECT_EQ(140, PlanEstimator::Simulate(*plan, durations, durations, 1));
+  // balanced fan-out needs one thread per branch
+  durations = ToDurations(
+      *plan, {{"a", 10}, {"b", 10}, {"c", 10}, {"d", 10}, {"e", 10}});
+  EXPECT_EQ(0, PlanEstimator::Estimate(*plan, durations, estimate));
+  EXPECT_EQ(20, estimate.critical_path);
+  EXPECT_DOUBLE_EQ(2.5, estimate.average_parallelism);
+  EXPECT_EQ(4u, estimate.saturated_thread_num);
+}
+
+TEST(PlanEstimatorTest, InvalidDuration) {
+  auto plan = CompileTestPlan({"a->b"});
+  PlanEstimate estimate;
+  EXPECT_EQ(kPlanEstimatorRetInvalidDuration,
+            PlanEstimator::Estimate(*plan, {1, 2}, estimate));
+  std::vector<int64_t> durations(plan->Size(), -1);
+  EXPECT_EQ(kPlanEstimatorRetInvalidDuration,
+            PlanEstimator::Estimate(*plan, durations, estimate));
+  // all zero
+  durations.assign(plan->Size(), 0);
+  EXPECT_EQ(0, PlanEstimator::Estimate(*plan, durations, estimate));
+  EXPECT_EQ(0, estimate.critical_path);
+  EXPECT_EQ(1u, estimate.saturated_thread_num);
+}
+
+}  // namespace yapf
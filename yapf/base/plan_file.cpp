@@ -0,0 +1,397 @@
+// File Name: plan_file.cpp
+// Description:
+
+#include "yapf/base/plan_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+#include <utility>
+
+#include "yapf/base/logging.h"
+
+namespace yapf {
+
+namespace {
+
+constexpr char kPlanFileMagic[8] = {'Y', 'A', 'P', 'F', 'P', 'L', 'A', 'N'};
+constexpr uint32_t kPlanFileVersion = 2;
+
+struct PlanFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t node_num;
+  uint32_t edge_num;
+  uint32_t param_num;
+  uint32_t start_node_id;
+  uint32_t end_node_id;
+  uint32_t namespace_offset;
+  uint32_t namespace_size;
+  uint64_t string_table_size;
+  uint64_t checksum;  // header之后所有字节
+};
+
+// 字符串表区间
+struct PlanFileString {
+  uint32_t offset;
+  uint32_t size;
+};
+
+struct PlanFileNode {
+  int32_t indegree;
+  uint32_t level;
+  uint32_t link_begin;
+  uint32_t link_end;
+  uint32_t parent_begin;
+  uint32_t parent_end;
+  uint32_t param_begin;
+  uint32_t param_end;
+  PlanFileString name;
+  PlanFileString full_name;
+  PlanFileString class_name;
+};
+
+// 参数保存解析后的各类型值，加载时不再解析字符串
+struct PlanFileParam {
+  PlanFileString key;
+  PlanFileString value;
+  int64_t iv;
+  double dv;
+  uint32_t bv;
+  uint32_t reserved;
+};
+
+// FNV-1a
+uint64_t Checksum(const char *data, size_t size) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= static_cast<unsigned char>(data[i]);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+// 字符串去重写入字符串表
+class StringTableWriter {
+ public:
+  PlanFileString Add(std::string_view str) {
+    auto result = offsets_.emplace(std::string(str), table_.size());
+    if (result.second) {
+      table_.append(str.data(), str.size());
+    }
+    return {result.first->second, static_cast<uint32_t>(str.size())};
+  }
+  const std::string &GetTable() const { return table_; }
+
+ private:
+  std::string table_;
+  std::unordered_map<std::string, uint32_t> offsets_;
+};
+
+template <typename T>
+void AppendSection(std::string &buffer, const T *data, size_t num) {
+  buffer.append(reinterpret_cast<const char *>(data), sizeof(T) * num);
+}
+
+bool InRange(const PlanFileString &str, uint64_t table_size) {
+  return static_cast<uint64_t>(str.offset) + str.size <= table_size;
+}
+
+// 加载计划不再经过DAG构建校验，检查文件中的拓扑自洽:
+// 入度与入边数一致、出边与入边互为镜像、无环且所有节点可达、层级为最长路径
+bool CheckTopology(const DAGPlan &plan) {
+  const size_t node_num = plan.Size();
+  std::vector<std::pair<uint32_t, uint32_t>> links, parents;
+  links.reserve(plan.GetEdgeCount());
+  parents.reserve(plan.GetEdgeCount());
+  for (uint32_t id = 0; id < node_num; ++id) {
+    const auto &node = plan.GetNode(id);
+    if (node.indegree < 0 ||
+        static_cast<size_t>(node.indegree) != plan.GetParents(id).size()) {
+      return false;
+    }
+    for (const auto &child : plan.GetLinks(id)) {
+      links.emplace_back(id, child);
+    }
+    for (const auto &parent : plan.GetParents(id)) {
+      parents.emplace_back(parent, id);
+    }
+  }
+  if (plan.GetNode(plan.GetStartNodeId()).indegree != 0) return false;
+  std::sort(links.begin(), links.end());
+  std::sort(parents.begin(), parents.end());
+  if (links != parents) return false;
+  std::vector<uint32_t> order;
+  plan.GetTopologyOrder(order);
+  if (order.size() != node_num) return false;
+  std::vector<uint32_t> levels(node_num, 0u);
+  for (const auto &id : order) {
+    if (plan.GetNode(id).level != levels[id]) return false;
+    for (const auto &child : plan.GetLinks(id)) {
+      levels[child] = std::max(levels[child], levels[id] + 1);
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+int PlanFile::Serialize(const DAGPlan &dag_plan,
+                        const std::vector<PhaseParamDetail> &phase_params,
+                        const std::string &phase_namespace,
+                        std::string &buffer) {
+  const size_t node_num = dag_plan.Size();
+  if (phase_params.size() != node_num) {
+    DAGPF_LOG_ERROR << "phase params size mismatch: " << phase_params.size()
+                    << ", node num: " << node_num << std::endl;
+    return kPlanFileRetInvalidFormat;
+  }
+  StringTableWriter strings;
+  std::vector<PlanFileNode> nodes(node_num);
+  std::vector<PlanFileParam> params;
+  for (uint32_t id = 0; id < node_num; ++id) {
+    const auto &plan_node = dag_plan.GetNode(id);
+    const auto &config_key = phase_params[id].config_key;
+    auto &node = nodes[id];
+    node.indegree = plan_node.indegree;
+    node.level = plan_node.level;
+    node.link_begin = plan_node.link_begin;
+    node.link_end = plan_node.link_end;
+    node.parent_begin = plan_node.parent_begin;
+    node.parent_end = plan_node.parent_end;
+    node.name = strings.Add(plan_node.name);
+    node.full_name = strings.Add(plan_node.full_name);
+    node.class_name = strings.Add(config_key.name);
+    node.param_begin = params.size();
+    for (const auto &item : config_key.params.params) {
+      PlanFileParam param;
+      memset(&param, 0, sizeof(param));
+      param.key = strings.Add(item.first);
+      param.value = strings.Add(item.second.str);
+      param.iv = item.second.iv;
+      param.dv = item.second.dv;
+      param.bv = item.second.bv;
+      params.push_back(param);
+    }
+    node.param_end = params.size();
+  }
+  PlanFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kPlanFileMagic, sizeof(header.magic));
+  header.version = kPlanFileVersion;
+  header.node_num = node_num;
+  header.edge_num = dag_plan.GetEdgeCount();
+  header.param_num = params.size();
+  header.start_node_id = dag_plan.GetStartNodeId();
+  header.end_node_id = dag_plan.GetEndNodeId();
+  auto ns = strings.Add(phase_namespace);
+  header.namespace_offset = ns.offset;
+  header.namespace_size = ns.size;
+  header.string_table_size = strings.GetTable().size();
+  buffer.clear();
+  AppendSection(buffer, &header, 1);
+  AppendSection(buffer, nodes.data(), nodes.size());
+  AppendSection(buffer, dag_plan.links_.data(), dag_plan.links_.size());
+  AppendSection(buffer, dag_plan.parents_.data(), dag_plan.parents_.size());
+  AppendSection(buffer, params.data(), params.size());
+  buffer.append(strings.GetTable());
+  header.checksum = Checksum(buffer.data() + sizeof(header),
+                             buffer.size() - sizeof(header));
+  memcpy(&buffer[0], &header, sizeof(header));
+  return 0;
+}
+
+int PlanFile::Parse(const char *data, size_t size, DAGPlanPtr &dag_plan,
+                    std::vector<PhaseParamDetail> &phase_params,
+                    std::string &phase_namespace) {
+  PlanFileHeader header;
+  if (size < sizeof(header)) {
+    DAGPF_LOG_ERROR << "plan file too small: " << size << std::endl;
+    return kPlanFileRetInvalidFormat;
+  }
+  memcpy(&header, data, sizeof(header));
+  if (memcmp(header.magic, kPlanFileMagic, sizeof(header.magic)) != 0 ||
+      header.version != kPlanFileVersion) {
+    DAGPF_LOG_ERROR << "invalid plan file magic or version: "
+                    << header.version << std::endl;
+    return kPlanFileRetInvalidFormat;
+  }
+  const uint64_t expected_size =
+      sizeof(header) + sizeof(PlanFileNode) * uint64_t(header.node_num) +
+      sizeof(uint32_t) * uint64_t(header.edge_num) * 2 +
+      sizeof(PlanFileParam) * uint64_t(header.param_num) +
+      header.string_table_size;
+  if (expected_size != size || header.node_num == 0 ||
+      header.start_node_id >= header.node_num ||
+      header.end_node_id >= header.node_num ||
+      !InRange({header.namespace_offset, header.namespace_size},
+               header.string_table_size)) {
+    DAGPF_LOG_ERROR << "invalid plan file size: " << size
+                    << ", expected: " << expected_size << std::endl;
+    return kPlanFileRetInvalidFormat;
+  }
+  if (Checksum(data + sizeof(header), size - sizeof(header)) !=
+      header.checksum) {
+    DAGPF_LOG_ERROR << "plan file checksum mismatch." << std::endl;
+    return kPlanFileRetChecksumMismatch;
+  }
+  // sections
+  const char *cursor = data + sizeof(header);
+  auto nodes = reinterpret_cast<const PlanFileNode *>(cursor);
+  cursor += sizeof(PlanFileNode) * header.node_num;
+  auto links = reinterpret_cast<const uint32_t *>(cursor);
+  cursor += sizeof(uint32_t) * header.edge_num;
+  auto parents = reinterpret_cast<const uint32_t *>(cursor);
+  cursor += sizeof(uint32_t) * header.edge_num;
+  // params hold 8-byte fields, copied out instead of read in place
+  const char *params_data = cursor;
+  cursor += sizeof(PlanFileParam) * header.param_num;
+  const char *strings = cursor;
+  const uint64_t table_size = header.string_table_size;
+  for (uint32_t i = 0; i < header.edge_num; ++i) {
+    if (links[i] >= header.node_num || parents[i] >= header.node_num) {
+      DAGPF_LOG_ERROR << "invalid edge in plan file." << std::endl;
+      return kPlanFileRetInvalidFormat;
+    }
+  }
+  auto read_param = [params_data](uint32_t i) {
+    PlanFileParam param;
+    memcpy(&param, params_data + sizeof(PlanFileParam) * i, sizeof(param));
+    return param;
+  };
+  for (uint32_t i = 0; i < header.param_num; ++i) {
+    const auto param = read_param(i);
+    if (!InRange(param.key, table_size) || !InRange(param.value, table_size)) {
+      DAGPF_LOG_ERROR << "invalid param in plan file." << std::endl;
+      return kPlanFileRetInvalidFormat;
+    }
+  }
+  auto new_plan = std::make_shared<DAGPlan>();
+  new_plan->nodes_.resize(header.node_num);
+  new_plan->links_.assign(links, links + header.edge_num);
+  new_plan->parents_.assign(parents, parents + header.edge_num);
+  new_plan->string_table_.assign(strings, table_size);
+  new_plan->start_node_id_ = header.start_node_id;
+  new_plan->end_node_id_ = header.end_node_id;
+  const char *table = new_plan->string_table_.data();
+  phase_params.assign(header.node_num, PhaseParamDetail());
+  for (uint32_t id = 0; id < header.node_num; ++id) {
+    const auto &node = nodes[id];
+    if (node.link_begin > node.link_end || node.link_end > header.edge_num ||
+        node.parent_begin > node.parent_end ||
+        node.parent_end > header.edge_num ||
+        node.param_begin > node.param_end ||
+        node.param_end > header.param_num ||
+        !InRange(node.name, table_size) ||
+        !InRange(node.full_name, table_size) ||
+        !InRange(node.class_name, table_size)) {
+      DAGPF_LOG_ERROR << "invalid node in plan file: " << id << std::endl;
+      return kPlanFileRetInvalidFormat;
+    }
+    auto &plan_node = new_plan->nodes_[id];
+    plan_node.id = id;
+    plan_node.indegree = node.indegree;
+    plan_node.level = node.level;
+    plan_node.link_begin = node.link_begin;
+    plan_node.link_end = node.link_end;
+    plan_node.parent_begin = node.parent_begin;
+    plan_node.parent_end = node.parent_end;
+    plan_node.name = std::string_view(table + node.name.offset, node.name.size);
+    plan_node.full_name =
+        std::string_view(table + node.full_name.offset, node.full_name.size);
+    // params are already parsed, typed values are copied as is
+    auto &config_key = phase_params[id].config_key;
+    config_key.name.assign(table + node.class_name.offset,
+                           node.class_name.size);
+    config_key.params.params.reserve(node.param_end - node.param_begin);
+    for (uint32_t i = node.param_begin; i < node.param_end; ++i) {
+      const auto param = read_param(i);
+      auto &value = config_key.params.params.Append(
+          std::string_view(table + param.key.offset, param.key.size));
+      value.str.assign(table + param.value.offset, param.value.size);
+      value.iv = param.iv;
+      value.dv = param.dv;
+      value.bv = param.bv != 0;
+    }
+  }
+  if (!CheckTopology(*new_plan)) {
+    DAGPF_LOG_ERROR << "inconsistent topology in plan file." << std::endl;
+    return kPlanFileRetInvalidFormat;
+  }
+  phase_namespace.assign(strings + header.namespace_offset,
+                         header.namespace_size);
+  dag_plan = std::move(new_plan);
+  return 0;
+}
+
+int PlanFile::Save(const std::string &path, const DAGPlan &dag_plan,
+                   const std::vector<PhaseParamDetail> &phase_params,
+                   const std::string &phase_namespace) {
+  std::string buffer;
+  int ret = Serialize(dag_plan, phase_params, phase_namespace, buffer);
+  if (ret != 0) return ret;
+  // unique temp file in the same directory, concurrent savers of the same
+  // path never write into one file, the last rename wins with a whole file
+  std::string tmp_path = path + ".XXXXXX";
+  int fd = mkstemp(&tmp_path[0]);
+  if (fd < 0) {
+    DAGPF_LOG_ERROR << "open plan file failed: " << tmp_path << std::endl;
+    return kPlanFileRetOpenFailed;
+  }
+  size_t written = 0;
+  while (written < buffer.size()) {
+    ssize_t n = write(fd, buffer.data() + written, buffer.size() - written);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    written += n;
+  }
+  // mkstemp creates the file with 0600, plan files are readable by others
+  if (written != buffer.size() || fchmod(fd, 0644) != 0 || fsync(fd) != 0) {
+    close(fd);
+    unlink(tmp_path.c_str());
+    DAGPF_LOG_ERROR << "write plan file failed: " << tmp_path << std::endl;
+    return kPlanFileRetWriteFailed;
+  }
+  if (close(fd) != 0 || rename(tmp_path.c_str(), path.c_str()) != 0) {
+    unlink(tmp_path.c_str());
+    DAGPF_LOG_ERROR << "rename plan file failed: " << path << std::endl;
+    return kPlanFileRetWriteFailed;
+  }
+  return 0;
+}
+
+int PlanFile::Load(const std::string &path, DAGPlanPtr &dag_plan,
+                   std::vector<PhaseParamDetail> &phase_params,
+                   std::string &phase_namespace) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    DAGPF_LOG_ERROR << "open plan file failed: " << path << std::endl;
+    return kPlanFileRetOpenFailed;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+    close(fd);
+    DAGPF_LOG_ERROR << "invalid plan file: " << path << std::endl;
+    return kPlanFileRetInvalidFormat;
+  }
+  const size_t size = file_stat.st_size;
+  void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    DAGPF_LOG_ERROR << "mmap plan file failed: " << path << std::endl;
+    return kPlanFileRetOpenFailed;
+  }
+  int ret = Parse(static_cast<const char *>(data), size, dag_plan,
+                  phase_params, phase_namespace);
+  munmap(data, size);
+  return ret;
+}
+
+}  // namespace yapf
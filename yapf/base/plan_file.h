@@ -0,0 +1,51 @@
+// File Name: plan_file.h
+// Description: 编译后调度计划的二进制文件格式
+//
+// 文件布局(本机字节序，各段4字节对齐):
+//   header | node table | links | parents | params | string table
+// 节点名称、Phase类名及参数键值均为字符串表中的区间(已去重)，
+// 参数同时保存解析后的整数、浮点及布尔值，加载时不再解析
+// 加载时mmap整个文件，校验checksum后按段整体拷贝，不逐节点分配拓扑存储
+
+#ifndef PLAN_FILE_H_
+#define PLAN_FILE_H_
+
+#include <string>
+#include <vector>
+
+#include "yapf/base/dag_processing.h"
+#include "yapf/base/phase_common.h"
+
+namespace yapf {
+
+enum EPlanFileRet {
+  kPlanFileRetOpenFailed = 80200,
+  kPlanFileRetWriteFailed,
+  kPlanFileRetInvalidFormat,
+  kPlanFileRetChecksumMismatch,
+};
+
+class PlanFile {
+ public:
+  // 序列化DAG计划及预解析的Phase参数
+  static int Serialize(const DAGPlan &dag_plan,
+                       const std::vector<PhaseParamDetail> &phase_params,
+                       const std::string &phase_namespace, std::string &buffer);
+  // 从内存解析，data需4字节对齐
+  static int Parse(const char *data, size_t size, DAGPlanPtr &dag_plan,
+                   std::vector<PhaseParamDetail> &phase_params,
+                   std::string &phase_namespace);
+  // 写入同目录下唯一的临时文件并fsync后rename，并发保存同一路径时
+  // 不会得到不完整或交错的计划文件
+  static int Save(const std::string &path, const DAGPlan &dag_plan,
+                  const std::vector<PhaseParamDetail> &phase_params,
+                  const std::string &phase_namespace);
+  // mmap方式加载
+  static int Load(const std::string &path, DAGPlanPtr &dag_plan,
+                  std::vector<PhaseParamDetail> &phase_params,
+                  std::string &phase_namespace);
+};
+
+}  // namespace yapf
+
+#endif
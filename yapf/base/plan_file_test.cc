@@ -0,0 +1,233 @@
+// File Name: plan_file_test.cc
+// Description:
+
+#include "yapf/base/plan_file.h"
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+namespace yapf {
+
+static void CompileTestPlan(DAGPlanPtr &plan,
+                            std::vector<PhaseParamDetail> &params) {
+  DAG dag;
+  std::vector<std::pair<std::string, std::string> > pairs;
+  std::vector<std::string> single_nodes;
+  std::vector<std::string> exprs{"a->b", "a->c", "b->d", "c->d"};
+  ASSERT_EQ(0, ParseExprs(exprs, pairs, single_nodes));
+  std::unordered_map<std::string, std::string> alias_map{
+      {"a", "PhaseA(cost_hint:5)"},
+      {"b", "PhaseB(map:true,name:x)"},
+      {"c", "PhaseB(map:true,name:x)"},
+      {"d", "PhaseD"},
+      {"StartPhase", "StartPhase"},
+      {"EndPhase", "EndPhase"}};
+  ASSERT_EQ(0, dag.AddNodeLinks(pairs, single_nodes, alias_map));
+  ASSERT_EQ(0, dag.Init([](const auto &t) -> bool { return true; }));
+  ASSERT_EQ(0, dag.Compile(plan));
+  params.resize(plan->Size());
+  for (uint32_t id = 0; id < plan->Size(); ++id) {
+    params[id].config_key.Parse(plan->GetNode(id).full_name);
+  }
+}
+
+TEST(PlanFileTest, RoundTrip) {
+  DAGPlanPtr plan;
+  std::vector<PhaseParamDetail> params;
+  CompileTestPlan(plan, params);
+  std::string buffer;
+  EXPECT_EQ(0, PlanFile::Serialize(*plan, params, "test_ns", buffer));
+
+  DAGPlanPtr loaded;
+  std::vector<PhaseParamDetail> loaded_params;
+  std::string ns;
+  ASSERT_EQ(0, PlanFile::Parse(buffer.data(), buffer.size(), loaded,
+                               loaded_params, ns));
+  EXPECT_EQ(ns, "test_ns");
+  ASSERT_EQ(loaded->Size(), plan->Size());
+  EXPECT_EQ(loaded->GetEdgeCount(), plan->GetEdgeCount());
+  EXPECT_EQ(loaded->GetStartNodeId(), plan->GetStartNodeId());
+  EXPECT_EQ(loaded->GetEndNodeId(), plan->GetEndNodeId());
+  for (uint32_t id = 0; id < plan->Size(); ++id) {
+    const auto &node = plan->GetNode(id);
+    const auto &loaded_node = loaded->GetNode(id);
+    EXPECT_EQ(loaded_node.name, node.name);
+    EXPECT_EQ(loaded_node.full_name, node.full_name);
+    EXPECT_EQ(loaded_node.indegree, node.indegree);
+    EXPECT_EQ(std::vector<uint32_t>(loaded->GetLinks(id).begin(),
+                                    loaded->GetLinks(id).end()),
+              std::vector<uint32_t>(plan->GetLinks(id).begin(),
+                                    plan->GetLinks(id).end()));
+    EXPECT_EQ(loaded->GetParents(id).size(), plan->GetParents(id).size());
+    const auto &key = params[id].config_key;
+    const auto &loaded_key = loaded_params[id].config_key;
+    EXPECT_EQ(loaded_key.name, key.name);
+    EXPECT_EQ(loaded_key.params.params.size(), key.params.params.size());
+    for (const auto &item : key.params.params) {
+      EXPECT_EQ(loaded_key.params[item.first].str, item.second.str);
+      EXPECT_EQ(loaded_key.params[item.first].iv, item.second.iv);
+      EXPECT_EQ(loaded_key.params[item.first].dv, item.second.dv);
+      EXPECT_EQ(loaded_key.params[item.first].bv, item.second.bv);
+    }
+  }
+  // 重复的名称及参数只存一份
+  std::string buffer2;
+  EXPECT_EQ(0, PlanFile::Serialize(*loaded, loaded_params, ns, buffer2));
+  EXPECT_EQ(buffer2.size(), buffer.size());
+}
+
+TEST(PlanFileTest, Corrupted) {
+  DAGPlanPtr plan;
+  std::vector<PhaseParamDetail> params;
+  CompileTestPlan(plan, params);
+  std::string buffer;
+  EXPECT_EQ(0, PlanFile::Serialize(*plan, params, "test_ns", buffer));
+
+  DAGPlanPtr loaded;
+  std::vector<PhaseParamDetail> loaded_params;
+  std::string ns;
+  std::string bad = buffer;
+  bad[bad.size() - 1] ^= 0x1;
+  EXPECT_EQ(kPlanFileRetChecksumMismatch,
+            PlanFile::Parse(bad.data(), bad.size(), loaded, loaded_params,
+                            ns));
+  bad = buffer;
+  bad[0] = 'X';
+  EXPECT_EQ(kPlanFileRetInvalidFormat,
+            PlanFile::Parse(bad.data(), bad.size(), loaded, loaded_params,
+                            ns));
+  EXPECT_EQ(kPlanFileRetInvalidFormat,
+            PlanFile::Parse(buffer.data(), buffer.size() - 4, loaded,
+                            loaded_params, ns));
+  EXPECT_TRUE(loaded == nullptr);
+}
+
+// 按文件布局改写节点表或出边后重新计算checksum
+static constexpr size_t kHeaderSize = 56;
+static constexpr size_t kChecksumOffset = 48;
+static constexpr size_t kNodeSize = 56;
+
+static void UpdateChecksum(std::string &buffer) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = kHeaderSize; i < buffer.size(); ++i) {
+    hash ^= static_cast<unsigned char>(buffer[i]);
+    hash *= 1099511628211ULL;
+  }
+  memcpy(&buffer[kChecksumOffset], &hash, sizeof(hash));
+}
+
+TEST(PlanFileTest, InconsistentTopology) {
+  DAGPlanPtr plan;
+  std::vector<PhaseParamDetail> params;
+  CompileTestPlan(plan, params);
+  std::string buffer;
+  EXPECT_EQ(0, PlanFile::Serialize(*plan, params, "test_ns", buffer));
+  const uint32_t end_id = plan->GetEndNodeId();
+  const size_t end_node_offset = kHeaderSize + kNodeSize * end_id;
+  const size_t links_offset = kHeaderSize + kNodeSize * plan->Size();
+
+  DAGPlanPtr loaded;
+  std::vector<PhaseParamDetail> loaded_params;
+  std::string ns;
+  // indegree does not match the parents, EndPhase would never run
+  std::string bad = buffer;
+  int32_t indegree = plan->GetNode(end_id).indegree + 1;
+  memcpy(&bad[end_node_offset], &indegree, sizeof(indegree));
+  UpdateChecksum(bad);
+  EXPECT_EQ(kPlanFileRetInvalidFormat,
+            PlanFile::Parse(bad.data(), bad.size(), loaded, loaded_params,
+                            ns));
+  // level is not the longest path
+  bad = buffer;
+  uint32_t level = plan->GetNode(end_id).level + 1;
+  memcpy(&bad[end_node_offset + sizeof(int32_t)], &level, sizeof(level));
+  UpdateChecksum(bad);
+  EXPECT_EQ(kPlanFileRetInvalidFormat,
+            PlanFile::Parse(bad.data(), bad.size(), loaded, loaded_params,
+                            ns));
+  // links and parents disagree
+  bad = buffer;
+  uint32_t link;
+  memcpy(&link, &bad[links_offset], sizeof(link));
+  link = (link + 1) % plan->Size();
+  memcpy(&bad[links_offset], &link, sizeof(link));
+  UpdateChecksum(bad);
+  EXPECT_EQ(kPlanFileRetInvalidFormat,
+            PlanFile::Parse(bad.data(), bad.size(), loaded, loaded_params,
+                            ns));
+  EXPECT_TRUE(loaded == nullptr);
+  // untouched buffer with a recomputed checksum still loads
+  bad = buffer;
+  UpdateChecksum(bad);
+  EXPECT_EQ(0, PlanFile::Parse(bad.data(), bad.size(), loaded, loaded_params,
+                               ns));
+}
+
+TEST(PlanFileTest, SaveLoad) {
+  DAGPlanPtr plan;
+  std::vector<PhaseParamDetail> params;
+  CompileTestPlan(plan, params);
+  std::string path =
+      "/tmp/plan_file_test." + std::to_string(getpid()) + ".plan";
+  EXPECT_EQ(0, PlanFile::Save(path, *plan, params, "test_ns"));
+
+  DAGPlanPtr loaded;
+  std::vector<PhaseParamDetail> loaded_params;
+  std::string ns;
+  EXPECT_EQ(0, PlanFile::Load(path, loaded, loaded_params, ns));
+  ASSERT_TRUE(loaded != nullptr);
+  EXPECT_EQ(loaded->Size(), plan->Size());
+  EXPECT_EQ(ns, "test_ns");
+  std::vector<uint32_t> order, loaded_order;
+  plan->GetTopologyOrder(order);
+  loaded->GetTopologyOrder(loaded_order);
+  EXPECT_EQ(order, loaded_order);
+  unlink(path.c_str());
+  EXPECT_EQ(kPlanFileRetOpenFailed,
+            PlanFile::Load(path, loaded, loaded_params, ns));
+}
+
+TEST(PlanFileTest, ConcurrentSave) {
+  DAGPlanPtr plan;
+  std::vector<PhaseParamDetail> params;
+  CompileTestPlan(plan, params);
+  char dir_template[] = "/tmp/plan_file_test.XXXXXX";
+  ASSERT_TRUE(mkdtemp(dir_template) != nullptr);
+  const std::string dir = dir_template;
+  const std::string path = dir + "/test.plan";
+  // savers of the same path use their own temp files
+  std::vector<std::thread> savers;
+  for (int i = 0; i < 8; ++i) {
+    savers.emplace_back([&]() {
+      for (int j = 0; j < 20; ++j) {
+        EXPECT_EQ(0, PlanFile::Save(path, *plan, params, "test_ns"));
+      }
+    });
+  }
+  for (auto &saver : savers) {
+    saver.join();
+  }
+  DAGPlanPtr loaded;
+  std::vector<PhaseParamDetail> loaded_params;
+  std::string ns;
+  EXPECT_EQ(0, PlanFile::Load(path, loaded, loaded_params, ns));
+  EXPECT_EQ(0, access(path.c_str(), R_OK));
+  // no temp file is left behind
+  std::vector<std::string> files;
+  DIR *dir_ptr = opendir(dir.c_str());
+  ASSERT_TRUE(dir_ptr != nullptr);
+  while (auto *entry = readdir(dir_ptr)) {
+    if (entry->d_name[0] != '.') files.emplace_back(entry->d_name);
+  }
+  closedir(dir_ptr);
+  EXPECT_EQ(std::vector<std::string>{"test.plan"}, files);
+  unlink(path.c_str());
+  rmdir(dir.c_str());
+}
+
+}  // namespace yapf
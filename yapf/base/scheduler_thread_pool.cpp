@@ -5,7 +5,9 @@
 
 #include "yapf/base/scheduler_thread_pool.h"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <functional>
 #include <type_traits>
 
@@ -14,6 +16,21 @@
 
 namespace yapf {
 
+namespace {
+// worker序号，按线程池区分
+struct WorkerSlot {
+  const SchedulerThreadPool *pool{nullptr};
+  int index{-1};
+};
+thread_local WorkerSlot t_worker_slot;
+
+int64_t SteadyNowUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+}  // namespace
+
 int SchedulerThreadPool::Init(const SchedulerThreadPoolOption &option) {
   assert(!option.scheduler_name.empty());
   size_t start_thread_num = option.thread_num;
@@ -21,6 +38,14 @@ int SchedulerThreadPool::Init(const SchedulerThreadPoolOption &option) {
     start_thread_num = 4;
   }
   // job_queue_.init(option.max_queue_size);
+  for (size_t i = 0; i < start_thread_num; ++i) {
+    local_queues_.emplace_back(new Utils::SimpleBlockingQueue<JobClosure>());
+  }
+  local_push_us_.reset(new std::atomic<int64_t>[start_thread_num]);
+  for (size_t i = 0; i < start_thread_num; ++i) {
+    local_push_us_[i].store(0, std::memory_order_relaxed);
+  }
+  steal_delay_us_ = option.steal_delay_us;
   while (start_thread_num--) {
     auto *t = SchedulerThreadClassRegister::GetInstance()->CreateInstance(
         option.scheduler_name, this);
@@ -39,32 +64,118 @@ int SchedulerThreadPool::Submit(JobClosure &&t) {
   // if (0 == job_queue_.enqueue(jc, false)) {
   // if (job_queue_.push(jc)) {
   if (0 == job_queue_.push_back(std::move(t))) {
-    // if (is_empty) {
-    // Notify();
+    // idle workers count themselves before checking the queues
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (idle_workers_.load() > 0) {
+      Notify();
+    }
     return 0;
-    //}
   }
   return -1;
 }
 
+int SchedulerThreadPool::SubmitAffinity(JobClosure &&t, int worker) {
+  if (worker >= 0 && worker == GetCurrentWorker()) {
+    auto &local_queue = *local_queues_[worker];
+    // one pending job at most, more would wait behind the busy worker
+    if (local_queue.empty()) {
+      local_push_us_[worker].store(SteadyNowUs(), std::memory_order_relaxed);
+      local_queue.push_back(std::move(t));
+      local_placed_count_.fetch_add(1, std::memory_order_relaxed);
+      // this worker picks it up once the current job returns, a woken idle
+      // worker steals it only if the current job keeps running
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (idle_workers_.load() > 0) {
+        Notify();
+      }
+      return 0;
+    }
+  }
+  return Submit(std::move(t));
+}
+
+bool SchedulerThreadPool::Steal(int worker, JobClosure &t,
+                                int64_t &next_steal_us) {
+  next_steal_us = 0;
+  const int queue_num = local_queues_.size();
+  const int64_t now_us = SteadyNowUs();
+  for (int i = 1; i <= queue_num; ++i) {
+    int victim = (worker + i + queue_num) % queue_num;
+    if (victim == worker || local_queues_[victim]->empty()) continue;
+    const int64_t steal_us =
+        local_push_us_[victim].load(std::memory_order_relaxed) +
+        steal_delay_us_;
+    if (steal_us > now_us) {
+      // the owner may still pick it up next
+      if (next_steal_us == 0 || steal_us < next_steal_us) {
+        next_steal_us = steal_us;
+      }
+      continue;
+    }
+    if (local_queues_[victim]->try_pop_front(t)) {
+      stolen_count_.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+  return false;
+}
+
+int SchedulerThreadPool::GetCurrentWorker() const {
+  return t_worker_slot.pool == this ? t_worker_slot.index : -1;
+}
+
 bool SchedulerThreadPool::Get(JobClosure &t, size_t waitms) {
-  // Wait(waitms);
-  // DAGPF_LOG_INFO << "get job...." << std::endl;
-  JobClosure *jc = nullptr;
-  // if (0 != job_queue_.dequeue(jc, false)) {
-  return job_queue_.pop_front(t, waitms);
-  // if (!job_queue_.pop(jc)) {
-  //   Wait(waitms);
-  //   if (!job_queue_.pop(jc)) {
-  //   // if (0 != job_queue_.dequeue(jc, false)) {
-  //     DAGPF_LOG_INFO << "get job failed." << std::endl;
-  //     return false;
-  //   }
-  // }
-  // DAGPF_LOG_INFO << "get a job." << std::endl;
-  // std::unique_ptr<JobClosure> jc_guarder(jc);
-  // t.swap(*jc);
-  // return true;
+  if (t_worker_slot.pool != this) {
+    t_worker_slot.pool = this;
+    int index = next_worker_.fetch_add(1, std::memory_order_relaxed);
+    t_worker_slot.index =
+        index < static_cast<int>(local_queues_.size()) ? index : -1;
+  }
+  const int worker = t_worker_slot.index;
+  if (worker >= 0 && local_queues_[worker]->try_pop_front(t)) {
+    return true;
+  }
+  if (job_queue_.try_pop_front(t)) {
+    return true;
+  }
+  // counted as idle before checking the queues, submitters check it after
+  // pushing, so a new job is either seen here or followed by a notify
+  idle_workers_.fetch_add(1);
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(waitms);
+  bool ret = false;
+  while (true) {
+    uint64_t notify_seq;
+    {
+      std::lock_guard<std::mutex> locker(cond_mutex_);
+      notify_seq = notify_seq_;
+    }
+    if (job_queue_.try_pop_front(t)) {
+      ret = true;
+      break;
+    }
+    // steal jobs left behind busy workers
+    int64_t next_steal_us = 0;
+    if (Steal(worker, t, next_steal_us)) {
+      ret = true;
+      break;
+    }
+    auto until = deadline;
+    if (next_steal_us > 0) {
+      until = std::min(until, std::chrono::steady_clock::time_point(
+                                  std::chrono::microseconds(next_steal_us)));
+    }
+    if (std::chrono::steady_clock::now() >= until) {
+      if (until == deadline) break;
+      continue;
+    }
+    std::unique_lock<std::mutex> locker(cond_mutex_);
+    cond_.wait_until(locker, until, [this, notify_seq]() {
+      return notify_seq_ != notify_seq;
+    });
+  }
+  idle_workers_.fetch_sub(1);
+  return ret;
 }
 
 bool SchedulerThreadPool::Empty() {
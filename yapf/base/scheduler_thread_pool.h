@@ -35,6 +35,8 @@ struct SchedulerThreadPoolOption {
   std::string scheduler_name{"default"};
   uint32_t thread_num{4};
   uint32_t max_queue_size{10000};
+  // 亲和提交的job在所属worker上等待超过该时长仍未执行时，空闲worker窃取
+  uint32_t steal_delay_us{200};
   SchedulerThreadOption thread_option;
 };
 
@@ -66,16 +68,36 @@ class SchedulerThreadPool {
   ~SchedulerThreadPool() = default; 
   int Init(const SchedulerThreadPoolOption &option);
   int Submit(JobClosure &&t);
+  // 亲和提交: 当前线程即worker且其本地队列为空时放入本地队列，
+  // 当前job返回后由同一worker执行; 当前job运行超过steal_delay_us时
+  // 由被唤醒的空闲worker窃取，否则退化为Submit
+  int SubmitAffinity(JobClosure &&t, int worker);
+  // 当前线程的worker序号，非本线程池worker返回-1
+  int GetCurrentWorker() const;
+  // 依次从本地队列、共享队列、其他worker本地队列(窃取)获取
   bool Get(JobClosure &t, size_t);
+  // 亲和提交放入本地队列的job数，及其中被其他worker窃取的数量
+  uint64_t GetLocalPlacedCount() const {
+    return local_placed_count_.load(std::memory_order_relaxed);
+  }
+  uint64_t GetStolenCount() const {
+    return stolen_count_.load(std::memory_order_relaxed);
+  }
   bool Empty();
   int Start();
   void Stop();
 
  private:
+  // 空闲worker在cond_上等待，Submit及SubmitAffinity有空闲worker时唤醒
   void Notify() {
-    // using condition variable
+    {
+      std::lock_guard<std::mutex> locker(cond_mutex_);
+      ++notify_seq_;
+    }
     cond_.notify_one();
   }
+  // 窃取等待已超过steal_delay_us的本地job，否则输出最早可窃取的时间
+  bool Steal(int worker, JobClosure &t, int64_t &next_steal_us);
 
   void Wait(uint64_t timeout_ms) {
     if (timeout_ms == 0) return;
@@ -87,8 +109,19 @@ class SchedulerThreadPool {
   std::atomic<bool> has_inited_{false};
   std::condition_variable cond_;
   std::mutex cond_mutex_;
-  std::vector<std::unique_ptr<SchedulerThreadBase>> job_threads_;
   Utils::SimpleBlockingQueue<JobClosure> job_queue_;
+  // 每个worker一个本地队列，worker首次Get时分配序号
+  std::vector<std::unique_ptr<Utils::SimpleBlockingQueue<JobClosure>>>
+      local_queues_;
+  std::unique_ptr<std::atomic<int64_t>[]> local_push_us_;  // 本地job放入时间
+  std::atomic<int> next_worker_{0};
+  std::atomic<int> idle_workers_{0};  // 正在窃取或等待任务的worker数
+  uint64_t notify_seq_{0};            // cond_mutex_保护
+  int64_t steal_delay_us_{200};
+  std::atomic<uint64_t> local_placed_count_{0};
+  std::atomic<uint64_t> stolen_count_{0};
+  // 最后声明，析构时先join线程，再释放其访问的队列
+  std::vector<std::unique_ptr<SchedulerThreadBase>> job_threads_;
 };
 
 class SchedulerThreadClassRegister
@@ -0,0 +1,86 @@
+// File Name: scheduler_thread_pool_bench.cc
+// Description: 亲和调度基准测试
+// 父job写入上下文数据后提交子job读取，对比共享队列与亲和提交的子job读取耗时
+// 其他worker空闲，共享队列的子job多由其他worker执行; 亲和提交的子job留在
+// 父job的worker上，local_placed/stolen为每次迭代放入本地队列及被窃取的次数
+// bazel run -c opt //yapf/base:scheduler_thread_pool_bench
+// cache miss可配合perf stat -e cache-misses,LLC-load-misses观察
+
+#include <chrono>
+#include <future>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "yapf/base/scheduler_thread_pool.h"
+
+namespace yapf {
+
+static SchedulerThreadPool *GetPool() {
+  static SchedulerThreadPool *pool = []() {
+    auto *new_pool = new SchedulerThreadPool();
+    SchedulerThreadPoolOption option;
+    option.scheduler_name = "default";
+    option.thread_num = 4;
+    new_pool->Init(option);
+    new_pool->Start();
+    return new_pool;
+  }();
+  return pool;
+}
+
+static void BM_ParentChild(benchmark::State &state) {
+  const bool affinity = state.range(0) != 0;
+  std::vector<uint64_t> context_data(state.range(1) / sizeof(uint64_t));
+  auto *pool = GetPool();
+  const uint64_t placed_count = pool->GetLocalPlacedCount();
+  const uint64_t stolen_count = pool->GetStolenCount();
+  int64_t child_read_ns = 0;
+  uint64_t round = 0;
+  for (auto _ : state) {
+    std::promise<int64_t> done;
+    auto done_future = done.get_future();
+    ++round;
+    pool->Submit([pool, affinity, round, &context_data, &done]() {
+      // parent writes the context
+      for (size_t i = 0; i < context_data.size(); ++i) {
+        context_data[i] = i ^ round;
+      }
+      JobClosure child = [&context_data, &done]() {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t sum = 0;
+        for (auto value : context_data) {
+          sum += value;
+        }
+        benchmark::DoNotOptimize(sum);
+        done.set_value(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::steady_clock::now() - start)
+                           .count());
+      };
+      if (affinity) {
+        pool->SubmitAffinity(std::move(child), pool->GetCurrentWorker());
+      } else {
+        pool->Submit(std::move(child));
+      }
+    });
+    child_read_ns += done_future.get();
+  }
+  state.counters["child_read_ns"] = benchmark::Counter(
+      child_read_ns, benchmark::Counter::kAvgIterations);
+  state.counters["local_placed"] = benchmark::Counter(
+      pool->GetLocalPlacedCount() - placed_count,
+      benchmark::Counter::kAvgIterations);
+  state.counters["stolen"] = benchmark::Counter(
+      pool->GetStolenCount() - stolen_count,
+      benchmark::Counter::kAvgIterations);
+  state.SetBytesProcessed(state.iterations() * state.range(1));
+}
+
+BENCHMARK(BM_ParentChild)
+    ->ArgNames({"affinity", "bytes"})
+    ->ArgsProduct({{0, 1}, {64 << 10, 256 << 10, 1 << 20}})
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
+
+}  // namespace yapf
+
+BENCHMARK_MAIN();
@@ -0,0 +1,175 @@
+// File Name: scheduler_thread_pool_test.cc
+// Description:
+
+#include "yapf/base/scheduler_thread_pool.h"
+
+#include <chrono>
+#include <future>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+namespace yapf {
+
+class SchedulerThreadPoolTest : public ::testing::Test {
+ public:
+  void SetUp() override {
+    SchedulerThreadPoolOption option;
+    option.scheduler_name = "default";
+    option.thread_num = 4;
+    // long enough for a parent job to return under a loaded test machine
+    option.steal_delay_us = 5000;
+    EXPECT_EQ(0, pool.Init(option));
+    EXPECT_EQ(0, pool.Start());
+  }
+  void TearDown() override { pool.Stop(); }
+
+ protected:
+  SchedulerThreadPool pool;
+};
+
+TEST_F(SchedulerThreadPoolTest, Affinity) {
+  EXPECT_EQ(-1, pool.GetCurrentWorker());
+  // keep the other workers busy, the child waits for the parent's worker
+  std::promise<void> release;
+  std::shared_future<void> release_future = release.get_future();
+  std::atomic<int> blocked{0};
+  for (int i = 0; i < 3; ++i) {
+    pool.Submit([&blocked, release_future]() {
+      blocked.fetch_add(1);
+      release_future.wait();
+    });
+  }
+  while (blocked.load() != 3) {
+    std::this_thread::yield();
+  }
+  const uint64_t placed_count = pool.GetLocalPlacedCount();
+  int same_thread_count = 0;
+  for (int i = 0; i < 20; ++i) {
+    std::promise<std::thread::id> parent_thread, child_thread;
+    auto parent_future = parent_thread.get_future();
+    auto child_future = child_thread.get_future();
+    pool.Submit([this, &parent_thread, &child_thread]() {
+      int worker = pool.GetCurrentWorker();
+      EXPECT_GE(worker, 0);
+      pool.SubmitAffinity(
+          [&child_thread]() {
+            child_thread.set_value(std::this_thread::get_id());
+          },
+          worker);
+      parent_thread.set_value(std::this_thread::get_id());
+    });
+    if (parent_future.get() == child_future.get()) {
+      ++same_thread_count;
+    }
+  }
+  release.set_value();
+  EXPECT_EQ(20, same_thread_count);
+  EXPECT_EQ(placed_count + 20, pool.GetLocalPlacedCount());
+}
+
+TEST_F(SchedulerThreadPoolTest, LocalPlacement) {
+  // idle workers do not take the child from a parent that returns at once
+  const uint64_t placed_count = pool.GetLocalPlacedCount();
+  const uint64_t stolen_count = pool.GetStolenCount();
+  int same_thread_count = 0;
+  for (int i = 0; i < 20; ++i) {
+    std::promise<std::thread::id> parent_thread, child_thread;
+    std::promise<void> sibling_done;
+    auto parent_future = parent_thread.get_future();
+    auto child_future = child_thread.get_future();
+    auto sibling_future = sibling_done.get_future();
+    pool.Submit([this, &parent_thread, &child_thread, &sibling_done]() {
+      int worker = pool.GetCurrentWorker();
+      pool.SubmitAffinity(
+          [&child_thread]() {
+            child_thread.set_value(std::this_thread::get_id());
+          },
+          worker);
+      // one pending job per worker, the sibling goes to the shared queue
+      pool.SubmitAffinity([&sibling_done]() { sibling_done.set_value(); },
+                          worker);
+      parent_thread.set_value(std::this_thread::get_id());
+    });
+    if (parent_future.get() == child_future.get()) {
+      ++same_thread_count;
+    }
+    sibling_future.wait();
+  }
+  EXPECT_EQ(20, same_thread_count);
+  EXPECT_EQ(placed_count + 20, pool.GetLocalPlacedCount());
+  EXPECT_EQ(stolen_count, pool.GetStolenCount());
+}
+
+TEST_F(SchedulerThreadPoolTest, BusyWorker) {
+  // the parent keeps its worker busy, an idle worker is woken and steals the
+  // child after steal_delay_us instead of its 50ms wait timing out
+  // all workers start waiting at the same time, none would wake up soon
+  std::promise<void> release;
+  std::shared_future<void> release_future = release.get_future();
+  std::atomic<int> blocked{0};
+  for (int i = 0; i < 4; ++i) {
+    pool.Submit([&blocked, release_future]() {
+      blocked.fetch_add(1);
+      release_future.wait();
+    });
+  }
+  while (blocked.load() != 4) {
+    std::this_thread::yield();
+  }
+  release.set_value();
+  std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  const uint64_t stolen_count = pool.GetStolenCount();
+  std::promise<std::thread::id> child_thread;
+  auto child_future = child_thread.get_future();
+  std::promise<std::thread::id> parent_thread;
+  auto parent_future = parent_thread.get_future();
+  pool.Submit([this, &child_thread, &parent_thread]() {
+    pool.SubmitAffinity(
+        [&child_thread]() {
+          child_thread.set_value(std::this_thread::get_id());
+        },
+        pool.GetCurrentWorker());
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    parent_thread.set_value(std::this_thread::get_id());
+  });
+  ASSERT_EQ(std::future_status::ready,
+            child_future.wait_for(std::chrono::milliseconds(30)));
+  EXPECT_NE(parent_future.get(), child_future.get());
+  EXPECT_EQ(stolen_count + 1, pool.GetStolenCount());
+}
+
+TEST_F(SchedulerThreadPoolTest, Fallback) {
+  // not a worker of the pool, goes to the shared queue
+  const uint64_t placed_count = pool.GetLocalPlacedCount();
+  std::promise<void> done;
+  EXPECT_EQ(0, pool.SubmitAffinity([&done]() { done.set_value(); }, 0));
+  EXPECT_EQ(std::future_status::ready,
+            done.get_future().wait_for(std::chrono::seconds(5)));
+  EXPECT_EQ(placed_count, pool.GetLocalPlacedCount());
+}
+
+TEST_F(SchedulerThreadPoolTest, Steal) {
+  // the owner keeps busy, another worker steals the pending job
+  std::promise<std::thread::id> child_thread;
+  auto child_future = child_thread.get_future();
+  std::promise<void> parent_done;
+  auto parent_future = parent_done.get_future();
+  std::thread::id parent_id;
+  pool.Submit([this, &child_thread, &parent_done, &parent_id]() {
+    parent_id = std::this_thread::get_id();
+    pool.SubmitAffinity(
+        [&child_thread]() {
+          child_thread.set_value(std::this_thread::get_id());
+        },
+        pool.GetCurrentWorker());
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    parent_done.set_value();
+  });
+  ASSERT_EQ(std::future_status::ready,
+            child_future.wait_for(std::chrono::milliseconds(400)));
+  parent_future.wait();
+  EXPECT_NE(parent_id, child_future.get());
+}
+
+}  // namespace yapf
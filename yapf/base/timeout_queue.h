@@ -57,6 +57,9 @@ class TimeoutQueue {
 
   bool empty() const;
 
+  // 最早的超时时间(ms)，队列为空时返回-1
+  int64_t nextExpireTime() const;
+
  private:
   TIME_MAP_TYPE m_timeMap;  // 超时表
   DATA_MAP_TYPE m_idMap;    // 数据表
@@ -125,6 +128,11 @@ bool TimeoutQueue<T>::empty() const {
   return m_timeMap.empty();
 }
 
+template <typename T>
+int64_t TimeoutQueue<T>::nextExpireTime() const {
+  return m_timeMap.empty() ? -1 : m_timeMap.begin()->first;
+}
+
 // 弹出特定id
 template <typename T>
 int TimeoutQueue<T>::pop(size_t id, T &item) {
@@ -8,6 +8,7 @@
 
 #include <semaphore.h>
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <condition_variable>
@@ -78,21 +79,30 @@ class TimerThread {
  private:
   void notify() { m_cond.notify_one(); }
 
-  void wait(uint64_t timeout_ms) {
+  // 等待至最早的超时时间，最长kMaxWaitMs
+  // 与push使用同一把锁，计算等待时间后新加入的定时器不会错过通知
+  void wait(std::unique_lock<std::mutex>& locker) {
+    static constexpr int64_t kMaxWaitMs = 100;
+    int64_t timeout_ms = kMaxWaitMs;
+    int64_t expire_ms = m_timedQueue.nextExpireTime();
+    if (expire_ms >= 0) {
+      int64_t now_ms = static_cast<int64_t>(Utils::getNowMs());
+      timeout_ms =
+          std::min(timeout_ms, std::max<int64_t>(expire_ms - now_ms, 0));
+    }
     if (timeout_ms > 0) {
-      std::unique_lock<std::mutex> locker(m_condMutex);
       m_cond.wait_for(locker, std::chrono::milliseconds(timeout_ms));
     }
   }
 
   int run() {
     while (!m_stopFlag.load()) {
-      // scan
-      wait(100);
-      if (m_stopFlag.load()) break;
       std::vector<TimerCBType> vec;
       {
-        std::lock_guard<std::mutex> locker(m_mutex);
+        // scan
+        std::unique_lock<std::mutex> locker(m_mutex);
+        wait(locker);
+        if (m_stopFlag.load()) break;
         m_timedQueue.timeout(&vec);
       }
       if (!vec.empty()) {
@@ -113,7 +123,6 @@ class TimerThread {
   std::atomic<bool> m_startFlag{false};
   std::mutex m_mutex;  // data access mutex
   std::condition_variable m_cond;
-  std::mutex m_condMutex;
   std::atomic<bool> m_stopFlag{false};
   TimeoutQueue<TimerCBType> m_timedQueue;
 };
@@ -38,6 +38,14 @@ struct Utils {
         .count();
   }
 
+  // get now microseconds
+  static uint64_t getNowUs() {
+    auto p = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               p.time_since_epoch())
+        .count();
+  }
+
   static uint64_t getNow() {
     auto p = std::chrono::high_resolution_clock::now();
     return std::chrono::duration_cast<std::chrono::seconds>(
@@ -92,6 +100,17 @@ struct Utils {
       return true;
     }
 
+    // 不等待
+    bool try_pop_front(T &t) {
+      std::unique_lock<std::mutex> locker(m_mutex);
+      if (m_queue.empty()) {
+        return false;
+      }
+      t = std::move(m_queue.front());
+      m_queue.pop_front();
+      return true;
+    }
+
     bool empty() {
       std::unique_lock<std::mutex> locker(m_mutex);
       return m_queue.empty();
@@ -103,6 +122,63 @@ struct Utils {
     std::mutex m_mutex;
     std::deque<T> m_queue;
   };
+
+  // 有界阻塞队列，满时push阻塞
+  // close后push失败，pop取完剩余元素后失败
+  template <typename T>
+  class BoundedBlockingQueue {
+   public:
+    explicit BoundedBlockingQueue(size_t capacity)
+        : m_capacity(capacity > 0 ? capacity : 1) {}
+
+    bool push(T &&t) {
+      std::unique_lock<std::mutex> locker(m_mutex);
+      m_not_full.wait(locker, [this]() {
+        return m_closed || m_queue.size() < m_capacity;
+      });
+      if (m_closed) return false;
+      m_queue.push_back(std::move(t));
+      locker.unlock();
+      m_not_empty.notify_one();
+      return true;
+    }
+
+    bool pop(T &t) {
+      std::unique_lock<std::mutex> locker(m_mutex);
+      m_not_empty.wait(locker,
+                       [this]() { return m_closed || !m_queue.empty(); });
+      if (m_queue.empty()) return false;
+      t = std::move(m_queue.front());
+      m_queue.pop_front();
+      locker.unlock();
+      m_not_full.notify_one();
+      return true;
+    }
+
+    void close() {
+      {
+        std::unique_lock<std::mutex> locker(m_mutex);
+        m_closed = true;
+      }
+      m_not_full.notify_all();
+      m_not_empty.notify_all();
+    }
+
+    size_t size() {
+      std::unique_lock<std::mutex> locker(m_mutex);
+      return m_queue.size();
+    }
+
+    size_t capacity() const { return m_capacity; }
+
+   private:
+    std::condition_variable m_not_full;
+    std::condition_variable m_not_empty;
+    std::mutex m_mutex;
+    std::deque<T> m_queue;
+    const size_t m_capacity;
+    bool m_closed{false};
+  };
 };
 
 };      // namespace yapf
@@ -5,6 +5,7 @@
 //
 #include "yapf/base/utils.h"
 
+#include <atomic>
 #include <chrono>
 #include <iostream>
 #include <thread>
@@ -64,4 +65,31 @@ TEST(UtilsTest, SimpleBlockingQueueThreading) {
   EXPECT_TRUE(q.empty());
 }
 
+TEST(UtilsTest, BoundedBlockingQueue) {
+  Utils::BoundedBlockingQueue<int> q(2);
+  EXPECT_TRUE(q.push(1));
+  EXPECT_TRUE(q.push(2));
+  // the producer blocks until the consumer takes one
+  std::atomic<bool> pushed{false};
+  std::thread producer{[&q, &pushed]() {
+    pushed.store(q.push(3));
+  }};
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_FALSE(pushed.load());
+  EXPECT_EQ(2u, q.size());
+  int t;
+  EXPECT_TRUE(q.pop(t));
+  EXPECT_EQ(1, t);
+  producer.join();
+  EXPECT_TRUE(pushed.load());
+  q.close();
+  EXPECT_FALSE(q.push(4));
+  // remaining items are still popped after close
+  EXPECT_TRUE(q.pop(t));
+  EXPECT_EQ(2, t);
+  EXPECT_TRUE(q.pop(t));
+  EXPECT_EQ(3, t);
+  EXPECT_FALSE(q.pop(t));
+}
+
 }  // namespace yapf